@@ -0,0 +1,245 @@
+// Large-array helpers for the vector addition benchmarks.
+//
+// large_alloc() places a vector on 2MB huge pages so 150M-element vectors
+// need a few hundred TLB entries instead of hundreds of thousands. It tries
+// reserved huge pages (MAP_HUGETLB) first, then transparent huge pages
+// (madvise(MADV_HUGEPAGE) on a 2MB aligned mapping). Without huge = true it
+// is a plain malloc. Free with large_free() and the same size and flag.
+//
+// stream_peak() measures the host's sustainable memory bandwidth the way the
+// STREAM benchmark does (Copy, Scale, Add and Triad over arrays much larger
+// than the caches, best of STREAM_TIMES runs), so a benchmark can report how
+// close it gets to the machine's peak. Ordinary stores first read each line
+// they write (read-for-ownership), traffic STREAM does not count, so a pass
+// that writes with non-temporal stores must be compared with STREAM run the
+// same way: stream_peak(threads, true) writes with _mm_stream_pd.
+
+#ifndef LARGE_VECTORS_H
+#define LARGE_VECTORS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <immintrin.h>
+
+#define HUGE_PAGE (2UL << 20) // 2MB huge page size on x86-64.
+#define STREAM_ELEMENTS (1L << 24) // Doubles per STREAM array, 128MB each (well past any LLC).
+#define STREAM_TIMES 5 // Runs of each STREAM kernel, the best counts.
+
+// How the last large_alloc() was satisfied: "hugetlb", "thp" or "malloc".
+static const char *large_alloc_kind = "malloc";
+
+// Allocates bytes, on huge pages if huge is set.
+static void *large_alloc(size_t bytes, bool huge)
+{
+    if (!huge)
+    {
+        large_alloc_kind = "malloc";
+        void *ptr = malloc(bytes);
+        if (ptr == NULL)
+        {
+            perror("Couldn't allocate a vector");
+            exit(1);
+        }
+        return ptr;
+    }
+
+    size_t rounded = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+
+    // Reserved huge pages (vm.nr_hugepages), fails if there aren't enough.
+#ifdef MAP_HUGETLB
+    void *ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+    {
+        large_alloc_kind = "hugetlb";
+        return ptr;
+    }
+#endif
+
+    // Transparent huge pages: map an extra page, keep the 2MB aligned part, ask for huge pages.
+    char *raw = (char *) mmap(NULL, rounded + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        perror("Couldn't map a vector");
+        exit(1);
+    }
+    char *aligned = (char *) (((uintptr_t) raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+    if (aligned > raw)
+    {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + rounded, (raw + rounded + HUGE_PAGE) - (aligned + rounded));
+    madvise(aligned, rounded, MADV_HUGEPAGE);
+    large_alloc_kind = "thp";
+    return aligned;
+}
+
+// Frees a large_alloc() allocation.
+static void large_free(void *ptr, size_t bytes, bool huge)
+{
+    if (!huge)
+    {
+        free(ptr);
+        return;
+    }
+    munmap(ptr, (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+}
+
+// Best bandwidth of each STREAM kernel, in GB/s.
+struct stream_result
+{
+    double copy, scale, add, triad;
+    double peak() const
+    {
+        double best = copy;
+        best = scale > best ? scale : best;
+        best = add > best ? add : best;
+        return triad > best ? triad : best;
+    }
+};
+
+struct stream_thread
+{
+    double *a, *b, *c;
+    long start, stop; // Even, so the non-temporal kernels' pairs stay 16 byte aligned.
+    bool streaming;
+    pthread_barrier_t *barrier;
+    std::chrono::high_resolution_clock::time_point *kernel_start; // Shared start of the kernel being timed.
+    double *seconds; // [4 * STREAM_TIMES], written by the barrier's serial thread.
+};
+
+// One thread's share of the STREAM runs. The clock is started and stopped by
+// the serial thread of the barriers either side of a kernel, so each time
+// covers every thread's share. With streaming the kernels store two doubles
+// at a time with _mm_stream_pd.
+static void *stream_worker(void *args)
+{
+    stream_thread *t = (stream_thread *) args;
+    double *a = t->a, *b = t->b, *c = t->c;
+    const double scalar = 3.0;
+    const __m128d s = _mm_set1_pd(scalar);
+
+    for (long i = t->start; i < t->stop; i++)
+    {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+
+    for (int run = 0; run < STREAM_TIMES; run++)
+    {
+        for (int kernel = 0; kernel < 4; kernel++)
+        {
+            if (pthread_barrier_wait(t->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+            {
+                *t->kernel_start = std::chrono::high_resolution_clock::now();
+            }
+            pthread_barrier_wait(t->barrier); // No thread starts before the clock does.
+
+            if (t->streaming)
+            {
+                for (long i = t->start; i < t->stop; i += 2)
+                {
+                    switch (kernel)
+                    {
+                    case 0: _mm_stream_pd(c + i, _mm_load_pd(a + i)); break; // Copy
+                    case 1: _mm_stream_pd(b + i, _mm_mul_pd(s, _mm_load_pd(c + i))); break; // Scale
+                    case 2: _mm_stream_pd(c + i, _mm_add_pd(_mm_load_pd(a + i), _mm_load_pd(b + i))); break; // Add
+                    case 3: _mm_stream_pd(a + i, _mm_add_pd(_mm_load_pd(b + i), _mm_mul_pd(s, _mm_load_pd(c + i)))); break; // Triad
+                    }
+                }
+                _mm_sfence(); // Drain the write-combining buffers before the clock stops.
+            }
+            else
+            {
+                switch (kernel)
+                {
+                case 0: for (long i = t->start; i < t->stop; i++) c[i] = a[i]; break; // Copy
+                case 1: for (long i = t->start; i < t->stop; i++) b[i] = scalar * c[i]; break; // Scale
+                case 2: for (long i = t->start; i < t->stop; i++) c[i] = a[i] + b[i]; break; // Add
+                case 3: for (long i = t->start; i < t->stop; i++) a[i] = b[i] + scalar * c[i]; break; // Triad
+                }
+            }
+
+            if (pthread_barrier_wait(t->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+            {
+                t->seconds[run * 4 + kernel] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::high_resolution_clock::now() - *t->kernel_start).count() / 1e9;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Runs STREAM Copy, Scale, Add and Triad on threads threads over STREAM_ELEMENTS
+// doubles per array, and returns the best bandwidth of each (first run skipped
+// as warm-up, as STREAM does). streaming writes with non-temporal stores.
+static stream_result stream_peak(int threads, bool streaming)
+{
+    double *a = (double *) large_alloc(STREAM_ELEMENTS * sizeof(double), false);
+    double *b = (double *) large_alloc(STREAM_ELEMENTS * sizeof(double), false);
+    double *c = (double *) large_alloc(STREAM_ELEMENTS * sizeof(double), false);
+    double seconds[4 * STREAM_TIMES];
+    std::chrono::high_resolution_clock::time_point kernel_start;
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads);
+    pthread_t *ids = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    stream_thread *work = (stream_thread *) malloc(threads * sizeof(stream_thread));
+    for (int t = 0; t < threads; t++)
+    {
+        stream_thread w = {a, b, c, (STREAM_ELEMENTS * t / threads) & ~1L, (STREAM_ELEMENTS * (t + 1) / threads) & ~1L,
+            streaming, &barrier, &kernel_start, seconds};
+        work[t] = w;
+        pthread_create(&ids[t], NULL, stream_worker, &work[t]);
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(ids[t], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    // Bytes per element moved by each kernel: Copy and Scale 2 arrays, Add and Triad 3.
+    const double bytes[4] = {16, 16, 24, 24};
+    double best[4] = {0, 0, 0, 0};
+    for (int run = 1; run < STREAM_TIMES; run++)
+    {
+        for (int kernel = 0; kernel < 4; kernel++)
+        {
+            double gbs = bytes[kernel] * STREAM_ELEMENTS / seconds[run * 4 + kernel] / 1e9;
+            best[kernel] = gbs > best[kernel] ? gbs : best[kernel];
+        }
+    }
+
+    free(ids);
+    free(work);
+    large_free(a, STREAM_ELEMENTS * sizeof(double), false);
+    large_free(b, STREAM_ELEMENTS * sizeof(double), false);
+    large_free(c, STREAM_ELEMENTS * sizeof(double), false);
+
+    stream_result result = {best[0], best[1], best[2], best[3]};
+    return result;
+}
+
+// Prints the STREAM figures, run with the same kind of stores as the pass
+// being compared, and how much of the peak achieved (GB/s) is.
+static void print_stream_peak(int threads, double achieved, bool streaming)
+{
+    stream_result s = stream_peak(threads, streaming);
+    printf(" STREAM host peak (%d threads, %s stores): Copy %.2f, Scale %.2f, Add %.2f, Triad %.2f GB/s\n",
+        threads, streaming ? "non-temporal" : "ordinary", s.copy, s.scale, s.add, s.triad);
+    if (achieved <= s.peak())
+    {
+        printf(" Achieved %.2f GB/s = %.0f%% of the STREAM peak (%.2f GB/s)\n", achieved, 100 * achieved / s.peak(), s.peak());
+    }
+    else
+    {
+        // Measurement noise, or a pass STREAM's four kernels don't bound.
+        printf(" Achieved %.2f GB/s, above the STREAM peak (%.2f GB/s)\n", achieved, s.peak());
+    }
+}
+
+#endif
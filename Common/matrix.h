@@ -0,0 +1,104 @@
+// Contiguous, 64-byte aligned matrix shared by the matrix multiplication programs.
+//
+// All rows live in one allocation. Each row starts on a cache line boundary
+// and the leading dimension (ld) is padded so that it is never a multiple of
+// 4KB, which would map every row of a column onto the same cache sets.
+// m[i] is a view of row i, so m[i][j] works like the old int** matrices.
+// A Matrix can also wrap memory it does not own, such as an MPI shared
+// memory window, with the (data, rows, cols, ld) constructor.
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#define MATRIX_ALIGN 64         // Cache line / AVX-512 alignment in bytes.
+#define MATRIX_CRITICAL_STRIDE 4096 // Row strides that are multiples of this alias in L1/L2.
+
+template <typename T>
+class Matrix
+{
+public:
+    // Allocates a rows x cols matrix of zeros. pad = false keeps ld == cols,
+    // for buffers handed to code that expects densely packed rows. align can
+    // raise the alignment of the allocation, e.g. to a page for zero-copy OpenCL buffers.
+    Matrix(int rows, int cols, bool pad = true, size_t align = MATRIX_ALIGN)
+        : rows_(rows), cols_(cols), ld_(cols), data_(NULL), owner_(true)
+    {
+        if (pad)
+        {
+            ld_ = padded_ld(cols);
+        }
+
+        size_t bytes = sizeof(T) * size();
+        bytes = ((bytes + align - 1) / align) * align;
+        if (posix_memalign((void **) &data_, align, bytes > 0 ? bytes : align) != 0)
+        {
+            perror("Couldn't allocate the matrix");
+            exit(1);
+        }
+        memset(data_, 0, bytes);
+    }
+
+    // Wraps rows x cols elements at data with leading dimension ld. The memory
+    // stays with its owner and is not freed by the matrix.
+    Matrix(T *data, int rows, int cols, int ld)
+        : rows_(rows), cols_(cols), ld_(ld), data_(data), owner_(false)
+    {
+    }
+
+    ~Matrix()
+    {
+        if (owner_)
+        {
+            free(data_);
+        }
+        data_ = NULL;
+    }
+
+    // Row views.
+    T *operator[](int i) { return data_ + (size_t) i * ld_; }
+    const T *operator[](int i) const { return data_ + (size_t) i * ld_; }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int ld() const { return ld_; }              // Elements between the start of each row.
+    size_t size() const { return (size_t) rows_ * ld_; } // Elements including padding.
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+
+    // Sets every element (padding included) to value.
+    void fill(T value)
+    {
+        for (size_t i=0; i<size(); i++)
+        {
+            data_[i] = value;
+        }
+    }
+
+    // Rounds cols up to whole cache lines, then adds a line if the stride would alias.
+    static int padded_ld(int cols)
+    {
+        int per_line = MATRIX_ALIGN / sizeof(T);
+        int ld = ((cols + per_line - 1) / per_line) * per_line;
+        if ((ld * sizeof(T)) % MATRIX_CRITICAL_STRIDE == 0)
+        {
+            ld += per_line;
+        }
+        return ld;
+    }
+
+private:
+    Matrix(const Matrix &);             // Not copyable, owns its allocation.
+    Matrix &operator=(const Matrix &);
+
+    int rows_;
+    int cols_;
+    int ld_;
+    T *data_;
+    bool owner_; // False for wrapped memory.
+};
+
+#endif
@@ -0,0 +1,221 @@
+// Pipelined distributed matrix multiplication, shared by MPI_MM.cpp and MPI_OpenMP_MM.cpp.
+//
+// B is sent in column panels of PIPE_COLS with MPI_Ibcast, the next panel is
+// in flight while the current one is multiplied, and each finished panel of C
+// goes back to the head node with MPI_Igather. Both B and C panels are double
+// buffered. A communication-only pass is timed first, the overlap reported is
+// the share of that time that is hidden behind the multiplication.
+//
+// The program multiplies one panel through a pipeline_multiply callback:
+//     multiply(panel_b, panel_c, rows, width, pending)
+// computes panel_c (rows x width) = its rows of A x panel_b (n x width), both
+// panels densely packed. MPI only moves nonblocking collectives along when it
+// is called, so the callback should MPI_Testall the PIPE_REQUESTS requests in
+// pending between blocks of its work.
+
+#ifndef MPI_PIPELINE_H
+#define MPI_PIPELINE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mpi.h>
+#include "matrix.h"
+
+#define PIPE_COLS 128 // Columns of B per panel.
+#define PIPE_REQUESTS 5 // A scatter, two B broadcasts and two C gathers in flight.
+
+typedef void (*pipeline_multiply)(const int *panel_b, int *panel_c, int rows, int width, MPI_Request *pending);
+
+// Timings of one pass, in seconds.
+struct pipeline_stats
+{
+    double total;
+    double compute;
+    double wait; // Time blocked waiting on communication.
+};
+
+// Copies columns of panel p of b into a dense rows x width buffer (head node).
+static inline void pipeline_pack_panel(const Matrix<int> &b, int *panel, int p)
+{
+    int j0 = p * PIPE_COLS, width = std::min(PIPE_COLS, b.cols() - j0);
+    for (int k=0; k<b.rows(); k++)
+    {
+        memcpy(panel + (size_t) k * width, b[k] + j0, sizeof(int) * width);
+    }
+}
+
+// Copies a gathered rows x width panel into its columns of c (head node).
+static inline void pipeline_unpack_panel(Matrix<int> &c, const int *panel, int p)
+{
+    int j0 = p * PIPE_COLS, width = std::min(PIPE_COLS, c.cols() - j0);
+    for (int i=0; i<c.rows(); i++)
+    {
+        memcpy(c[i] + j0, panel + (size_t) i * width, sizeof(int) * width);
+    }
+}
+
+// One pass over every panel of B for an n x n product. a holds this rank's
+// rows[rank] rows of A (all of A on the head node, where b and c are the whole
+// matrices, NULL elsewhere). With compute = false the same messages are moved
+// without multiplying, which times the communication on its own.
+static inline pipeline_stats pipeline_pass(Matrix<int> *a, const Matrix<int> *b, Matrix<int> *c, int n,
+    const int *rows, const int *first, pipeline_multiply multiply, bool compute)
+{
+    int num_tasks, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &num_tasks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    pipeline_stats stats = {0, 0, 0};
+    int panels = (n + PIPE_COLS - 1) / PIPE_COLS;
+    int partition = rows[rank];
+
+    // Scatterv counts for A, and Gatherv counts for each C buffer (they must stay
+    // untouched until the nonblocking gather that uses them has finished).
+    int *a_counts = (int *) malloc(num_tasks * sizeof(int));
+    int *a_displs = (int *) malloc(num_tasks * sizeof(int));
+    int *c_counts[2], *c_displs[2];
+    for (int r=0; r<num_tasks; r++)
+    {
+        a_counts[r] = rows[r] * a->ld();
+        a_displs[r] = first[r] * a->ld();
+    }
+
+    // Double buffered panels: B (n x PIPE_COLS), this rank's C (partition x PIPE_COLS)
+    // and on the head node the gathered C (n x PIPE_COLS).
+    Matrix<int> *panel_b[2], *panel_c[2], *gather_c[2] = {NULL, NULL};
+    for (int i=0; i<2; i++)
+    {
+        panel_b[i] = new Matrix<int>(n, PIPE_COLS, false);
+        panel_c[i] = new Matrix<int>(partition, PIPE_COLS, false);
+        c_counts[i] = (int *) malloc(num_tasks * sizeof(int));
+        c_displs[i] = (int *) malloc(num_tasks * sizeof(int));
+        if (rank == 0)
+        {
+            gather_c[i] = new Matrix<int>(n, PIPE_COLS, false);
+        }
+    }
+
+    // pending[0] = A scatter, [1..2] = B broadcasts, [3..4] = C gathers, by buffer.
+    MPI_Request pending[PIPE_REQUESTS] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL,
+        MPI_REQUEST_NULL};
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+
+    // Start sending A and the first panel of B together.
+    if (rank == 0)
+    {
+        MPI_Iscatterv(a->data(), a_counts, a_displs, MPI_INT, MPI_IN_PLACE, a_counts[0], MPI_INT, 0, MPI_COMM_WORLD, &pending[0]);
+        pipeline_pack_panel(*b, panel_b[0]->data(), 0);
+    }
+    else
+    {
+        MPI_Iscatterv(NULL, NULL, NULL, MPI_INT, a->data(), a_counts[rank], MPI_INT, 0, MPI_COMM_WORLD, &pending[0]);
+    }
+    MPI_Ibcast(panel_b[0]->data(), n * std::min(PIPE_COLS, n), MPI_INT, 0, MPI_COMM_WORLD, &pending[1]);
+
+    for (int p=0; p<panels; p++)
+    {
+        int buf = p % 2;
+        int width = std::min(PIPE_COLS, n - p * PIPE_COLS);
+
+        // Wait for this panel of B, and for the C buffer to come free from panel p-2.
+        double wait_start = MPI_Wtime();
+        MPI_Wait(&pending[0], MPI_STATUS_IGNORE);
+        MPI_Wait(&pending[1 + buf], MPI_STATUS_IGNORE);
+        MPI_Wait(&pending[3 + buf], MPI_STATUS_IGNORE);
+        stats.wait += MPI_Wtime() - wait_start;
+
+        if (rank == 0 && p >= 2)
+        {
+            pipeline_unpack_panel(*c, gather_c[buf]->data(), p - 2);
+        }
+
+        // Put the next panel of B in flight before multiplying this one.
+        if (p + 1 < panels)
+        {
+            int next_width = std::min(PIPE_COLS, n - (p + 1) * PIPE_COLS);
+            if (rank == 0)
+            {
+                pipeline_pack_panel(*b, panel_b[1 - buf]->data(), p + 1);
+            }
+            MPI_Ibcast(panel_b[1 - buf]->data(), n * next_width, MPI_INT, 0, MPI_COMM_WORLD, &pending[2 - buf]);
+        }
+
+        if (compute)
+        {
+            double compute_start = MPI_Wtime();
+            memset(panel_c[buf]->data(), 0, sizeof(int) * partition * width);
+            multiply(panel_b[buf]->data(), panel_c[buf]->data(), partition, width, pending);
+            stats.compute += MPI_Wtime() - compute_start;
+        }
+
+        for (int r=0; r<num_tasks; r++)
+        {
+            c_counts[buf][r] = rows[r] * width;
+            c_displs[buf][r] = first[r] * width;
+        }
+        MPI_Igatherv(panel_c[buf]->data(), partition * width, MPI_INT, rank == 0 ? gather_c[buf]->data() : NULL,
+            c_counts[buf], c_displs[buf], MPI_INT, 0, MPI_COMM_WORLD, &pending[3 + buf]);
+    }
+
+    // Drain the last two gathers.
+    for (int p=std::max(0, panels - 2); p<panels; p++)
+    {
+        double wait_start = MPI_Wtime();
+        MPI_Wait(&pending[3 + p % 2], MPI_STATUS_IGNORE);
+        stats.wait += MPI_Wtime() - wait_start;
+        if (rank == 0)
+        {
+            pipeline_unpack_panel(*c, gather_c[p % 2]->data(), p);
+        }
+    }
+    stats.total = MPI_Wtime() - start;
+
+    for (int i=0; i<2; i++)
+    {
+        delete panel_b[i];
+        delete panel_c[i];
+        delete gather_c[i];
+        free(c_counts[i]);
+        free(c_displs[i]);
+    }
+    free(a_counts);
+    free(a_displs);
+    return stats;
+}
+
+// Runs a communication-only pass and a full pass, then rank 0 prints the
+// slowest rank's timings under "Pipelined <label> processing". Collective,
+// returns the full pass's time on the slowest rank (on rank 0).
+static inline double pipeline_run(Matrix<int> *a, const Matrix<int> *b, Matrix<int> *c, int n,
+    const int *rows, const int *first, pipeline_multiply multiply, const char *label, const char *kernel)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    pipeline_stats comm = pipeline_pass(a, b, c, n, rows, first, multiply, false);
+    pipeline_stats run = pipeline_pass(a, b, c, n, rows, first, multiply, true);
+
+    // Slowest rank decides each figure.
+    double local[4] = {run.total, run.compute, run.wait, comm.total}, slowest[4];
+    MPI_Reduce(local, slowest, 4, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0)
+    {
+        double hidden = std::max(0.0, slowest[3] - slowest[2]);
+        int panels = (n + PIPE_COLS - 1) / PIPE_COLS;
+        printf("\n\nPipelined %s processing of a %d X %d Matrix in %d panels of %d columns (%s kernel).\n",
+            label, n, n, panels, PIPE_COLS, kernel);
+        printf("Total time:         %g seconds.\n", slowest[0]);
+        printf("Compute time:       %g seconds.\n", slowest[1]);
+        printf("Communication time: %g seconds. (communication-only pass)\n", slowest[3]);
+        printf("Exposed comm wait:  %g seconds.\n", slowest[2]);
+        printf("Overlap:            %g%%\n\n", slowest[3] > 0 ? 100.0 * hidden / slowest[3] : 0.0);
+    }
+    return slowest[0];
+}
+
+#endif
@@ -0,0 +1,538 @@
+// Reusable OpenCL runtime shared by the OpenCL programs.
+//
+// One OclRuntime picks the device (GPU, else CPU), then creates the context and
+// command queue once. It keeps every program, kernel and buffer it hands out
+// until it is destroyed, so repeated multiplications or vector ops pay the
+// setup cost only once.
+//
+// Program binaries are cached on disk (OCL_CACHE_DIR, default ./.ocl_cache).
+// Each one is keyed by a hash of the source, the build options and the
+// device/driver, so only the first (cold) run on a device compiles from
+// source. Warm runs load the binary. The startup_seconds / build_seconds /
+// cache_hits counters report the difference.
+//
+// Buffers come from a pool. release() returns a buffer to the pool, and the
+// next request with the same flags that fits reuses it instead of allocating.
+//
+// input_buffer() / output_buffer() / read_output() move data without copies
+// where the device allows it. On a CPU device (or any device that shares host
+// memory) the buffers wrap the page-aligned host arrays with CL_MEM_USE_HOST_PTR
+// and nothing is copied. Other devices get pinned CL_MEM_ALLOC_HOST_PTR buffers
+// filled through map/unmap. Output buffers are never uploaded.
+
+#ifndef OCL_RUNTIME_H
+#define OCL_RUNTIME_H
+
+#include <CL/cl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OCL_CACHE_DIR ".ocl_cache" // Default directory for cached program binaries.
+#define OCL_HOST_ALIGN 4096 // Page alignment for host arrays wrapped by zero-copy buffers.
+
+class OclRuntime
+{
+public:
+    // Picks the device and creates the context and the main command queue.
+    // properties are the queue properties, e.g. CL_QUEUE_PROFILING_ENABLE.
+    OclRuntime(cl_command_queue_properties properties = 0)
+        : startup_seconds(0), build_seconds(0), cache_hits(0), cache_misses(0), bytes_copied(0)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        cl_int err;
+
+        device_ = create_device();
+        clGetDeviceInfo(device_, CL_DEVICE_NAME, sizeof(device_name_), device_name_, NULL);
+
+        // CPU devices and integrated GPUs can use host memory in place.
+        cl_device_type type = 0;
+        cl_bool unified = CL_FALSE;
+        clGetDeviceInfo(device_, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+        clGetDeviceInfo(device_, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+        shares_host_memory_ = (type & CL_DEVICE_TYPE_CPU) != 0 || unified == CL_TRUE;
+
+        // The context is the environment kernels run in and memory is managed in.
+        context_ = clCreateContext(NULL, 1, &device_, NULL, NULL, &err);
+        if (err < 0)
+        {
+            perror("Couldn't create a context");
+            exit(1);
+        }
+
+        queue_ = create_queue(properties);
+
+        const char *dir = getenv("OCL_CACHE_DIR");
+        cache_dir_ = dir != NULL ? dir : OCL_CACHE_DIR;
+        mkdir(cache_dir_.c_str(), 0755);
+
+        startup_seconds = seconds_since(start);
+    }
+
+    ~OclRuntime()
+    {
+        for (std::map<cl_mem, pooled_buffer>::iterator it = buffers_.begin(); it != buffers_.end(); ++it)
+        {
+            clReleaseMemObject(it->first);
+        }
+        for (std::map<std::string, cl_kernel>::iterator it = kernels_.begin(); it != kernels_.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+        for (std::map<std::string, cl_program>::iterator it = programs_.begin(); it != programs_.end(); ++it)
+        {
+            if (it->second != NULL)
+            {
+                clReleaseProgram(it->second);
+            }
+        }
+        for (size_t i=0; i<queues_.size(); i++)
+        {
+            clReleaseCommandQueue(queues_[i]);
+        }
+        clReleaseContext(context_);
+    }
+
+    cl_device_id device() const { return device_; }
+    cl_context context() const { return context_; }
+    cl_command_queue queue() const { return queue_; }
+    const char *device_name() const { return device_name_; }
+    bool shares_host_memory() const { return shares_host_memory_; } // True if zero-copy buffers copy nothing.
+
+    // Page-aligned host allocation, rounded up to whole cache lines, that
+    // zero-copy buffers can wrap in place. Release with free().
+    static void *host_alloc(size_t bytes)
+    {
+        void *ptr = NULL;
+        bytes = ((bytes + 63) / 64) * 64;
+        if (posix_memalign(&ptr, OCL_HOST_ALIGN, bytes > 0 ? bytes : 64) != 0)
+        {
+            perror("Couldn't allocate host memory");
+            exit(1);
+        }
+        return ptr;
+    }
+
+    // Creates another command queue on the device, released with the runtime.
+    cl_command_queue create_queue(cl_command_queue_properties properties = 0)
+    {
+        cl_int err;
+        cl_queue_properties list[3] = {CL_QUEUE_PROPERTIES, properties, 0};
+        cl_command_queue queue = clCreateCommandQueueWithProperties(context_, device_, properties ? list : NULL, &err);
+        if (err < 0)
+        {
+            perror("Couldn't create a command queue");
+            exit(1);
+        }
+        queues_.push_back(queue);
+        return queue;
+    }
+
+    // Returns the program built from filename with options. Built once per
+    // runtime, and loaded from the binary cache when this device has built it before.
+    cl_program program(const char *filename, const char *options = "")
+    {
+        cl_program program = try_program(filename, options);
+        if (program == NULL)
+        {
+            printf("\nCouldn't build %s with options \"%s\".\n", filename, options);
+            exit(1);
+        }
+        return program;
+    }
+
+    // Like program(), but a build that fails prints its log and returns NULL
+    // instead of exiting, for optional variants such as autotuner candidates.
+    // The failure is remembered, the same build is not tried again.
+    cl_program try_program(const char *filename, const char *options = "")
+    {
+        std::string key = std::string(filename) + "|" + options;
+        std::map<std::string, cl_program>::iterator found = programs_.find(key);
+        if (found != programs_.end())
+        {
+            return found->second;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::string source = read_file(filename);
+        std::string binary_path = cache_path(source, options);
+
+        cl_program program = load_binary(binary_path, options);
+        if (program != NULL)
+        {
+            cache_hits++;
+        }
+        else
+        {
+            program = build_source(source, options);
+            if (program != NULL)
+            {
+                save_binary(program, binary_path);
+            }
+            cache_misses++;
+        }
+
+        build_seconds += seconds_since(start);
+        programs_[key] = program;
+        return program;
+    }
+
+    // Returns the named kernel of the program built from filename with options.
+    cl_kernel kernel(const char *filename, const char *name, const char *options = "")
+    {
+        program(filename, options); // Exits if the program doesn't build.
+        cl_kernel kernel = try_kernel(filename, name, options);
+        if (kernel == NULL)
+        {
+            perror("Couldn't create a kernel");
+            exit(1);
+        }
+        return kernel;
+    }
+
+    // Like kernel(), but returns NULL if the program doesn't build or has no such kernel.
+    cl_kernel try_kernel(const char *filename, const char *name, const char *options = "")
+    {
+        std::string key = std::string(filename) + "|" + options + "|" + name;
+        std::map<std::string, cl_kernel>::iterator found = kernels_.find(key);
+        if (found != kernels_.end())
+        {
+            return found->second;
+        }
+
+        cl_program program = try_program(filename, options);
+        if (program == NULL)
+        {
+            return NULL;
+        }
+        cl_int err;
+        cl_kernel kernel = clCreateKernel(program, name, &err);
+        if (err < 0)
+        {
+            printf("Couldn't create kernel %s, error = %d\n", name, err);
+            return NULL;
+        }
+        kernels_[key] = kernel;
+        return kernel;
+    }
+
+    // Returns a buffer of at least bytes. A free pooled buffer with the same
+    // flags is reused when one fits. Buffers over host memory (host_ptr) are
+    // never shared, they are created every time and released for good.
+    cl_mem buffer(size_t bytes, cl_mem_flags flags = CL_MEM_READ_WRITE, void *host_ptr = NULL)
+    {
+        if (host_ptr == NULL)
+        {
+            for (std::map<cl_mem, pooled_buffer>::iterator it = buffers_.begin(); it != buffers_.end(); ++it)
+            {
+                pooled_buffer &pooled = it->second;
+                if (!pooled.in_use && pooled.flags == flags && pooled.bytes >= bytes && pooled.host_ptr == NULL)
+                {
+                    pooled.in_use = true;
+                    return it->first;
+                }
+            }
+        }
+
+        cl_int err;
+        cl_mem buffer = clCreateBuffer(context_, flags, bytes, host_ptr, &err);
+        if (err < 0)
+        {
+            perror("Couldn't create a buffer");
+            printf("error = %d\n", err);
+            exit(1);
+        }
+        pooled_buffer pooled = {bytes, flags, host_ptr, true};
+        buffers_[buffer] = pooled;
+        return buffer;
+    }
+
+    // Hands a buffer back to the pool (or frees it if it wraps host memory).
+    void release(cl_mem buffer)
+    {
+        std::map<cl_mem, pooled_buffer>::iterator found = buffers_.find(buffer);
+        if (found == buffers_.end())
+        {
+            return;
+        }
+        if (found->second.host_ptr != NULL)
+        {
+            clReleaseMemObject(buffer);
+            buffers_.erase(found);
+            return;
+        }
+        found->second.in_use = false;
+    }
+
+    // Read-only buffer holding bytes from data. Wraps data in place when the
+    // device shares host memory, otherwise fills a pinned buffer through a map.
+    cl_mem input_buffer(void *data, size_t bytes)
+    {
+        if (shares_host_memory_)
+        {
+            return buffer(bytes, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, data);
+        }
+        cl_mem input = buffer(bytes, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+        void *mapped = map(input, CL_MAP_WRITE_INVALIDATE_REGION, bytes);
+        memcpy(mapped, data, bytes);
+        clEnqueueUnmapMemObject(queue_, input, mapped, 0, NULL, NULL);
+        bytes_copied += bytes;
+        return input;
+    }
+
+    // Write-only buffer for kernel results that end up in data. Nothing is
+    // uploaded, read_output() brings the results back.
+    cl_mem output_buffer(void *data, size_t bytes)
+    {
+        if (shares_host_memory_)
+        {
+            return buffer(bytes, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, data);
+        }
+        return buffer(bytes, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    }
+
+    // Waits for the kernels writing output, then makes its first bytes visible
+    // in data. The map is only a synchronisation point when output wraps data.
+    void read_output(cl_mem output, void *data, size_t bytes)
+    {
+        void *mapped = map(output, CL_MAP_READ, bytes);
+        if (mapped != data)
+        {
+            memcpy(data, mapped, bytes);
+            bytes_copied += bytes;
+        }
+        clEnqueueUnmapMemObject(queue_, output, mapped, 0, NULL, NULL);
+        clFinish(queue_);
+    }
+
+    // Prints where the startup time went.
+    void print_startup(const char *label) const
+    {
+        printf("%s%s: runtime setup %.3f s, program builds %.3f s (%d from cache, %d compiled) - %s start\n",
+            label, device_name_, startup_seconds, build_seconds, cache_hits, cache_misses,
+            cache_misses == 0 ? "warm" : "cold");
+    }
+
+    double startup_seconds; // Device, context and queue creation.
+    double build_seconds; // Program builds and binary loads so far.
+    int cache_hits; // Programs loaded from the binary cache.
+    int cache_misses; // Programs compiled from source.
+    size_t bytes_copied; // Host copies made by the zero-copy helpers (0 when memory is shared).
+
+private:
+    struct pooled_buffer
+    {
+        size_t bytes;
+        cl_mem_flags flags;
+        void *host_ptr;
+        bool in_use;
+    };
+
+    OclRuntime(const OclRuntime &); // Not copyable, owns the OpenCL objects.
+    OclRuntime &operator=(const OclRuntime &);
+
+    // Blocking map of the first bytes of buffer.
+    void *map(cl_mem buffer, cl_map_flags flags, size_t bytes)
+    {
+        cl_int err;
+        void *mapped = clEnqueueMapBuffer(queue_, buffer, CL_TRUE, flags, 0, bytes, 0, NULL, NULL, &err);
+        if (err < 0)
+        {
+            perror("Couldn't map a buffer");
+            printf("error = %d\n", err);
+            exit(1);
+        }
+        return mapped;
+    }
+
+    static double seconds_since(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+    }
+
+    // First GPU of the first platform, the CPU device if there is no GPU.
+    static cl_device_id create_device()
+    {
+        cl_platform_id platform;
+        cl_device_id dev;
+
+        cl_int err = clGetPlatformIDs(1, &platform, NULL);
+        if (err < 0)
+        {
+            perror("Couldn't identify a platform");
+            exit(1);
+        }
+
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+        if (err == CL_DEVICE_NOT_FOUND)
+        {
+            printf("GPU not found\n");
+            err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+        }
+        if (err < 0)
+        {
+            perror("Couldn't access any devices");
+            exit(1);
+        }
+        return dev;
+    }
+
+    static std::string read_file(const char *filename)
+    {
+        FILE *handle = fopen(filename, "r");
+        if (handle == NULL)
+        {
+            perror("Couldn't find the program file");
+            exit(1);
+        }
+        std::string text;
+        char chunk[4096];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), handle)) > 0)
+        {
+            text.append(chunk, got);
+        }
+        fclose(handle);
+        return text;
+    }
+
+    // 64-bit FNV-1a, good enough to tell sources and option sets apart.
+    static unsigned long long hash(const std::string &text, unsigned long long h = 14695981039346656037ULL)
+    {
+        for (size_t i=0; i<text.size(); i++)
+        {
+            h ^= (unsigned char) text[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // Cache file for this source, options and device/driver.
+    std::string cache_path(const std::string &source, const char *options) const
+    {
+        char version[256] = "", driver[256] = "", name[64];
+        clGetDeviceInfo(device_, CL_DEVICE_VERSION, sizeof(version), version, NULL);
+        clGetDeviceInfo(device_, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+
+        unsigned long long h = hash(source);
+        h = hash(std::string("|") + options, h);
+        h = hash(std::string("|") + device_name_ + "|" + version + "|" + driver, h);
+        snprintf(name, sizeof(name), "/%016llx.bin", h);
+        return cache_dir_ + name;
+    }
+
+    // Program from a cached binary, NULL if there is none or the driver rejects it.
+    cl_program load_binary(const std::string &path, const char *options)
+    {
+        FILE *handle = fopen(path.c_str(), "rb");
+        if (handle == NULL)
+        {
+            return NULL;
+        }
+        fseek(handle, 0, SEEK_END);
+        size_t size = ftell(handle);
+        rewind(handle);
+        unsigned char *binary = (unsigned char *) malloc(size);
+        size_t got = fread(binary, 1, size, handle);
+        fclose(handle);
+
+        cl_int err, status;
+        const unsigned char *binaries[1] = {binary};
+        cl_program program = NULL;
+        if (got == size)
+        {
+            program = clCreateProgramWithBinary(context_, 1, &device_, &size, binaries, &status, &err);
+            if (err < 0 || status < 0 || clBuildProgram(program, 1, &device_, options, NULL, NULL) < 0)
+            {
+                if (program != NULL && err >= 0)
+                {
+                    clReleaseProgram(program);
+                }
+                program = NULL;
+            }
+        }
+        free(binary);
+        return program;
+    }
+
+    // Program compiled from source, NULL (after printing the build log) if it doesn't build.
+    cl_program build_source(const std::string &source, const char *options)
+    {
+        cl_int err;
+        const char *text = source.c_str();
+        size_t length = source.size();
+
+        cl_program program = clCreateProgramWithSource(context_, 1, &text, &length, &err);
+        if (err < 0)
+        {
+            perror("Couldn't create the program");
+            exit(1);
+        }
+
+        // Options are like gcc flags, e.g. -DMACRO=VALUE or -cl-opt-disable.
+        err = clBuildProgram(program, 1, &device_, options, NULL, NULL);
+        if (err < 0)
+        {
+            size_t log_size;
+            clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+            char *program_log = (char *) malloc(log_size + 1);
+            program_log[log_size] = '\0';
+            clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, log_size + 1, program_log, NULL);
+            printf("\nBuild with options \"%s\" failed:\n%s", options, program_log);
+            free(program_log);
+            clReleaseProgram(program);
+            return NULL;
+        }
+        return program;
+    }
+
+    // Writes the device binary next to the others. A temporary file is renamed
+    // into place so ranks sharing the directory never read half a file.
+    void save_binary(cl_program program, const std::string &path)
+    {
+        size_t size = 0;
+        if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) < 0 || size == 0)
+        {
+            return;
+        }
+        unsigned char *binary = (unsigned char *) malloc(size);
+        unsigned char *binaries[1] = {binary};
+        if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) >= 0)
+        {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+            std::string temp = path + suffix;
+            FILE *handle = fopen(temp.c_str(), "wb");
+            if (handle != NULL)
+            {
+                bool written = fwrite(binary, 1, size, handle) == size;
+                fclose(handle);
+                if (!written || rename(temp.c_str(), path.c_str()) != 0)
+                {
+                    remove(temp.c_str());
+                }
+            }
+        }
+        free(binary);
+    }
+
+    cl_device_id device_;
+    cl_context context_;
+    cl_command_queue queue_;
+    char device_name_[256];
+    bool shares_host_memory_; // CPU device or host unified memory.
+    std::string cache_dir_;
+    std::vector<cl_command_queue> queues_; // Every queue created, queue_ included.
+    std::map<std::string, cl_program> programs_; // By file and options, NULL for a failed build.
+    std::map<std::string, cl_kernel> kernels_; // By file, options and kernel name.
+    std::map<cl_mem, pooled_buffer> buffers_;
+};
+
+#endif
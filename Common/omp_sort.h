@@ -0,0 +1,430 @@
+// OpenMP sorts for int vectors, shared by OMP_Qsort.cpp and the local sort of MPI_Qsort.cpp.
+//
+//     quick_sort_OMP   task-parallel quicksort on the Common/quicksort.h partitions,
+//                      with the depth budget passed down through the tasks.
+//     sample_sort_OMP  parallel from the first pass: splitters from a sample,
+//                      parallel bucketing, then every bucket sorted on its own.
+//     radix_sort_OMP   LSD radix sort, 8 bits per pass, over the bytes that differ.
+//     counting_sort_OMP for a key range of at most COUNTING_MAX_RANGE.
+// sort_OMP() runs one of them, or with SORT_AUTO picks one from a sample of the keys.
+
+#ifndef OMP_SORT_H
+#define OMP_SORT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <omp.h>
+#include "quicksort.h"
+
+#define RADIX_BITS 8 // Bits sorted per radix pass.
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MIN_SIZE 4096 // Smaller vectors are quicksorted.
+#define COUNTING_MAX_RANGE 65536 // Widest key range (max - min + 1) given to counting sort.
+#define SAMPLE_KEYS 1024 // Keys sampled to estimate the key range.
+#define COUNTING_CHUNK 64 // Keys per dynamically scheduled chunk when writing the counting sort output.
+#define BUCKETS_PER_THREAD 4 // Sample sort buckets per thread, spare buckets even out the sorting.
+#define OVERSAMPLE 32 // Sampled keys per sample sort bucket, more gives more even buckets.
+#define SAMPLE_SEED 7 // RNG stream for the positions of the sampled keys.
+
+enum sort_algorithm
+{
+    SORT_AUTO,
+    SORT_QUICK,
+    SORT_RADIX,
+    SORT_COUNTING,
+    SORT_SAMPLE
+};
+
+static const char* sort_names[] = {"auto", "quick", "radix", "counting", "sample"};
+
+// Bucket statistics of the last sample sort, for the summary.
+static int sample_buckets = 0;
+static long sample_largest = 0;
+
+// Recursive QuickSort (Main Quicksort Procedure).
+// depth counts down the levels left before heapsort takes over (see quicksort.h).
+static inline void quick_sort_OMP(int* vec, int low, int high, int limit, int depth, qs_options* opts)
+{
+    if (low < high)
+    {
+        // Ensures that no additional tasks are allocated if vec is < limit.
+            // Keeps task creation overhead reasonable. 
+        if ((high-low) < limit)
+        {   // Calls sequential Quick Sort.
+            intro_sort(vec, low, high, depth, opts);
+        }
+        else if (depth == 0)
+        {   // Too many bad splits, heapsort the rest.
+            opts->fallbacks.fetch_add(1, std::memory_order_relaxed);
+            heap_sort(vec, low, high);
+        }
+        else
+        {
+            // printf("Thread %d is entering quick_sort method.\n", omp_get_thread_num()); 
+            // Reordering the vector & retrieving the ranges either side of the pivot(s).
+            long left_high, right_low;
+            qs_split(vec, low, high, opts, &left_high, &right_low);
+
+            // Explicitly defines the task and the shared data.
+            #pragma omp task shared(vec)
+            // Recursive call left of the pivot point
+            quick_sort_OMP(vec, low, left_high, limit, depth-1, opts);
+
+            // Recursive call right of the pivot point.
+            #pragma omp task shared(vec)
+            quick_sort_OMP(vec, right_low, high, limit, depth-1, opts);
+        }
+    }
+}
+
+// Sorts the whole vector on a team of threads.
+static inline void sort_parallel(int* vec, int size, int limit, qs_options* opts)
+{
+    #pragma omp parallel // OpenMP Parallised section 
+    {
+        // OMP single ensures a single master task controls the process. 
+            // Once inside Q-Sort, OMP Task generates children to work in parallel.  
+        #pragma omp single
+        quick_sort_OMP(vec, 0, size-1, limit, qs_depth_limit(size), opts); // Quick sort start.
+        // Waits for the child tasks to complete their work.
+        #pragma omp taskwait
+    }
+}
+
+// Exclusive prefix sum of counts[0, m), called by every thread of a parallel
+// region. Each thread scans its own block, then adds the total of the blocks
+// before it (block_sums holds one total per thread).
+static inline void prefix_sum_OMP(long* counts, long m, long* block_sums)
+{
+    int t = omp_get_thread_num(), threads = omp_get_num_threads();
+    long first = m * t / threads, last = m * (t+1) / threads;
+
+    long sum = 0;
+    for (long i=first; i<last; i++)
+    {
+        long count = counts[i];
+        counts[i] = sum;
+        sum += count;
+    }
+    block_sums[t] = sum;
+    #pragma omp barrier
+
+    long offset = 0;
+    for (int b=0; b<t; b++)
+    {
+        offset += block_sums[b];
+    }
+    for (long i=first; i<last; i++)
+    {
+        counts[i] += offset;
+    }
+    #pragma omp barrier
+}
+
+// Exact smallest and largest key.
+static inline void key_range(int* vec, int size, int* min_key, int* max_key)
+{
+    int lo = INT_MAX, hi = INT_MIN;
+    #pragma omp parallel for reduction(min:lo) reduction(max:hi)
+    for (int i=0; i<size; i++)
+    {
+        lo = std::min(lo, vec[i]);
+        hi = std::max(hi, vec[i]);
+    }
+    *min_key = lo;
+    *max_key = hi;
+}
+
+// Key range of SAMPLE_KEYS evenly spaced elements, cheap and usually close.
+static inline void sample_key_range(int* vec, int size, int* min_key, int* max_key)
+{
+    int lo = INT_MAX, hi = INT_MIN;
+    for (int s=0; s<SAMPLE_KEYS; s++)
+    {
+        int key = vec[(long) size * s / SAMPLE_KEYS];
+        lo = std::min(lo, key);
+        hi = std::max(hi, key);
+    }
+    *min_key = lo;
+    *max_key = hi;
+}
+
+// Parallel LSD radix sort. Keys are sorted as key - min_key, so only the bytes
+// that differ across [min_key, max_key] are passed over (2 for 0-999). Each
+// pass: per-thread histograms of its block, a prefix sum over (digit, thread),
+// then every thread scatters its block, which keeps the sort stable.
+static inline void radix_sort_OMP(int* vec, int size, int min_key, int max_key)
+{
+    unsigned span = (unsigned) max_key - (unsigned) min_key;
+    int passes = 0;
+    for (; span > 0; span >>= RADIX_BITS)
+    {
+        passes++;
+    }
+
+    int* buffer = (int*) malloc(sizeof(int) * size);
+    int max_threads = omp_get_max_threads();
+    long* counts = (long*) malloc(sizeof(long) * RADIX_BUCKETS * max_threads); // [digit][thread]
+    long* block_sums = (long*) malloc(sizeof(long) * max_threads);
+    if (buffer == NULL || counts == NULL || block_sums == NULL)
+    {
+        perror("Couldn't allocate the radix sort buffers");
+        exit(1);
+    }
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num(), threads = omp_get_num_threads();
+        int first = (long) size * t / threads, last = (long) size * (t+1) / threads;
+        int* src = vec;
+        int* dst = buffer;
+
+        for (int pass=0; pass<passes; pass++)
+        {
+            int shift = pass * RADIX_BITS;
+            long local[RADIX_BUCKETS] = {0};
+            for (int i=first; i<last; i++)
+            {
+                local[(((unsigned) src[i] - (unsigned) min_key) >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+            for (int d=0; d<RADIX_BUCKETS; d++)
+            {
+                counts[d * threads + t] = local[d];
+            }
+            #pragma omp barrier
+
+            prefix_sum_OMP(counts, (long) RADIX_BUCKETS * threads, block_sums);
+
+            for (int d=0; d<RADIX_BUCKETS; d++)
+            {
+                local[d] = counts[d * threads + t];
+            }
+            for (int i=first; i<last; i++)
+            {
+                dst[local[(((unsigned) src[i] - (unsigned) min_key) >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+            }
+            #pragma omp barrier
+            std::swap(src, dst);
+        }
+
+        // An odd number of passes leaves the result in the buffer.
+        if (src != vec)
+        {
+            for (int i=first; i<last; i++)
+            {
+                vec[i] = src[i];
+            }
+        }
+    }
+
+    free(buffer);
+    free(counts);
+    free(block_sums);
+}
+
+// Parallel counting sort for keys in [min_key, max_key]. Per-thread histograms,
+// summed per key and prefix summed in parallel, then each key's run is written
+// straight back into vec, so no second buffer is needed.
+static inline void counting_sort_OMP(int* vec, int size, int min_key, int max_key)
+{
+    long range = (long) max_key - min_key + 1;
+    int max_threads = omp_get_max_threads();
+    long* counts = (long*) calloc(range * max_threads, sizeof(long)); // [thread][key]
+    long* starts = (long*) malloc(sizeof(long) * range);
+    long* block_sums = (long*) malloc(sizeof(long) * max_threads);
+    if (counts == NULL || starts == NULL || block_sums == NULL)
+    {
+        perror("Couldn't allocate the counting sort buffers");
+        exit(1);
+    }
+
+    #pragma omp parallel
+    {
+        int threads = omp_get_num_threads();
+        long* mine = counts + range * omp_get_thread_num();
+
+        #pragma omp for schedule(static)
+        for (int i=0; i<size; i++)
+        {
+            mine[vec[i] - min_key]++;
+        }
+
+        #pragma omp for schedule(static)
+        for (long k=0; k<range; k++)
+        {
+            long total = 0;
+            for (int b=0; b<threads; b++)
+            {
+                total += counts[range * b + k];
+            }
+            starts[k] = total;
+        }
+
+        prefix_sum_OMP(starts, range, block_sums);
+
+        #pragma omp for schedule(dynamic, COUNTING_CHUNK)
+        for (long k=0; k<range; k++)
+        {
+            long stop = k+1 < range ? starts[k+1] : size;
+            for (long i=starts[k]; i<stop; i++)
+            {
+                vec[i] = min_key + k;
+            }
+        }
+    }
+
+    free(counts);
+    free(starts);
+    free(block_sums);
+}
+
+// Parallel sample sort (the alternative entry point to quick_sort_OMP). Picks
+// buckets - 1 splitters from OVERSAMPLE sampled keys per bucket. Every thread
+// counts the bucket of each key in its block, a prefix sum over (bucket, thread)
+// gives the scatter offsets, and the buckets are then sorted independently, so
+// all threads work from the first pass. Runs of equal keys stay in one bucket,
+// which the 3-way intro_sort finishes in a single pass.
+static inline void sample_sort_OMP(int* vec, int size, qs_options* opts)
+{
+    int max_threads = omp_get_max_threads();
+    int buckets = max_threads * BUCKETS_PER_THREAD;
+    long samples = (long) buckets * OVERSAMPLE;
+    if (size < samples)
+    {
+        intro_sort(vec, 0, size-1, qs_depth_limit(size), opts);
+        sample_buckets = 1;
+        sample_largest = size;
+        return;
+    }
+
+    // Splitters: every OVERSAMPLE-th key of the sorted sample.
+    int* sample = (int*) malloc(sizeof(int) * samples);
+    int* splitters = (int*) malloc(sizeof(int) * (buckets - 1));
+    int* buffer = (int*) malloc(sizeof(int) * size);
+    unsigned short* bucket_of = (unsigned short*) malloc(sizeof(unsigned short) * size); // Saves a second search.
+    long* counts = (long*) malloc(sizeof(long) * buckets * max_threads); // [bucket][thread]
+    long* block_sums = (long*) malloc(sizeof(long) * max_threads);
+    if (sample == NULL || splitters == NULL || buffer == NULL || bucket_of == NULL || counts == NULL || block_sums == NULL)
+    {
+        perror("Couldn't allocate the sample sort buffers");
+        exit(1);
+    }
+    for (long s=0; s<samples; s++)
+    {
+        sample[s] = vec[rng_at(SAMPLE_SEED, s) % size];
+    }
+    std::sort(sample, sample + samples);
+    for (int b=0; b<buckets-1; b++)
+    {
+        splitters[b] = sample[(long) (b+1) * OVERSAMPLE];
+    }
+    free(sample);
+
+    long largest = 0;
+    #pragma omp parallel reduction(max:largest)
+    {
+        int t = omp_get_thread_num(), threads = omp_get_num_threads();
+        int first = (long) size * t / threads, last = (long) size * (t+1) / threads;
+
+        // Bucket b takes the keys in [splitters[b-1], splitters[b]).
+        long* local = (long*) calloc(buckets, sizeof(long));
+        for (int i=first; i<last; i++)
+        {
+            bucket_of[i] = std::upper_bound(splitters, splitters + buckets - 1, vec[i]) - splitters;
+            local[bucket_of[i]]++;
+        }
+        for (int b=0; b<buckets; b++)
+        {
+            counts[(long) b * threads + t] = local[b];
+        }
+        #pragma omp barrier
+
+        prefix_sum_OMP(counts, (long) buckets * threads, block_sums);
+
+        for (int b=0; b<buckets; b++)
+        {
+            local[b] = counts[(long) b * threads + t];
+        }
+        for (int i=first; i<last; i++)
+        {
+            buffer[local[bucket_of[i]]++] = vec[i];
+        }
+        free(local);
+        #pragma omp barrier
+
+        // Sort each bucket and copy it back, uneven buckets are balanced by the dynamic schedule.
+        #pragma omp for schedule(dynamic, 1)
+        for (int b=0; b<buckets; b++)
+        {
+            long start = counts[(long) b * threads];
+            long stop = b+1 < buckets ? counts[(long) (b+1) * threads] : size;
+            intro_sort(buffer, start, stop-1, qs_depth_limit(stop - start), opts);
+            std::copy(buffer + start, buffer + stop, vec + start);
+            largest = std::max(largest, stop - start);
+        }
+    }
+    sample_buckets = buckets;
+    sample_largest = largest;
+
+    free(splitters);
+    free(buffer);
+    free(bucket_of);
+    free(counts);
+    free(block_sums);
+}
+
+// Sorts the vector with algorithm, or for SORT_AUTO the one picked from a
+// sample of the keys. Returns the algorithm that actually ran.
+static inline sort_algorithm sort_OMP(int* vec, int size, int limit, qs_options* opts, sort_algorithm algorithm)
+{
+    // Nothing to sort, and an empty range has min_key > max_key.
+    if (size < 2)
+    {
+        return algorithm == SORT_AUTO ? SORT_QUICK : algorithm;
+    }
+
+    if (algorithm == SORT_AUTO)
+    {
+        int lo, hi;
+        sample_key_range(vec, size, &lo, &hi);
+        if (size < RADIX_MIN_SIZE)
+        {
+            algorithm = SORT_QUICK;
+        }
+        else if ((long) hi - lo < COUNTING_MAX_RANGE && (long) hi - lo < size)
+        {
+            algorithm = SORT_COUNTING;
+        }
+        else
+        {
+            algorithm = SORT_RADIX;
+        }
+    }
+
+    if (algorithm == SORT_QUICK)
+    {
+        sort_parallel(vec, size, limit, opts);
+        return SORT_QUICK;
+    }
+    if (algorithm == SORT_SAMPLE)
+    {
+        sample_sort_OMP(vec, size, opts);
+        return SORT_SAMPLE;
+    }
+
+    // The sample may have missed the extremes: counting sort needs the exact
+    // range and hands a range that turns out too wide to radix sort.
+    int min_key, max_key;
+    key_range(vec, size, &min_key, &max_key);
+    if (algorithm == SORT_COUNTING && max_key >= min_key && (long) max_key - min_key < COUNTING_MAX_RANGE)
+    {
+        counting_sort_OMP(vec, size, min_key, max_key);
+        return SORT_COUNTING;
+    }
+    radix_sort_OMP(vec, size, min_key, max_key);
+    return SORT_RADIX;
+}
+
+#endif
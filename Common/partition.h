@@ -0,0 +1,100 @@
+// Splits rows or elements over MPI ranks for MPI_Scatterv / MPI_Gatherv.
+//
+// Each rank gets a share in proportion to its weight. The weight is 1 unless
+// the program is started with --weight w. Any size works with any number of
+// ranks, and faster nodes can take more of the work, e.g.
+//     mpirun -np 1 -host fast ./mpi --weight 2 : -np 3 -host slow ./mpi
+// Shares are rounded with the largest remainder method, so they always add up
+// to the total and each is within one item of its exact share.
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <mpi.h>
+
+// Reads --weight w from the command line, 1 if it is not given.
+inline double parse_weight(int argc, char **argv)
+{
+    for (int i=1; i<argc-1; i++)
+    {
+        if (strcmp(argv[i], "--weight") == 0)
+        {
+            double weight = atof(argv[i + 1]);
+            if (weight <= 0)
+            {
+                printf("The --weight value must be greater than zero.\n");
+                exit(1);
+            }
+            return weight;
+        }
+    }
+    return 1.0;
+}
+
+// Splits total items over num_tasks ranks in proportion to weights.
+// counts[r] is the number of items for rank r, displs[r] the index of its first.
+inline void split_weighted(int total, int num_tasks, const double *weights, int *counts, int *displs)
+{
+    double *remainder = (double *) malloc(sizeof(double) * num_tasks);
+    double weight_sum = 0;
+    int given = 0;
+
+    for (int r=0; r<num_tasks; r++)
+    {
+        weight_sum += weights[r];
+    }
+
+    // Whole part of each exact share first.
+    for (int r=0; r<num_tasks; r++)
+    {
+        double exact = (double) total * weights[r] / weight_sum;
+        counts[r] = (int) exact;
+        remainder[r] = exact - counts[r];
+        given += counts[r];
+    }
+
+    // Leftover items go to the largest remainders, ties to the lower rank.
+    while (given < total)
+    {
+        int best = 0;
+        for (int r=1; r<num_tasks; r++)
+        {
+            if (remainder[r] > remainder[best])
+            {
+                best = r;
+            }
+        }
+        counts[best]++;
+        remainder[best] = -1;
+        given++;
+    }
+
+    displs[0] = 0;
+    for (int r=1; r<num_tasks; r++)
+    {
+        displs[r] = displs[r - 1] + counts[r - 1];
+    }
+    free(remainder);
+}
+
+// Gathers every rank's weight (MPI_Allgather) and splits total items of unit
+// elements each, e.g. unit = ld for matrix rows. counts and displs come back
+// in elements, ready for MPI_Scatterv / MPI_Gatherv. Collective, every rank calls it.
+inline void partition_work(int total, int unit, double weight, int num_tasks, int *counts, int *displs)
+{
+    double *weights = (double *) malloc(sizeof(double) * num_tasks);
+    MPI_Allgather(&weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    split_weighted(total, num_tasks, weights, counts, displs);
+    for (int r=0; r<num_tasks; r++)
+    {
+        counts[r] *= unit;
+        displs[r] *= unit;
+    }
+    free(weights);
+}
+
+#endif
@@ -0,0 +1,325 @@
+// Quicksort building blocks shared by Quicksort.cpp and OMP_Qsort.cpp.
+//
+// Two partition schemes:
+//     QS_LOMUTO     the original partition(), equal keys all go to the left
+//                   side, so duplicate-heavy input splits badly.
+//     QS_THREE_WAY  Bentley-McIlroy, [< pivot | == pivot | > pivot]. The middle
+//                   band is final and never looked at again, so a range of
+//                   equal keys is done in one pass. Unlike Dijkstra's Dutch
+//                   national flag it leaves an ordered run in order, so the
+//                   median of 3 still finds good pivots in sorted input.
+// Three pivot rules: the last element (the original), the median of the first,
+// middle and last, or Tukey's ninther (the median of three medians of 3) for
+// ranges of at least QS_NINTHER_MIN elements.
+//
+// intro_sort() bounds the recursion at 2 log2(n) levels. A range that is still
+// unsorted at the limit is heapsorted, so no input is worse than O(n log n),
+// and the smaller side is recursed into first so the stack stays O(log n).
+// Ranges of up to QS_INSERTION_MAX elements are finished by insertion sort.
+
+#ifndef QUICKSORT_H
+#define QUICKSORT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <atomic>
+#include <algorithm>
+#include "rng.h"
+
+#define QS_NINTHER_MIN 128 // Shorter ranges take the median of 3 instead of the ninther.
+#define QS_INSERTION_MAX 16 // Ranges up to this long are insertion sorted.
+
+enum qs_scheme
+{
+    QS_LOMUTO,
+    QS_THREE_WAY
+};
+
+enum qs_pivot
+{
+    QS_PIVOT_LAST,
+    QS_PIVOT_MEDIAN3,
+    QS_PIVOT_NINTHER
+};
+
+enum qs_input
+{
+    QS_UNIFORM,     // Random over the whole int range, negatives included, almost all distinct.
+    QS_FEW_UNIQUE,  // Random 0 to 999, the original rand_fill() data.
+    QS_SORTED,      // Already ascending.
+    QS_REVERSE      // Descending.
+};
+
+struct qs_options
+{
+    qs_scheme scheme;
+    qs_pivot pivot;
+    std::atomic<long> fallbacks; // Ranges handed to heapsort at the depth limit.
+};
+
+static const char *qs_scheme_names[] = {"lomuto", "3way"};
+static const char *qs_pivot_names[] = {"last", "median3", "ninther"};
+static const char *qs_input_names[] = {"uniform", "few", "sorted", "reverse"};
+
+// Value of --flag value on the command line, NULL if it is not given.
+static inline const char *qs_arg(int argc, char **argv, const char *flag)
+{
+    for (int i=1; i<argc-1; i++)
+    {
+        if (strcmp(argv[i], flag) == 0)
+        {
+            return argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+// Index of name in names[0, count), def if name is NULL. Exits on an unknown name.
+static inline int qs_lookup(const char *name, const char **names, int count, int def)
+{
+    if (name == NULL)
+    {
+        return def;
+    }
+    for (int i=0; i<count; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    printf("Unknown option value \"%s\".\n", name);
+    exit(1);
+}
+
+// Element i of a size element vector with the given input pattern.
+static inline int qs_value(long i, long size, qs_input input, uint64_t seed)
+{
+    switch (input)
+    {
+        case QS_UNIFORM:     return (int) (uint32_t) (rng_at(seed, i) >> 32);
+        case QS_FEW_UNIQUE:  return rng_int(seed, i, 1000);
+        case QS_SORTED:      return (int) i;
+        default:             return (int) (size - 1 - i);
+    }
+}
+
+// Index of the median of vec[a], vec[b] and vec[c].
+static inline long qs_median3(const int *vec, long a, long b, long c)
+{
+    if (vec[a] < vec[b])
+    {
+        return vec[b] < vec[c] ? b : (vec[a] < vec[c] ? c : a);
+    }
+    return vec[a] < vec[c] ? a : (vec[b] < vec[c] ? c : b);
+}
+
+// Index of the pivot for [low, high] under rule.
+static inline long qs_choose_pivot(const int *vec, long low, long high, qs_pivot rule)
+{
+    long n = high - low + 1;
+    long mid = low + n / 2;
+    if (rule == QS_PIVOT_LAST || n < 3)
+    {
+        return high;
+    }
+    if (rule == QS_PIVOT_MEDIAN3 || n < QS_NINTHER_MIN)
+    {
+        return qs_median3(vec, low, mid, high);
+    }
+    long step = n / 8;
+    return qs_median3(vec,
+        qs_median3(vec, low, low + step, low + 2 * step),
+        qs_median3(vec, mid - step, mid, mid + step),
+        qs_median3(vec, high - 2 * step, high - step, high));
+}
+
+// The original Lomuto partition around vec[high], returns the pivot's final index.
+static inline long qs_partition_lomuto(int *vec, long low, long high)
+{
+    int pivot = vec[high];
+    long i = low-1;
+    for (long j=low; j<high; j++)
+    {
+        if (vec[j] <= pivot)
+        {
+            i++;
+            std::swap(vec[i], vec[j]);
+        }
+    }
+    std::swap(vec[i + 1], vec[high]);
+    return i+1;
+}
+
+// Bentley-McIlroy partition around vec[p]. Afterwards [low, *lt) < pivot,
+// [*lt, *gt] == pivot and (*gt, high] > pivot. A Hoare style scan swaps keys
+// equal to the pivot out to both ends, which are then swapped into the middle.
+static inline void qs_partition_3way(int *vec, long low, long high, long p, long *lt, long *gt)
+{
+    int pivot = vec[p];
+    long i = low - 1, j = high + 1; // Scan positions.
+    long l = low - 1, g = high + 1; // Equal keys collected in [low, l] and [g, high].
+    for (;;)
+    {
+        while (vec[++i] < pivot)
+        {
+            if (i == high) break;
+        }
+        while (pivot < vec[--j])
+        {
+            if (j == low) break;
+        }
+        if (i == j && vec[i] == pivot)
+        {
+            std::swap(vec[++l], vec[i]);
+        }
+        if (i >= j)
+        {
+            break;
+        }
+        std::swap(vec[i], vec[j]);
+        if (vec[i] == pivot) std::swap(vec[++l], vec[i]);
+        if (vec[j] == pivot) std::swap(vec[--g], vec[j]);
+    }
+
+    // [low, j] < pivot apart from the equal keys at its start, likewise (j, high] at its end.
+    i = j + 1;
+    for (long k = low; k <= l; k++)
+    {
+        std::swap(vec[k], vec[j--]);
+    }
+    for (long k = high; k >= g; k--)
+    {
+        std::swap(vec[k], vec[i++]);
+    }
+    *lt = j + 1;
+    *gt = i - 1;
+}
+
+// Picks a pivot and partitions [low, high] with the chosen scheme. The ranges
+// still to sort are [low, *left_high] and [*right_low, high].
+static inline void qs_split(int *vec, long low, long high, const qs_options *opts, long *left_high, long *right_low)
+{
+    long p = qs_choose_pivot(vec, low, high, opts->pivot);
+    if (opts->scheme == QS_THREE_WAY)
+    {
+        long lt, gt;
+        qs_partition_3way(vec, low, high, p, &lt, &gt);
+        *left_high = lt - 1;
+        *right_low = gt + 1;
+        return;
+    }
+    std::swap(vec[p], vec[high]);
+    long pivot = qs_partition_lomuto(vec, low, high);
+    *left_high = pivot - 1;
+    *right_low = pivot + 1;
+}
+
+// Moves vec[low + root] down the max-heap held in vec[low, low + n).
+static inline void qs_sift_down(int *vec, long low, long root, long n)
+{
+    for (long child = 2 * root + 1; child < n; child = 2 * root + 1)
+    {
+        if (child + 1 < n && vec[low + child] < vec[low + child + 1])
+        {
+            child++;
+        }
+        if (vec[low + root] >= vec[low + child])
+        {
+            return;
+        }
+        std::swap(vec[low + root], vec[low + child]);
+        root = child;
+    }
+}
+
+// In-place heapsort of [low, high], the introsort fallback.
+static inline void heap_sort(int *vec, long low, long high)
+{
+    long n = high - low + 1;
+    for (long root = n / 2 - 1; root >= 0; root--)
+    {
+        qs_sift_down(vec, low, root, n);
+    }
+    for (long end = n - 1; end > 0; end--)
+    {
+        std::swap(vec[low], vec[low + end]);
+        qs_sift_down(vec, low, 0, end);
+    }
+}
+
+// Insertion sort of [low, high], for short ranges.
+static inline void insertion_sort(int *vec, long low, long high)
+{
+    for (long i=low+1; i<=high; i++)
+    {
+        int value = vec[i];
+        long j = i - 1;
+        for (; j >= low && vec[j] > value; j--)
+        {
+            vec[j + 1] = vec[j];
+        }
+        vec[j + 1] = value;
+    }
+}
+
+// Levels of partitioning allowed for n elements before heapsort takes over.
+static inline int qs_depth_limit(long n)
+{
+    int depth = 0;
+    for (; n > 1; n >>= 1)
+    {
+        depth += 2;
+    }
+    return depth;
+}
+
+// Quicksort of [low, high] that falls back to heapsort after depth levels.
+static inline void intro_sort(int *vec, long low, long high, int depth, qs_options *opts)
+{
+    while (low < high)
+    {
+        if (high - low < QS_INSERTION_MAX)
+        {
+            insertion_sort(vec, low, high);
+            return;
+        }
+        if (depth-- == 0)
+        {
+            opts->fallbacks.fetch_add(1, std::memory_order_relaxed);
+            heap_sort(vec, low, high);
+            return;
+        }
+        long left_high, right_low;
+        qs_split(vec, low, high, opts, &left_high, &right_low);
+
+        // Recurse into the smaller side, loop on the larger one.
+        if (left_high - low < high - right_low)
+        {
+            intro_sort(vec, low, left_high, depth, opts);
+            low = right_low;
+        }
+        else
+        {
+            intro_sort(vec, right_low, high, depth, opts);
+            high = left_high;
+        }
+    }
+}
+
+// Checks vec[0, size) is in ascending order.
+static inline bool qs_is_sorted(const int *vec, long size)
+{
+    for (long i=1; i<size; i++)
+    {
+        if (vec[i-1] > vec[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,63 @@
+// Counter-based random numbers shared by the data generators.
+//
+// rng_at(seed, i) is the i-th number of stream seed, computed from (seed, i)
+// alone with the SplitMix64 mixer, there is no state to carry from one element
+// to the next. Any thread or rank can therefore generate any slice of a vector
+// or matrix by itself, and the data comes out bit-identical whatever the number
+// of threads or ranks that produced it (unlike rand(), which is serial, or
+// rand_r seeded per thread, which changes with the thread count).
+//
+// Use a different seed per array, e.g. RNG_SEED_A and RNG_SEED_B for the two
+// inputs, and the element's offset in the whole array as i.
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+#define RNG_SEED_A 1 // Stream of the first input (v1 / matrix A).
+#define RNG_SEED_B 2 // Stream of the second input (v2 / matrix B).
+#define RNG_SEED_C 3 // Stream of an output that is pre-filled (v3).
+
+// SplitMix64 finaliser, a bijection with full avalanche.
+static inline uint64_t rng_mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 64 random bits for element i of stream seed.
+static inline uint64_t rng_at(uint64_t seed, uint64_t i)
+{
+    return rng_mix(rng_mix(seed) + (i + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+// Element i of stream seed as an int in [0, bound). Uses the top 32 bits and a
+// multiply instead of %, which is both faster and unbiased enough for test data.
+static inline int rng_int(uint64_t seed, uint64_t i, int bound)
+{
+    return (int) (((rng_at(seed, i) >> 32) * (uint64_t) bound) >> 32);
+}
+
+// v[i] = rng_int(seed, i, bound) for i in [start, stop). v points at element 0
+// of the whole array, so a thread or rank passes its own range.
+static inline void rng_fill(int *v, long start, long stop, uint64_t seed, int bound)
+{
+    for (long i = start; i < stop; i++)
+    {
+        v[i] = rng_int(seed, i, bound);
+    }
+}
+
+// slice[k] = rng_int(seed, first + k, bound) for k in [0, count), for a rank
+// that only holds elements [first, first + count) of the whole array.
+static inline void rng_fill_slice(int *slice, long first, long count, uint64_t seed, int bound)
+{
+    for (long k = 0; k < count; k++)
+    {
+        slice[k] = rng_int(seed, first + k, bound);
+    }
+}
+
+#endif
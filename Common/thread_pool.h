@@ -0,0 +1,318 @@
+// Persistent pthread worker pool with a parallel-for, shared by the pthread programs.
+//
+// The threads are created once and wait for work between calls, so a
+// parallel_for costs a wake-up rather than a pthread_create / pthread_join per
+// thread. Idle workers spin for POOL_SPIN_US before they block on a condition
+// variable, which keeps back-to-back calls in the microsecond range without
+// burning a core while the program does something else. The calling thread
+// takes part as worker 0, so a pool of n threads starts n - 1 workers.
+//
+// parallel_for(begin, end, body, schedule, chunk) calls body(first, last, worker)
+// on sub-ranges [first, last) that together cover [begin, end) once:
+//     POOL_STATIC   one contiguous block per worker, sizes differ by at most one
+//                   (chunk > 0 deals chunks round-robin instead).
+//     POOL_DYNAMIC  workers take the next chunk from a shared counter.
+//     POOL_GUIDED   like dynamic, but chunks start at remaining / (2 * workers)
+//                   and shrink towards chunk as the range runs out.
+// worker (0 ... size() - 1) lets the body keep per-thread results without locks.
+// Calls are not reentrant: body must not call parallel_for on the same pool.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define POOL_SPIN_US 50 // Time an idle worker spins for new work before it sleeps.
+#define POOL_DYNAMIC_SPLIT 16 // Default dynamic chunk: a worker's share split this many ways.
+
+enum pool_schedule
+{
+    POOL_STATIC,
+    POOL_DYNAMIC,
+    POOL_GUIDED
+};
+
+// Schedule from its name ("static", "dynamic" or "guided"), def for anything else.
+static inline pool_schedule pool_schedule_from(const char *name, pool_schedule def)
+{
+    if (name == NULL) return def;
+    if (name[0] == 's') return POOL_STATIC;
+    if (name[0] == 'd') return POOL_DYNAMIC;
+    if (name[0] == 'g') return POOL_GUIDED;
+    return def;
+}
+
+static inline const char *pool_schedule_name(pool_schedule schedule)
+{
+    return schedule == POOL_STATIC ? "static" : schedule == POOL_DYNAMIC ? "dynamic" : "guided";
+}
+
+class ThreadPool
+{
+public:
+    // Starts threads - 1 workers (the caller is worker 0), threads <= 0 uses every online core.
+    explicit ThreadPool(int threads = 0)
+        : threads_(threads > 0 ? threads : online_cores()), generation_(0), remaining_(0),
+          sleepers_(0), stop_(false), job_(NULL), job_ctx_(NULL)
+    {
+        pthread_mutex_init(&lock_, NULL);
+        pthread_cond_init(&wake_, NULL);
+        workers_ = (pthread_t *) malloc(sizeof(pthread_t) * threads_);
+        args_ = (worker_arg *) malloc(sizeof(worker_arg) * threads_);
+        for (int w = 1; w < threads_; w++)
+        {
+            args_[w].pool = this;
+            args_[w].worker = w;
+            if (pthread_create(&workers_[w], NULL, worker_main, &args_[w]) != 0)
+            {
+                perror("Couldn't start a pool thread");
+                exit(1);
+            }
+        }
+    }
+
+    ~ThreadPool()
+    {
+        stop_.store(true);
+        generation_.fetch_add(1);
+        pthread_mutex_lock(&lock_);
+        pthread_cond_broadcast(&wake_);
+        pthread_mutex_unlock(&lock_);
+        for (int w = 1; w < threads_; w++)
+        {
+            pthread_join(workers_[w], NULL);
+        }
+        free(workers_);
+        free(args_);
+        pthread_cond_destroy(&wake_);
+        pthread_mutex_destroy(&lock_);
+    }
+
+    int size() const { return threads_; }
+
+    // Runs body(first, last, worker) over [begin, end), see the top of the file.
+    template <typename Body>
+    void parallel_for(long begin, long end, Body body, pool_schedule schedule = POOL_STATIC, long chunk = 0)
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+        for_job<Body> job(this, begin, end, body, schedule, chunk);
+        run_job(&for_job<Body>::invoke, &job);
+    }
+
+    // Runs body(worker) once on every thread of the pool.
+    template <typename Body>
+    void run(Body body)
+    {
+        run_job(&each_job<Body>::invoke, &body);
+    }
+
+    static int online_cores()
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (int) n : 1;
+    }
+
+private:
+    struct worker_arg
+    {
+        ThreadPool *pool;
+        int worker;
+    };
+
+    typedef void (*job_fn)(void *ctx, int worker);
+
+    // The range of one parallel_for and its shared chunk counter.
+    template <typename Body>
+    struct for_job
+    {
+        ThreadPool *pool;
+        long begin, end, chunk;
+        Body &body;
+        pool_schedule schedule;
+        std::atomic<long> next;
+
+        for_job(ThreadPool *p, long b, long e, Body &f, pool_schedule s, long c)
+            : pool(p), begin(b), end(e), chunk(c), body(f), schedule(s), next(b)
+        {
+            long per_worker = (e - b + p->threads_ - 1) / p->threads_;
+            if (chunk <= 0 && s == POOL_DYNAMIC)
+            {
+                chunk = per_worker / POOL_DYNAMIC_SPLIT;
+            }
+            if (chunk <= 0)
+            {
+                chunk = s == POOL_STATIC ? 0 : 1;
+            }
+        }
+
+        static void invoke(void *ctx, int worker)
+        {
+            for_job *job = (for_job *) ctx;
+            job->work(worker);
+        }
+
+        void work(int worker)
+        {
+            long n = end - begin;
+            int p = pool->threads_;
+            if (schedule == POOL_STATIC && chunk == 0)
+            {
+                // Balanced blocks, the first n % p workers take one extra item.
+                long first = begin + n / p * worker + (worker < n % p ? worker : n % p);
+                long count = n / p + (worker < n % p ? 1 : 0);
+                if (count > 0)
+                {
+                    body(first, first + count, worker);
+                }
+                return;
+            }
+            if (schedule == POOL_STATIC)
+            {
+                for (long first = begin + chunk * worker; first < end; first += chunk * p)
+                {
+                    body(first, first + chunk < end ? first + chunk : end, worker);
+                }
+                return;
+            }
+            for (;;)
+            {
+                long first, size;
+                if (schedule == POOL_DYNAMIC)
+                {
+                    first = next.fetch_add(chunk);
+                    size = chunk;
+                }
+                else
+                {
+                    // Guided: half of an even share of what is left, at least chunk.
+                    first = next.load();
+                    do
+                    {
+                        size = (end - first) / (2 * p);
+                        size = size > chunk ? size : chunk;
+                    } while (first < end && !next.compare_exchange_weak(first, first + size));
+                }
+                if (first >= end)
+                {
+                    return;
+                }
+                body(first, first + size < end ? first + size : end, worker);
+            }
+        }
+    };
+
+    template <typename Body>
+    struct each_job
+    {
+        static void invoke(void *ctx, int worker)
+        {
+            (*(Body *) ctx)(worker);
+        }
+    };
+
+    // Publishes a job, does the caller's share and waits for the workers.
+    void run_job(job_fn fn, void *ctx)
+    {
+        job_ = fn;
+        job_ctx_ = ctx;
+        remaining_.store(threads_ - 1);
+        generation_.fetch_add(1);
+        if (sleepers_.load() > 0)
+        {
+            pthread_mutex_lock(&lock_);
+            pthread_cond_broadcast(&wake_);
+            pthread_mutex_unlock(&lock_);
+        }
+
+        fn(ctx, 0);
+
+        // Spin briefly, then give the core to the workers (there may be fewer cores than threads).
+        for (int spins = 0; remaining_.load() > 0; spins++)
+        {
+            if (spins > 1000)
+            {
+                sched_yield();
+            }
+        }
+    }
+
+    static void *worker_main(void *args)
+    {
+        worker_arg *arg = (worker_arg *) args;
+        arg->pool->worker_loop(arg->worker);
+        return NULL;
+    }
+
+    void worker_loop(int worker)
+    {
+        unsigned long seen = 0;
+        for (;;)
+        {
+            // Spin for new work, then sleep until run_job or the destructor wakes us.
+            std::chrono::steady_clock::time_point idle = std::chrono::steady_clock::now();
+            while (generation_.load() == seen &&
+                std::chrono::steady_clock::now() - idle < std::chrono::microseconds(POOL_SPIN_US))
+            {
+                sched_yield();
+            }
+            if (generation_.load() == seen)
+            {
+                pthread_mutex_lock(&lock_);
+                sleepers_.fetch_add(1);
+                while (generation_.load() == seen)
+                {
+                    pthread_cond_wait(&wake_, &lock_);
+                }
+                sleepers_.fetch_sub(1);
+                pthread_mutex_unlock(&lock_);
+            }
+            seen = generation_.load();
+            if (stop_.load())
+            {
+                return;
+            }
+
+            job_(job_ctx_, worker);
+            remaining_.fetch_sub(1);
+        }
+    }
+
+    ThreadPool(const ThreadPool &);             // Not copyable, owns its threads.
+    ThreadPool &operator=(const ThreadPool &);
+
+    int threads_;
+    pthread_t *workers_;
+    worker_arg *args_;
+    pthread_mutex_t lock_;
+    pthread_cond_t wake_;
+    std::atomic<unsigned long> generation_; // Bumped once per job.
+    std::atomic<int> remaining_; // Workers still running the current job.
+    std::atomic<int> sleepers_; // Workers blocked on wake_.
+    std::atomic<bool> stop_;
+    job_fn job_;
+    void *job_ctx_;
+};
+
+// Average microseconds for one empty parallel_for over calls calls, the pool's
+// fixed cost per operation (wake-up, the caller's share, waiting for the last worker).
+static inline double pool_dispatch_us(ThreadPool &pool, int calls)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int c = 0; c < calls; c++)
+    {
+        pool.parallel_for(0, pool.size(), [](long, long, int) {});
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / calls;
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Cache-tiled matrix multiplication tile shared by the Module02 pThread and OpenMP programs.
+//
+// multiply_tile() computes one TILE_I x TILE_J tile of C += A x B. Both
+// programs hand whole tiles to their threads, so keeping the tile sizes and
+// the tile kernel here means the two benchmarks always compare the same
+// tiling and differ only in how the tiles are scheduled.
+
+#ifndef TILE_MULTIPLY_H
+#define TILE_MULTIPLY_H
+
+#include <algorithm>
+#include "matrix.h"
+
+#define TILE_I 32   // Rows per tile, the TILE_I x TILE_J accumulator block (16KB) stays in L1.
+#define TILE_J 128  // Columns per tile, one row of a B tile is 512 bytes (8 cache lines).
+#define TILE_K 128  // Depth per tile, the TILE_K x TILE_J B tile (64KB) stays in L2.
+
+// Multiplies one tile of rows [i_start, i_stop) and columns [j_start, j_start + TILE_J).
+// Uses i-k-j order so the inner loop streams along rows of b, and sums into a
+// local accumulator block that is written back to result_m once per tile.
+static inline void multiply_tile(const Matrix<int>& matrix_a, const Matrix<int>& matrix_b, Matrix<int>& result_m,
+    int i_start, int i_stop, int j_start)
+{
+    int acc[TILE_I][TILE_J];
+    int depth = matrix_a.cols();
+    int j_stop = std::min(j_start + TILE_J, matrix_b.cols());
+    int width = j_stop - j_start;
+
+    for (int i=0; i<i_stop-i_start; i++)
+    {
+        for (int j=0; j<width; j++)
+        {
+            acc[i][j] = 0;
+        }
+    }
+
+    for (int kk=0; kk<depth; kk+=TILE_K)
+    {
+        int k_stop = std::min(kk + TILE_K, depth);
+        for (int i=i_start; i<i_stop; i++)
+        {
+            int* acc_row = acc[i - i_start];
+            for (int k=kk; k<k_stop; k++)
+            {
+                int a_ik = matrix_a[i][k];
+                const int* b_row = &matrix_b[k][j_start];
+                for (int j=0; j<width; j++)
+                {
+                    acc_row[j] += a_ik * b_row[j];
+                }
+            }
+        }
+    }
+
+    for (int i=i_start; i<i_stop; i++)
+    {
+        for (int j=0; j<width; j++)
+        {
+            result_m[i][j_start + j] += acc[i - i_start][j];
+        }
+    }
+}
+
+#endif
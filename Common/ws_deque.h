@@ -0,0 +1,154 @@
+// Chase-Lev work-stealing deque, one per worker thread.
+//
+// The owner pushes and pops at the bottom (LIFO, so it keeps working on the
+// data it just touched), idle threads steal from the top (the oldest, and for
+// divide and conquer the largest, piece of work). Only steals, and a pop that
+// races a steal for the last item, pay for a compare-and-swap. The memory
+// orders follow Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (PPoPP 2013).
+//
+// The ring grows when full. Old rings are kept until the deque is destroyed,
+// because a thief may still be reading one. T must be lock-free as a
+// std::atomic (an integer or a pointer), pack larger tasks into a word.
+
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+
+#define WS_DEQUE_CAPACITY 1024 // Initial slots, doubled when the owner overflows it.
+#define WS_CACHE_LINE 64
+
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    WorkStealingDeque() : top_(0), bottom_(0)
+    {
+        ring_.store(new_ring(WS_DEQUE_CAPACITY, NULL), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque()
+    {
+        ring *r = ring_.load(std::memory_order_relaxed);
+        while (r != NULL)
+        {
+            ring *older = r->older;
+            free(r->slots);
+            free(r);
+            r = older;
+        }
+    }
+
+    // Owner only: adds item at the bottom.
+    void push(T item)
+    {
+        long b = bottom_.load(std::memory_order_relaxed);
+        long t = top_.load(std::memory_order_acquire);
+        ring *r = ring_.load(std::memory_order_relaxed);
+        if (b - t > r->mask)
+        {
+            r = grow(r, t, b);
+        }
+        r->slots[b & r->mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only: takes the item pushed last, false if the deque is empty.
+    bool pop(T &item)
+    {
+        long b = bottom_.load(std::memory_order_relaxed) - 1;
+        ring *r = ring_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top_.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed); // Was empty.
+            return false;
+        }
+        item = r->slots[b & r->mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last item, a thief may be after it too.
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: takes the oldest item, false if empty or another thread got it first.
+    bool steal(T &item)
+    {
+        long t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return false;
+        }
+        ring *r = ring_.load(std::memory_order_acquire);
+        item = r->slots[t & r->mask].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // Approximate number of items, for statistics.
+    long size() const
+    {
+        long n = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+        return n > 0 ? n : 0;
+    }
+
+private:
+    struct ring
+    {
+        long mask; // Capacity - 1, the capacity is a power of two.
+        std::atomic<T> *slots;
+        ring *older; // The ring this one replaced.
+    };
+
+    static ring *new_ring(long capacity, ring *older)
+    {
+        ring *r = (ring *) malloc(sizeof(ring));
+        std::atomic<T> *slots = (std::atomic<T> *) malloc(sizeof(std::atomic<T>) * capacity);
+        if (r == NULL || slots == NULL)
+        {
+            perror("Couldn't grow the work-stealing deque");
+            exit(1);
+        }
+        r->slots = slots;
+        r->mask = capacity - 1;
+        r->older = older;
+        return r;
+    }
+
+    // Copies the live items [t, b) into a ring twice the size.
+    ring *grow(ring *r, long t, long b)
+    {
+        ring *bigger = new_ring(2 * (r->mask + 1), r);
+        for (long i = t; i < b; i++)
+        {
+            bigger->slots[i & bigger->mask].store(r->slots[i & r->mask].load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+        }
+        ring_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &);             // Not copyable, thieves hold its address.
+    WorkStealingDeque &operator=(const WorkStealingDeque &);
+
+    // top_ is written by thieves, bottom_ by the owner: keep them on separate lines.
+    std::atomic<long> top_;
+    char pad_top_[WS_CACHE_LINE];
+    std::atomic<long> bottom_;
+    char pad_bottom_[WS_CACHE_LINE];
+    std::atomic<ring *> ring_;
+};
+
+#endif
@@ -5,16 +5,21 @@
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/tile_multiply.h" // Cache-tiled multiplication kernel.
 #include <omp.h>
 
 using namespace std::chrono;
 using namespace std;
 
-#define SIZE 1000 // For ease of adjusting matrix size.
+#ifndef SIZE
+#define SIZE 1000 // For ease of adjusting matrix size. Override with -DSIZE=2048 etc.
+#endif
 #define THREADS 6 // Ideal number of threads = 6-12.
 
 // Sets all values in the matrix passed to zero.
-void init_zero(int** matrix)
+void init_zero(Matrix<int>& matrix)
 {
     for (int i=0; i<SIZE; i++)
     {
@@ -26,19 +31,21 @@ void init_zero(int** matrix)
 }
 
 // Random generation of values to populate matrix.
-void random_matrix(int** matrix, unsigned int seed)
+void random_matrix(Matrix<int>& matrix, uint64_t seed)
 {
+    // Every element depends only on its position, so the rows can be filled in any order.
+    #pragma omp parallel for
     for (int i=0; i<SIZE; i++)
     {
         for (int j=0; j<SIZE; j++)
         {
-            matrix[i][j] = rand_r(&seed) % 10;
+            matrix[i][j] = rng_int(seed, (uint64_t) i * SIZE + j, 10);
         }
     }
 }
 
 // Prints the matrix passed to the screen
-void print_matrix(int** matrix)
+void print_matrix(Matrix<int>& matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -53,7 +60,7 @@ void print_matrix(int** matrix)
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int** matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int>& matrix)
 {
     ofstream fstream(f_name); // Creates the txt file.
 
@@ -78,18 +85,15 @@ void write_matrix(string f_name, int calc_time, int** matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix.
-void multiply_matrix(int** matrix_a, int** matrix_b, int** result_m)
+void multiply_matrix(Matrix<int>& matrix_a, Matrix<int>& matrix_b, Matrix<int>& result_m)
 {
-    // Adds the parallelisation to the loops - Using Auto Scheduling
-    #pragma omp for schedule(auto)
-    for (int i=0; i<SIZE; i++)
+    // Adds the parallelisation to the loops - Each thread takes whole tiles (Auto Scheduling).
+    #pragma omp for collapse(2) schedule(auto)
+    for (int ii=0; ii<SIZE; ii+=TILE_I)
     {
-        for (int j=0; j<SIZE; j++)
+        for (int jj=0; jj<SIZE; jj+=TILE_J)
         {
-            for (int k=0; k<SIZE; k++)
-            {
-                result_m[i][j] += (matrix_a[i][k] * matrix_b[k][j]);
-            }
+            multiply_tile(matrix_a, matrix_b, result_m, ii, min(ii + TILE_I, SIZE), jj);
         }
     }
 }
@@ -98,24 +102,17 @@ void multiply_matrix(int** matrix_a, int** matrix_b, int** result_m)
 int main()
 {
     // Allocating the required memory for each matrix.
-    // Double pointers, 1st allocation for pointers.
-    int** matrix_a = (int**) malloc(sizeof(int*) * SIZE);
-    int** matrix_b = (int**) malloc(sizeof(int*) * SIZE);
-    int** result_m = (int**) malloc(sizeof(int*) * SIZE);
-    // 2nd allocation for integer space.
-    for (int i=0; i<SIZE; i++)
-    {
-        matrix_a[i] = (int*) malloc(sizeof(int) * SIZE);
-        matrix_b[i] = (int*) malloc(sizeof(int) * SIZE);
-        result_m[i] = (int*) malloc(sizeof(int) * SIZE);
-    }
+    // One aligned block per matrix, rows padded to whole cache lines.
+    Matrix<int> matrix_a(SIZE, SIZE);
+    Matrix<int> matrix_b(SIZE, SIZE);
+    Matrix<int> result_m(SIZE, SIZE);
 
     // Ensuring no garbage values exist
     init_zero(result_m);
 
     // Populate matrices a and b with random values.
-    random_matrix(matrix_a, 5);
-    random_matrix(matrix_b, 3);
+    random_matrix(matrix_a, RNG_SEED_A);
+    random_matrix(matrix_b, RNG_SEED_B);
 
     // print_matrix(matrix_a); // TEST Print Functions.
     // print_matrix(matrix_b);
@@ -159,18 +156,9 @@ int main()
     cout << "Calculation time: " << calc_time << " microseconds for the OPEN MP processing of a "
         << SIZE << " X " << SIZE << " Matrix." << endl;
     cout << "                  " << calc_time/1000000.0 << " seconds. Running " << THREADS << " partitions." <<endl;
+    cout << "                  " << (2.0 * SIZE * SIZE * SIZE) / (calc_time * 1000.0) << " GOP/s." << endl;
     cout << endl;
 
-    // Deallocate Memory & set pointer to NULL.
-    for (int i=0; i<SIZE; i++)
-    {
-        free(matrix_a[i]); matrix_a[i] = NULL;
-        free(matrix_b[i]); matrix_b[i] = NULL;
-        free(result_m[i]); result_m[i] = NULL;
-    }
-    free(matrix_a); matrix_a = NULL;
-    free(matrix_b); matrix_b = NULL;
-    free(result_m); result_m = NULL;
-
+    // Matrix memory is released when the matrices go out of scope.
     return 0;
 }
@@ -1,36 +1,27 @@
 // On Mac COMPILE WITH: clang++ -pthread pThread.cpp -o pthread -std=c++11
 // On Windows COMPILE WITH: g++ -pthread pThread.cpp -o pthread -std=c++11
+// Usage: ./pthread [static|dynamic|guided]
+    // Schedule the row tiles are handed out with (default static, equal blocks of tiles).
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
-#include <pthread.h>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/thread_pool.h" // Persistent worker pool.
+#include "../../Common/tile_multiply.h" // Cache-tiled multiplication kernel.
 
 using namespace std::chrono;
 using namespace std;
 
-#define SIZE 1000 // Matrix size - MUST be >= THREADS.
-#define THREADS 6 // Ideal number of threads = 6-12.
-
-// Matrix data pointers
-struct matrix_data
-{
-    int** matrix_a;
-    int** matrix_b;
-    int** result_m;
-};
-
-// Thread data for strat and stop positions.
-struct thread_data
-{
-   int start;
-   int stop;
-   matrix_data *m_data;
-};
+#ifndef SIZE
+#define SIZE 1000 // Matrix size. Override with -DSIZE=2048 etc.
+#endif
+#define THREADS 6 // Pool size, the main thread included. Ideal number of threads = 6-12.
 
 // Sets all values in the matrix passed to zero.
-void init_zero(int** matrix)
+void init_zero(Matrix<int>& matrix)
 {
     for (int i=0; i<SIZE; i++)
     {
@@ -42,19 +33,19 @@ void init_zero(int** matrix)
 }
 
 // Random generation of values to populate matrix.
-void random_matrix(int** matrix, unsigned int seed)
+void random_matrix(Matrix<int>& matrix, uint64_t seed)
 {
     for (int i=0; i<SIZE; i++)
     {
         for (int j=0; j<SIZE; j++)
         {
-            matrix[i][j] = rand_r(&seed) % 10;
+            matrix[i][j] = rng_int(seed, (uint64_t) i * SIZE + j, 10);
         }
     }
 }
 
 // Prints the matrix passed to the screen (for testing only).
-void print_matrix(int** matrix)
+void print_matrix(Matrix<int>& matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -69,7 +60,7 @@ void print_matrix(int** matrix)
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int** matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int>& matrix)
 {
     ofstream fstream(f_name); // Creates the txt file.
 
@@ -94,99 +85,53 @@ void write_matrix(string f_name, int calc_time, int** matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix.
-void *multiply_matrix(void *args)
+// Works through the tiles of row tiles [first_tile, last_tile), as handed out by the pool.
+void multiply_matrix(Matrix<int>& matrix_a, Matrix<int>& matrix_b, Matrix<int>& result_m, long first_tile, long last_tile)
 {
-    struct thread_data *t_data;
-    t_data = (struct thread_data*) args;
-
-    for (int i = t_data->start; i < t_data->stop; i++)
+    for (long tile = first_tile; tile < last_tile; tile++)
     {
-        for (int j=0; j<SIZE; j++)
+        int ii = tile * TILE_I;
+        int i_stop = min(ii + TILE_I, SIZE);
+        for (int jj=0; jj<SIZE; jj+=TILE_J)
         {
-            for (int k=0; k<SIZE; k++)
-            {
-                t_data->m_data->result_m[i][j] +=
-                    (t_data->m_data->matrix_a[i][k] *
-                        t_data->m_data->matrix_b[k][j]);
-            }
+            multiply_tile(matrix_a, matrix_b, result_m, ii, i_stop, jj);
         }
     }
-    pthread_exit(NULL);
 }
 
 
-int main()
+int main(int argc, char **argv)
 {
     // Allocating the required memory for each matrix.
-    // Double pointers, 1st allocation for pointers.
-    int** matrix_a = (int**) malloc(sizeof(int*) * SIZE);
-    int** matrix_b = (int**) malloc(sizeof(int*) * SIZE);
-    int** result_m = (int**) malloc(sizeof(int*) * SIZE);
-    // 2nd allocation for integer space.
-    for (int i=0; i<SIZE; i++)
-    {
-        matrix_a[i] = (int*) malloc(sizeof(int) * SIZE);
-        matrix_b[i] = (int*) malloc(sizeof(int) * SIZE);
-        result_m[i] = (int*) malloc(sizeof(int) * SIZE);
-    }
-
-
-    // Pointing the struct values to the matrices.
-    matrix_data m_data;
-    m_data.matrix_a = matrix_a;
-    m_data.matrix_b = matrix_b;
-    m_data.result_m = result_m;
+    // One aligned block per matrix, rows padded to whole cache lines.
+    Matrix<int> matrix_a(SIZE, SIZE);
+    Matrix<int> matrix_b(SIZE, SIZE);
+    Matrix<int> result_m(SIZE, SIZE);
+    pool_schedule schedule = pool_schedule_from(argc > 1 ? argv[1] : NULL, POOL_STATIC);
 
     // Ensuring no garbage values exist
     init_zero(result_m);
 
     // Populate matrices a and b with random values.
-    random_matrix(matrix_a, 5); random_matrix(matrix_b, 3);
+    random_matrix(matrix_a, RNG_SEED_A); random_matrix(matrix_b, RNG_SEED_B);
 
     // print_matrix(matrix_a); // TEST Print Functions.
     // print_matrix(matrix_b);
 
+    // The threads are started once, before the timer, and wait for work between calls.
+    ThreadPool pool(THREADS);
+
     // Start Timer
     auto start = high_resolution_clock::now();
 
-    // Setting the partition sizes and adjusting the number of threads.
-    int partition = SIZE / THREADS;
-    int remainder = SIZE % THREADS;
-    int thread_num = THREADS;
-
-    // Adds an aditional thread to handle the remainder.
-    if (remainder != 0)
-    {
-        thread_num+= 1;
-    }
-
-    // Creating an array of threads and thread_data structs.
-    pthread_t threads[thread_num];
-    thread_data t_data[thread_num];
-
-    // Allocating the partitions and putting the threads to work.
-    for (int i=0; i<thread_num; i++)
-    {
-        t_data[i].start = partition * i;
-        t_data[i].stop = t_data[i].start + partition;
-        t_data[i].m_data = &m_data;
-
-        // Dealing with the remainder partition.
-        if (i == thread_num - 1)
-        {
-            t_data[i].stop = SIZE;
-        }
-
-        // Creates and runs the thread
-        pthread_create(&threads[i], NULL, multiply_matrix, &t_data[i]);
-    }
-
-    // Joining threads
-    for (int i = 0; i < thread_num; i++)
-    {
-        pthread_join(threads[i], NULL);
-    }
-
+    // The unit of work is a row tile, a partial last tile is just a shorter
+    // one, so no extra thread is needed for the remainder.
+    int row_tiles = (SIZE + TILE_I - 1) / TILE_I;
+    // Static hands each worker one contiguous block of tiles, dynamic and guided
+    // take them from a shared counter one tile (or more, for guided) at a time.
+    pool.parallel_for(0, row_tiles, [&](long first, long last, int) {
+        multiply_matrix(matrix_a, matrix_b, result_m, first, last);
+    }, schedule, schedule == POOL_STATIC ? 0 : 1);
 
     // Stop Timer
     auto stop = high_resolution_clock::now();
@@ -202,19 +147,12 @@ int main()
     // Print Summary of Calulation Time.
     cout << "Calculation time: " << calc_time << " microseconds for the pTHREAD processing of a "
         << SIZE << " X " << SIZE << " Matrix." << endl;
-    cout << "                  " << calc_time/1000000.0 << " seconds. Running " << THREADS << " partitions." <<endl;
+    cout << "                  " << calc_time/1000000.0 << " seconds. Running " << THREADS << " threads, "
+        << row_tiles << " row tiles (" << pool_schedule_name(schedule) << " schedule)." <<endl;
+    cout << "                  " << (2.0 * SIZE * SIZE * SIZE) / (calc_time * 1000.0) << " GOP/s." << endl;
+    cout << "                  " << pool_dispatch_us(pool, 1000) << " microseconds pool dispatch per parallel_for." << endl;
     cout << endl;
 
-    // Deallocate Memory & set pointer to NULL.
-    for (int i=0; i<SIZE; i++)
-    {
-        free(matrix_a[i]); matrix_a[i] = NULL;
-        free(matrix_b[i]); matrix_b[i] = NULL;
-        free(result_m[i]); result_m[i] = NULL;
-    }
-    free(matrix_a); matrix_a = NULL;
-    free(matrix_b); matrix_b = NULL;
-    free(result_m); result_m = NULL;
-
+    // Matrix memory is released when the matrices go out of scope.
     return 0;
 }
@@ -1,10 +1,22 @@
 // On Mac RUN WITH: -
 // On Windows RUN WITH: g++ -fopenmp \OMP_Qsort.cpp -o ompQS.exe
+// Usage: ./ompQS [--algorithm auto|quick|radix|counting|sample] [--scheme lomuto|3way]
+//                [--pivot last|median3|ninther] [--input uniform|few|sorted|reverse]
+    // Defaults: auto, 3way, ninther, few (random 0-999, about 2000 copies of each key).
+    // auto samples the keys: a small key range gets counting sort, a wide one radix
+    // sort, and vectors under RADIX_MIN_SIZE elements the quicksort. sample is the
+    // comparison-based alternative to quick, parallel from the first pass.
+// Or: ./ompQS --bench
+    // Times the quicksort partition schemes and pivot rules, sample sort, radix
+    // sort and the automatic choice on all four inputs.
 
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
 #include <chrono>
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/quicksort.h" // Partition schemes, pivot rules and the heapsort fallback.
+#include "../../Common/omp_sort.h" // Quick, sample, radix and counting sorts and the sort_OMP driver.
 #include <omp.h>
 
 using namespace std::chrono;
@@ -12,13 +24,13 @@ using namespace std;
 
 #define SIZE 2000000 // Defines the size of the vector to be sorted.
 
-// Populates the vector with random values
-void rand_fill(int* vec, int size, unsigned int seed)
+// Populates the vector with the input pattern (random values use element i of stream seed).
+void rand_fill(int* vec, int size, qs_input input, uint64_t seed)
 {
     #pragma omp for schedule(auto) // Auto Schedule to fill vector.
     for (int i=0; i<size; i++)
     {
-        vec[i] = rand_r(&seed) %1000; // 0 to 999.
+        vec[i] = qs_value(i, size, input, seed);
     }
 }
 
@@ -83,101 +95,70 @@ void print_results(int size, int duration)
     cout << "                        " << duration / 1000000.0 << " seconds.\n" << endl;
 }
 
-// Swaps elements in the array (Quicksort Helper Procedure).
-void swap(int* a, int* b)
+// Times the quicksort partition schemes / pivot rules, sample sort, radix sort and the
+// automatic choice on each input pattern (--bench).
+void benchmark(int* vec, int limit)
 {
-    int* temp = a;
-    a = b;
-    b = temp;
-}
-
-// Re-arrange the array based on the pivot point (Quicksort Pivot Function).
-int partition(int* vec, int low, int high)
-{
-    int pivot = vec[high];  // Uses the last element as the pivot
-    int i = low-1;          // Pointer for the greater element.
-
-    // printf("Thread %d is PIVOTING.\n", omp_get_thread_num()); 
-    // cout << " LOW:" << low << " High: " << high << "\n [";
-    // for (int k=low; k<high; k++) {
-    //     cout << vec[k] << ",";
-    //     } cout << vec[high] << "]" << endl;
-
-    for (int j=low; j<high; j++)
-    {   // Ensures the values <= Pivot are placed on the left side of the array.
-        if (vec[j] <= pivot)
-        {
-            i++;
-            swap(vec[i], vec[j]);
-        }
-    }
-    // Final Swap to place the pivot value in its correct position.
-    swap(vec[i + 1], vec[high]);
-    // Returning the index of the pivot point.
-    return (i+1);
-}
-
-// Recursive QuickSort
-void quick_sort(int* vec, int low, int high)
-{
-    if (low < high)
-    {
-        // Reordering the vector & retrieving the pivot point
-        int pivot = partition(vec, low, high);
-
-        // Recursive call left of the pivot point
-        quick_sort(vec, low, pivot-1);
-
-        // Recursive call right of the pivot point.
-        quick_sort(vec, pivot+1, high);
-    }
-}
-
-// Recursive QuickSort (Main Quicksort Procedure).
-void quick_sort_OMP(int* vec, int low, int high, int limit)
-{
-    if (low < high)
+    static const int configs[][3] = {{SORT_QUICK, QS_LOMUTO, QS_PIVOT_LAST}, {SORT_QUICK, QS_LOMUTO, QS_PIVOT_NINTHER},
+        {SORT_QUICK, QS_THREE_WAY, QS_PIVOT_MEDIAN3}, {SORT_QUICK, QS_THREE_WAY, QS_PIVOT_NINTHER},
+        {SORT_SAMPLE, QS_THREE_WAY, QS_PIVOT_NINTHER}, {SORT_RADIX, QS_THREE_WAY, QS_PIVOT_NINTHER},
+        {SORT_AUTO, QS_THREE_WAY, QS_PIVOT_NINTHER}};
+
+    printf("\nOMP sorts, %d elements, %d threads.\n", SIZE, omp_get_max_threads());
+    printf(" input    sort                   seconds    heapsort fallbacks  sorted\n");
+    for (int input=0; input<4; input++)
     {
-        // Ensures that no additional tasks are allocated if vec is < limit.
-            // Keeps task creation overhead reasonable. 
-        if ((high-low) < limit)
-        {   // Calls sequential Quick Sort.
-            quick_sort(vec, low, high);
-        }
-        else
+        for (int c=0; c<7; c++)
         {
-            printf("Thread %d is entering quick_sort method.\n", omp_get_thread_num()); 
-            // Reordering the vector & retrieving the pivot point
-            int pivot = partition(vec, low, high);
-
-            // Explicitly defines the task and the shared data.
-            #pragma omp task shared(vec)
-            // Recursive call left of the pivot point
-            quick_sort_OMP(vec, low, pivot-1, limit);
-
-            // Recursive call right of the pivot point.
-            #pragma omp task shared(vec)
-            quick_sort_OMP(vec, pivot+1, high, limit);
+            qs_options opts;
+            opts.scheme = (qs_scheme) configs[c][1];
+            opts.pivot = (qs_pivot) configs[c][2];
+            opts.fallbacks = 0;
+            #pragma omp parallel
+            rand_fill(vec, SIZE, (qs_input) input, RNG_SEED_A);
+
+            auto start = chrono::high_resolution_clock::now();
+            sort_algorithm used = sort_OMP(vec, SIZE, limit, &opts, (sort_algorithm) configs[c][0]);
+            auto stop = chrono::high_resolution_clock::now();
+
+            string label = configs[c][0] == SORT_AUTO ? string("auto: ") + sort_names[used]
+                : used == SORT_QUICK ? string("quick ") + qs_scheme_names[opts.scheme] + " " + qs_pivot_names[opts.pivot]
+                : string(sort_names[used]);
+            printf(" %-8s %-22s %-10.4f %-19ld %s\n", qs_input_names[input], label.c_str(),
+                duration_cast<microseconds>(stop - start).count() / 1000000.0,
+                opts.fallbacks.load(), qs_is_sorted(vec, SIZE) ? "yes" : "NO");
         }
     }
+    cout << endl;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     // Allocating the memory for the array.
     int* v1 = (int*) malloc(sizeof(int) * SIZE);
-    //unsigned int seed = 3; // Seed to produce same result for testing. 
     int limit = 1000; // Limits the size of Vec that OMP will create additional threads for.
 
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        benchmark(v1, limit);
+        free(v1);
+        return 0;
+    }
+
+    qs_options opts;
+    opts.scheme = (qs_scheme) qs_lookup(qs_arg(argc, argv, "--scheme"), qs_scheme_names, 2, QS_THREE_WAY);
+    opts.pivot = (qs_pivot) qs_lookup(qs_arg(argc, argv, "--pivot"), qs_pivot_names, 3, QS_PIVOT_NINTHER);
+    opts.fallbacks = 0;
+    qs_input input = (qs_input) qs_lookup(qs_arg(argc, argv, "--input"), qs_input_names, 4, QS_FEW_UNIQUE);
+    sort_algorithm algorithm = (sort_algorithm) qs_lookup(qs_arg(argc, argv, "--algorithm"), sort_names, 5, SORT_AUTO);
+
     auto start = chrono::high_resolution_clock::now(); // Timer START.
     
     // OpenMP Parallised section - Using Auto Scheduling to fill Vector with random values.
-    #pragma omp parallel shared(v1, limit) default(none)
+    #pragma omp parallel shared(v1, input) default(none)
     {
-        int seed = omp_get_thread_num(); // Seeding with thread number.
-
         printf("Thread %d is entering rand_fill method.\n", omp_get_thread_num()); 
-        rand_fill(v1, SIZE, seed); // Fill Vector with random values 0-999.
+        rand_fill(v1, SIZE, input, RNG_SEED_A); // Fill Vector with the input pattern, the same whatever the thread count.
 
         #pragma omp barrier  // Wait for all threads to finish filling vector.  
     }
@@ -185,17 +166,7 @@ int main()
      // Writting the unordered vector to a txt file. 
     write_vec("OMP_Quicksort_OG_Vec", 5, v1);  
 
-    #pragma omp parallel // OpenMP Parallised section 
-    {
-        printf("Thread %d is entering quick_sort method.\n", omp_get_thread_num()); 
-
-        // OMP single ensures a single master task controls the process. 
-            // Once inside Q-Sort, OMP Task generates children to work in parallel.  
-        #pragma omp single
-        quick_sort_OMP(v1, 0, SIZE-1, limit); // Quick sort start.
-        // Waits for the child tasks to complete their work.
-        #pragma omp taskwait
-    }  
+    sort_algorithm used = sort_OMP(v1, SIZE, limit, &opts, algorithm); // Sort start.
 
     auto stop = chrono::high_resolution_clock::now(); // Timer STOP.
 
@@ -204,6 +175,22 @@ int main()
     write_vec("OMP_Quicksort_Sorted_Vec", duration, v1); // Writing the result to a txt file. 
     
     print_results(SIZE, duration); // Display results to the console. 
+    printf(" Input %s, %s sort", qs_input_names[input], sort_names[used]);
+    if (algorithm == SORT_AUTO)
+    {
+        printf(" (chosen from a sample of the keys)");
+    }
+    if (used == SORT_SAMPLE)
+    {
+        printf(", %d buckets, the largest %.2fx the average", sample_buckets,
+            (double) sample_largest * sample_buckets / SIZE);
+    }
+    if (used == SORT_QUICK)
+    {
+        printf(", %s partition, %s pivot, %ld heapsort fallbacks", qs_scheme_names[opts.scheme],
+            qs_pivot_names[opts.pivot], opts.fallbacks.load());
+    }
+    printf(".\n\n");
 
     free(v1); // Free the memory.
     v1 = NULL;
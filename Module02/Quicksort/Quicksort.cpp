@@ -1,22 +1,28 @@
 // On Mac RUN WITH: clang++ -std=c++11 Quicksort.cpp -o seq
 // On Windows RUN WITH: g++ -std=c++11 Quicksort.cpp -o seq
+// Usage: ./seq [--scheme lomuto|3way] [--pivot last|median3|ninther] [--input uniform|few|sorted|reverse]
+    // Defaults: 3way, ninther, few (random 0-999, about 2000 copies of each key).
+// Or: ./seq --bench
+    // Times the partition schemes and pivot rules on all four inputs.
 
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
 #include <chrono>
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/quicksort.h" // Partition schemes, pivot rules and the heapsort fallback.
 
 using namespace std::chrono;
 using namespace std;
 
 #define SIZE 2000000 // Defines the size of the vector to be sorted.
 
-// Populates the vector with random values
-void rand_fill(int* vec, int size, unsigned int seed)
+// Populates the vector with the input pattern (random values use element i of stream seed).
+void rand_fill(int* vec, int size, qs_input input, uint64_t seed)
 {
     for (int i=0; i<size; i++)
     {
-        vec[i] = rand_r(&seed) %1000; // 0 to 999.
+        vec[i] = qs_value(i, size, input, seed);
     }
 }
 
@@ -81,72 +87,71 @@ void print_results(int size, int duration)
     cout << "                        " << duration / 1000000.0 << " seconds.\n" << endl;
 }
 
-// Swaps elements in the array (Quicksort Helper Procedure).
-void swap(int* a, int* b)
+// QuickSort (Main Quicksort Procedure), with heapsort past the depth limit.
+void quick_sort(int* vec, int low, int high, qs_options* opts)
 {
-    int* temp = a;
-    a = b;
-    b = temp;
+    intro_sort(vec, low, high, qs_depth_limit(high - low + 1), opts);
 }
 
-// Re-arrange the array based on the pivot point (Quicksort Pivot Function). 
-int partition(int* vec, int low, int high)
+// Times every partition scheme / pivot rule pair on each input pattern (--bench).
+void benchmark(int* vec)
 {
-    int pivot = vec[high];  // Uses the last element as the pivot
-    int i = low-1;          // Pointer for the greater element.
-
-    // Print Statement for testing
-    // cout << " LOW:" << low << " High: " << high << "\n [";
-    // for (int k=low; k<high; k++) {
-    //     cout << vec[k] << ",";
-    //     } cout << vec[high] << "]" << endl;
-
-    for (int j=low; j<high; j++)
-    {   // Ensures the values <= Pivot are placed on the left side of the array.
-        if (vec[j] <= pivot)
+    static const int configs[][2] = {{QS_LOMUTO, QS_PIVOT_LAST}, {QS_LOMUTO, QS_PIVOT_NINTHER},
+        {QS_THREE_WAY, QS_PIVOT_MEDIAN3}, {QS_THREE_WAY, QS_PIVOT_NINTHER}};
+
+    printf("\nSequential Quicksort, %d elements.\n", SIZE);
+    printf(" input    scheme  pivot     seconds    heapsort fallbacks  sorted\n");
+    for (int input=0; input<4; input++)
+    {
+        for (int c=0; c<4; c++)
         {
-            i++;
-            swap(vec[i], vec[j]);
+            qs_options opts;
+            opts.scheme = (qs_scheme) configs[c][0];
+            opts.pivot = (qs_pivot) configs[c][1];
+            opts.fallbacks = 0;
+            rand_fill(vec, SIZE, (qs_input) input, RNG_SEED_A);
+
+            auto start = chrono::high_resolution_clock::now();
+            quick_sort(vec, 0, SIZE-1, &opts);
+            auto stop = chrono::high_resolution_clock::now();
+
+            printf(" %-8s %-7s %-9s %-10.4f %-19ld %s\n", qs_input_names[input], qs_scheme_names[opts.scheme],
+                qs_pivot_names[opts.pivot], duration_cast<microseconds>(stop - start).count() / 1000000.0,
+                opts.fallbacks.load(), qs_is_sorted(vec, SIZE) ? "yes" : "NO");
         }
     }
-    // Final Swap to place the pivot value in its correct position.
-    swap(vec[i + 1], vec[high]);
-    // Returning the index of the pivot point.
-    return (i+1);
+    cout << endl;
 }
 
-// Recursive QuickSort (Main Quicksort Procedure).
-void quick_sort(int* vec, int low, int high)
+int main(int argc, char** argv)
 {
-    if (low < high)
-    {
-        // Reordering the vector & retrieving the pivot point
-        int pivot = partition(vec, low, high);
-
-        // Recursive call left of the pivot point
-        quick_sort(vec, low, pivot-1);
+    // Allocating the memory for the array.
+    int* v1 = (int*) malloc(sizeof(int) * SIZE);
+    uint64_t seed = RNG_SEED_A; // Same vector every run, and the same as OMP_Qsort sorts.
 
-        // Recursive call right of the pivot point.
-        quick_sort(vec, pivot+1, high);
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        benchmark(v1);
+        free(v1);
+        return 0;
     }
-}
 
-int main()
-{
-    // Allocating the memory for the array.
-    int* v1 = (int*) malloc(sizeof(int) * SIZE);
-    unsigned int seed = 3; // Seed to produce same result for testing. 
+    qs_options opts;
+    opts.scheme = (qs_scheme) qs_lookup(qs_arg(argc, argv, "--scheme"), qs_scheme_names, 2, QS_THREE_WAY);
+    opts.pivot = (qs_pivot) qs_lookup(qs_arg(argc, argv, "--pivot"), qs_pivot_names, 3, QS_PIVOT_NINTHER);
+    opts.fallbacks = 0;
+    qs_input input = (qs_input) qs_lookup(qs_arg(argc, argv, "--input"), qs_input_names, 4, QS_FEW_UNIQUE);
 
     auto start = chrono::high_resolution_clock::now(); // Timer START.
     
     printf("Main is entering rand_fill method.\n");
-    rand_fill(v1, SIZE, seed); // Fill Vector with random values 0-999.
+    rand_fill(v1, SIZE, input, seed); // Fill Vector with the input pattern.
 
     // Writting the unordered vector to a txt file. 
     write_vec("Sequential_Quicksort_OG_Vec", 5, v1);  
     
     printf("Main is entering quick_sort method.\n");
-    quick_sort(v1, 0, SIZE-1); // Quick sort start.
+    quick_sort(v1, 0, SIZE-1, &opts); // Quick sort start.
     //print_vec(v1); // For testing
 
     auto stop = chrono::high_resolution_clock::now(); // Timer STOP.
@@ -157,6 +162,8 @@ int main()
 
     // Display results to the console. 
     print_results(SIZE, duration);
+    printf(" Input %s, %s partition, %s pivot, %ld heapsort fallbacks.\n\n", qs_input_names[input],
+        qs_scheme_names[opts.scheme], qs_pivot_names[opts.pivot], opts.fallbacks.load());
 
     free(v1); // Free Memory 
     v1 = NULL;
@@ -0,0 +1,427 @@
+// On Mac RUN WITH: clang++ -std=c++11 -O2 -Xpreprocessor -fopenmp -lomp -pthread WS_Qsort.cpp -o wsQS
+// On Windows RUN WITH: g++ -std=c++11 -O2 -fopenmp -pthread WS_Qsort.cpp -o wsQS
+// Usage: ./wsQS [elements] [threads]
+    // Sorts the same random vector twice, with OpenMP tasks (quick_sort_OMP's fixed
+    // cutoff of 1000) and with per-thread work-stealing deques whose cutoff adapts
+    // to the measured cost of a task and to the elements per thread, and compares
+    // wall time, tasks and steals.
+    // ws_compare.sh runs it from 2M to 1B elements.
+
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/thread_pool.h" // Persistent worker pool.
+#include "../../Common/ws_deque.h" // Chase-Lev work-stealing deque.
+#include <omp.h>
+
+using namespace std::chrono;
+using namespace std;
+
+#define SIZE 2000000 // Default size of the vector to be sorted, up to 2^32 - 1.
+#define OMP_LIMIT 1000 // quick_sort_OMP's fixed task cutoff.
+#define TASK_OVERHEAD 0.02 // Adaptive cutoff target: pushing and getting a task cost at most 2% of sorting it.
+#define TASKS_PER_THREAD 1024 // Enough tasks per thread to balance the load, finer splits only add overhead.
+#define CUTOFF_MIN 16 // Bounds of the adaptive cutoff (elements).
+#define CUTOFF_MAX (1 << 20)
+#define CALIBRATE_ELEMENTS 32768 // Sample sorted to estimate the sequential cost per element per level.
+#define CALIBRATE_TASKS 16384 // Pushes and pops timed to estimate the cost of a task.
+#define RETUNE_TASKS 64 // A worker recomputes the cutoff after this many tasks.
+
+// Per-thread deque and statistics. Only the owner writes the statistics.
+struct ws_worker
+{
+    WorkStealingDeque<uint64_t> deque;
+    long tasks;          // Tasks this thread ran.
+    long steals;         // Tasks it took from another thread's deque.
+    long failed_steals;  // Steal attempts that found nothing or lost the race.
+    double push_ns;      // Running average cost of pushing a task.
+    double task_ns;      // Running average cost of getting a task (pop or steal).
+    double level_ns;     // Running average sequential sort cost per element per level (n log2 n).
+    uint64_t victim_rng; // State for picking steal victims.
+    char pad[WS_CACHE_LINE]; // Keeps the next worker's fields off this cache line.
+};
+
+// State shared by the threads of one work-stealing sort.
+struct ws_sort
+{
+    int* vec;
+    long size;
+    ws_worker** workers;
+    int threads;
+    std::atomic<long> pending; // Tasks pushed and not yet finished, 0 ends the sort.
+    std::atomic<long> cutoff;  // Partitions of at most this many elements are sorted sequentially.
+};
+
+// Populates [start, stop) of the vector with random values, element i of stream seed.
+void rand_fill(int* vec, long start, long stop, uint64_t seed)
+{
+    rng_fill(vec, start, stop, seed, INT_MAX); // 0 to 2^31 - 2, almost all distinct.
+}
+
+// Re-arrange the array based on the pivot point (Quicksort Pivot Function).
+long partition(int* vec, long low, long high)
+{
+    int pivot = vec[high];  // Uses the last element as the pivot
+    long i = low-1;         // Pointer for the greater element.
+
+    for (long j=low; j<high; j++)
+    {   // Ensures the values <= Pivot are placed on the left side of the array.
+        if (vec[j] <= pivot)
+        {
+            i++;
+            swap(vec[i], vec[j]);
+        }
+    }
+    // Final Swap to place the pivot value in its correct position.
+    swap(vec[i + 1], vec[high]);
+    // Returning the index of the pivot point.
+    return (i+1);
+}
+
+// Recursive QuickSort, recursing into the smaller side so the stack stays O(log n).
+void quick_sort(int* vec, long low, long high)
+{
+    while (low < high)
+    {
+        long pivot = partition(vec, low, high);
+        if (pivot - low < high - pivot)
+        {
+            quick_sort(vec, low, pivot-1);
+            low = pivot+1;
+        }
+        else
+        {
+            quick_sort(vec, pivot+1, high);
+            high = pivot-1;
+        }
+    }
+}
+
+// OpenMP task QuickSort as in OMP_Qsort.cpp, counting the tasks it creates.
+void quick_sort_OMP(int* vec, long low, long high, int limit, long* tasks)
+{
+    if (low < high)
+    {
+        if ((high-low) < limit)
+        {   // Calls sequential Quick Sort.
+            quick_sort(vec, low, high);
+        }
+        else
+        {
+            long pivot = partition(vec, low, high);
+
+            #pragma omp atomic
+            *tasks += 2;
+
+            #pragma omp task shared(vec)
+            quick_sort_OMP(vec, low, pivot-1, limit, tasks);
+
+            #pragma omp task shared(vec)
+            quick_sort_OMP(vec, pivot+1, high, limit, tasks);
+        }
+    }
+}
+
+// A task is the range [low, high], packed into one word for the deque.
+uint64_t task_pack(long low, long high)
+{
+    return ((uint64_t) low << 32) | (uint32_t) high;
+}
+
+void task_unpack(uint64_t task, long* low, long* high)
+{
+    *low = (long) (task >> 32);
+    *high = (long) (uint32_t) task;
+}
+
+// Folds one sample into a running average. Samples more than 4x off the
+// average (e.g. the thread was descheduled mid-sort) only move it by 4x.
+void update_average(double* average, double sample)
+{
+    sample = max(*average / 4, min(*average * 4, sample));
+    *average = 0.9 * *average + 0.1 * sample;
+}
+
+// Cost of sorting n elements sequentially, n log2 n levels of level_ns.
+double leaf_ns(double n, double level_ns)
+{
+    return n * log2(max(2.0, n)) * level_ns;
+}
+
+// Cutoff for a sort of size elements on threads threads. A leaf must be big
+// enough that the cost of its task (push plus pop or steal) stays under
+// TASK_OVERHEAD of sorting it, and need be no smaller than TASKS_PER_THREAD
+// leaves per thread to keep every thread busy.
+long adaptive_cutoff(double task_ns, double level_ns, long size, int threads)
+{
+    // Smallest n with leaf_ns(n) >= task_ns / TASK_OVERHEAD, by fixed-point iteration.
+    double target = task_ns / (TASK_OVERHEAD * level_ns), n = target;
+    for (int i=0; i<4; i++)
+    {
+        n = target / log2(max(2.0, n));
+    }
+    double cutoff = max(n, (double) size / ((double) threads * TASKS_PER_THREAD));
+    return (long) max((double) CUTOFF_MIN, min((double) CUTOFF_MAX, cutoff));
+}
+
+// Splits [low, high] until it is below the cutoff, pushing the larger side of
+// each split for thieves and keeping the smaller one, then sorts the rest.
+void run_task(ws_sort* ws, ws_worker* self, long low, long high)
+{
+    while (high - low + 1 > ws->cutoff.load(std::memory_order_relaxed))
+    {
+        long pivot = partition(ws->vec, low, high);
+        auto start = steady_clock::now();
+        ws->pending.fetch_add(1, std::memory_order_relaxed);
+        if (pivot - low > high - pivot)
+        {
+            self->deque.push(task_pack(low, pivot-1));
+            low = pivot+1;
+        }
+        else
+        {
+            self->deque.push(task_pack(pivot+1, high));
+            high = pivot-1;
+        }
+        update_average(&self->push_ns, duration_cast<nanoseconds>(steady_clock::now() - start).count());
+    }
+
+    if (high - low >= 1)
+    {
+        auto start = steady_clock::now();
+        quick_sort(ws->vec, low, high);
+        double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+        update_average(&self->level_ns, ns / leaf_ns(high - low + 1, 1.0));
+    }
+}
+
+// Steals from up to threads - 1 randomly chosen victims.
+bool steal_task(ws_sort* ws, int me, uint64_t* task)
+{
+    ws_worker* self = ws->workers[me];
+    for (int attempt = 1; attempt < ws->threads; attempt++)
+    {
+        int victim = rng_at(self->victim_rng++, me) % ws->threads;
+        if (victim == me)
+        {
+            continue;
+        }
+        auto start = steady_clock::now();
+        if (ws->workers[victim]->deque.steal(*task))
+        {
+            update_average(&self->task_ns, duration_cast<nanoseconds>(steady_clock::now() - start).count());
+            self->steals++;
+            return true;
+        }
+        self->failed_steals++;
+    }
+    return false;
+}
+
+// Worker loop: runs its own tasks newest first, steals when it runs out, and
+// returns when no task is left anywhere.
+void ws_worker_loop(ws_sort* ws, int me)
+{
+    ws_worker* self = ws->workers[me];
+    while (ws->pending.load(std::memory_order_acquire) > 0)
+    {
+        uint64_t task;
+        auto start = steady_clock::now();
+        if (self->deque.pop(task))
+        {
+            update_average(&self->task_ns, duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+        else if (!steal_task(ws, me, &task))
+        {
+            sched_yield(); // Nothing to steal, let the threads that have work run.
+            continue;
+        }
+
+        long low, high;
+        task_unpack(task, &low, &high);
+        run_task(ws, self, low, high);
+        self->tasks++;
+        ws->pending.fetch_sub(1, std::memory_order_release);
+
+        if (self->tasks % RETUNE_TASKS == 0)
+        {
+            ws->cutoff.store(adaptive_cutoff(self->push_ns + self->task_ns, self->level_ns, ws->size, ws->threads),
+                std::memory_order_relaxed);
+        }
+    }
+}
+
+// Times a sequential sort of a sample and local push / pop pairs, the starting
+// point for every worker's running averages.
+void calibrate(int* vec, long size, double* push_ns, double* task_ns, double* level_ns)
+{
+    long n = min(size, (long) CALIBRATE_ELEMENTS);
+    int* sample = (int*) malloc(sizeof(int) * n);
+    copy(vec, vec + n, sample);
+    auto start = steady_clock::now();
+    quick_sort(sample, 0, n-1);
+    *level_ns = max(0.1, (double) duration_cast<nanoseconds>(steady_clock::now() - start).count() / leaf_ns(n, 1.0));
+    free(sample);
+
+    WorkStealingDeque<uint64_t> deque;
+    std::atomic<long> pending(0);
+    uint64_t task;
+    start = steady_clock::now();
+    for (int i=0; i<CALIBRATE_TASKS; i++)
+    {
+        pending.fetch_add(1);
+        deque.push(task_pack(i, i));
+    }
+    auto pushed = steady_clock::now();
+    for (int i=0; i<CALIBRATE_TASKS; i++)
+    {
+        deque.pop(task);
+        pending.fetch_sub(1);
+    }
+    *push_ns = max(1.0, (double) duration_cast<nanoseconds>(pushed - start).count() / CALIBRATE_TASKS);
+    *task_ns = max(1.0, (double) duration_cast<nanoseconds>(steady_clock::now() - pushed).count() / CALIBRATE_TASKS);
+}
+
+// Work-stealing QuickSort of vec[0, size) on the pool's threads.
+void quick_sort_WS(int* vec, long size, ThreadPool& pool, ws_worker** workers, long* initial_cutoff, long* final_cutoff)
+{
+    double push_ns, task_ns, level_ns;
+    calibrate(vec, size, &push_ns, &task_ns, &level_ns);
+
+    ws_sort ws;
+    ws.vec = vec;
+    ws.size = size;
+    ws.workers = workers;
+    ws.threads = pool.size();
+    ws.pending.store(1);
+    ws.cutoff.store(adaptive_cutoff(push_ns + task_ns, level_ns, size, pool.size()));
+    *initial_cutoff = ws.cutoff.load();
+
+    for (int w=0; w<pool.size(); w++)
+    {
+        workers[w]->tasks = workers[w]->steals = workers[w]->failed_steals = 0;
+        workers[w]->push_ns = push_ns;
+        workers[w]->task_ns = task_ns;
+        workers[w]->level_ns = level_ns;
+        workers[w]->victim_rng = (uint64_t) w << 32;
+    }
+    workers[0]->deque.push(task_pack(0, size-1)); // The caller is worker 0 of the pool.
+
+    pool.run([&](int worker) {
+        ws_worker_loop(&ws, worker);
+    });
+    *final_cutoff = ws.cutoff.load();
+}
+
+// Checks the vector is in order and holds the values it was filled with.
+bool check_sorted(int* vec, long size, long long expected_sum)
+{
+    long long sum = 0;
+    for (long i=0; i<size; i++)
+    {
+        if (i > 0 && vec[i-1] > vec[i])
+        {
+            return false;
+        }
+        sum += vec[i];
+    }
+    return sum == expected_sum;
+}
+
+int main(int argc, char** argv)
+{
+    long size = argc > 1 ? atol(argv[1]) : SIZE;
+    int threads = argc > 2 ? atoi(argv[2]) : omp_get_max_threads();
+    if (size < 2 || size > UINT_MAX)
+    {
+        printf("The number of elements must be between 2 and %u.\n", UINT_MAX);
+        exit(1);
+    }
+
+    int* v1 = (int*) malloc(sizeof(int) * size);
+    if (v1 == NULL)
+    {
+        perror("Couldn't allocate the vector");
+        exit(1);
+    }
+
+    ThreadPool pool(threads);
+    omp_set_num_threads(threads);
+    ws_worker** workers = (ws_worker**) malloc(sizeof(ws_worker*) * threads);
+    for (int w=0; w<threads; w++)
+    {
+        workers[w] = new ws_worker();
+    }
+
+    // Both sorts get the same vector, refilled from its counter-based stream.
+    long long expected_sum = 0;
+    pool.parallel_for(0, size, [&](long first, long last, int) {
+        rand_fill(v1, first, last, RNG_SEED_A);
+    });
+    for (long i=0; i<size; i++)
+    {
+        expected_sum += v1[i];
+    }
+
+    // OpenMP tasks.
+    long omp_tasks = 0;
+    auto start = high_resolution_clock::now();
+    #pragma omp parallel
+    {
+        #pragma omp single
+        quick_sort_OMP(v1, 0, size-1, OMP_LIMIT, &omp_tasks);
+    }
+    auto stop = high_resolution_clock::now();
+    double omp_seconds = duration_cast<microseconds>(stop - start).count() / 1000000.0;
+    bool omp_sorted = check_sorted(v1, size, expected_sum);
+
+    // Work stealing.
+    pool.parallel_for(0, size, [&](long first, long last, int) {
+        rand_fill(v1, first, last, RNG_SEED_A);
+    });
+    long initial_cutoff, final_cutoff;
+    start = high_resolution_clock::now();
+    quick_sort_WS(v1, size, pool, workers, &initial_cutoff, &final_cutoff);
+    stop = high_resolution_clock::now();
+    double ws_seconds = duration_cast<microseconds>(stop - start).count() / 1000000.0;
+    bool ws_sorted = check_sorted(v1, size, expected_sum);
+
+    long ws_tasks = 0, ws_steals = 0, ws_failed = 0;
+    for (int w=0; w<threads; w++)
+    {
+        ws_tasks += workers[w]->tasks;
+        ws_steals += workers[w]->steals;
+        ws_failed += workers[w]->failed_steals;
+    }
+
+    // Print Summary
+    cout << "\nVector of Length " << size << ", " << threads << " threads:" << endl;
+    cout << " OpenMP tasks:  " << omp_seconds << " seconds, " << omp_tasks << " tasks, cutoff "
+        << OMP_LIMIT << " (fixed). Sorted: " << (omp_sorted ? "yes" : "NO") << endl;
+    cout << " Work stealing: " << ws_seconds << " seconds, " << ws_tasks << " tasks, " << ws_steals
+        << " steals (" << ws_failed << " failed), cutoff " << initial_cutoff << " -> " << final_cutoff
+        << ". Sorted: " << (ws_sorted ? "yes" : "NO") << endl;
+    cout << " Work stealing speed-up over OpenMP tasks: " << omp_seconds / ws_seconds << "x" << endl;
+    cout << " Thread  tasks      steals     push ns  get ns   sort ns/(n log2 n)" << endl;
+    for (int w=0; w<threads; w++)
+    {
+        printf(" %-7d %-10ld %-10ld %-8.0f %-8.0f %.2f\n", w, workers[w]->tasks, workers[w]->steals,
+            workers[w]->push_ns, workers[w]->task_ns, workers[w]->level_ns);
+    }
+    cout << endl;
+
+    for (int w=0; w<threads; w++)
+    {
+        delete workers[w];
+    }
+    free(workers);
+    free(v1); // Free the memory.
+    v1 = NULL;
+
+    return (omp_sorted && ws_sorted) ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Wall time and steal counts of the work-stealing quicksort against OpenMP tasks.
+# Usage: ./ws_compare.sh [threads] [sizes...]
+#   Sizes default to 2M, 16M, 128M and 1B elements. 1B needs 4GB for the vector.
+# The cutoff column is the work-stealing cutoff at the start and end of the sort.
+# It grows with the elements per thread (TASKS_PER_THREAD leaves each), and with
+# many threads and few elements it is set by the measured cost of a task instead.
+
+THREADS=${1:-$(nproc)}
+shift
+SIZES=${@:-2000000 16000000 128000000 1000000000}
+
+g++ -std=c++11 -O2 -fopenmp -pthread WS_Qsort.cpp -o wsQS || exit 1
+
+echo "Work stealing vs OpenMP tasks, $THREADS threads"
+echo "elements     omp s      omp tasks  ws s       ws tasks   steals     cutoff          speedup"
+for n in $SIZES; do
+    ./wsQS $n $THREADS | awk -v n=$n '
+        /^ OpenMP tasks:/ { omp_s = $3; omp_tasks = $5 }
+        /^ Work stealing:/ { ws_s = $3; ws_tasks = $5; steals = $7; cutoff = $12 "->" $14; sub(/\./, "", cutoff) }
+        END { printf "%-12d %-10.4f %-10d %-10.4f %-10d %-10d %-15s %.2fx\n",
+              n, omp_s, omp_tasks, ws_s, ws_tasks, steals, cutoff, omp_s / ws_s }'
+done
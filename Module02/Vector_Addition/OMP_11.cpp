@@ -5,18 +5,19 @@
 
 // include Open MP library
 #include <omp.h>
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 using namespace std::chrono;
 using namespace std;
 
-void randomVector(int vector[], int size, unsigned int seed)
+void randomVector(int vector[], int size, uint64_t seed)
 {
     // Parallelise for loop to set elements to random numbers
     #pragma omp for
     for (int i = 0; i < size; i++)
     {
-        // Set element i in vector with a random number from 0-99
-        vector[i] = rand_r(&seed) % 100;
+        // Element i of stream seed, 0-99, the same whichever thread sets it.
+        vector[i] = rng_int(seed, i, 100);
     }
 }
 
@@ -25,8 +26,6 @@ int main(){
     unsigned long size = 150000000; // 150,000,000
     const int THREADS = 8;
 
-    srand(time(0));
-
     int *v1, *v2, *v3;
 
     // Setup number of threads to use
@@ -45,14 +44,12 @@ int main(){
    #pragma omp parallel
    {
 
-        // Seed for the random number generator
-        unsigned int seed = omp_get_thread_num();
         // Printing of thread numbers as created.
-        printf(", %d", seed);
+        printf(", %d", omp_get_thread_num());
 
         // Fill random vectors
-        randomVector(v1, size, seed);
-        randomVector(v2, size, seed);
+        randomVector(v1, size, RNG_SEED_A);
+        randomVector(v2, size, RNG_SEED_B);
 
         // Wait for random vector to fill
         #pragma omp barrier
@@ -5,18 +5,19 @@
 
 // include Open MP library
 #include <omp.h>
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 using namespace std::chrono;
 using namespace std;
 
-void randomVector(int vector[], int size, unsigned int seed)
+void randomVector(int vector[], int size, uint64_t seed)
 {
     // Parallelise for loop to set elements to random numbers
     #pragma omp for
     for (int i = 0; i < size; i++)
     {
-        // Set element i in vector with a random number from 0-99
-        vector[i] = rand_r(&seed) % 100;
+        // Element i of stream seed, 0-99, the same whichever thread sets it.
+        vector[i] = rng_int(seed, i, 100);
     }
 }
 
@@ -24,10 +25,9 @@ int main(){
 
     unsigned long size = 150000000; // 150,000,000
     const int THREADS = 8;
+    double addStart = 0, addStop = 0; // Add pass on its own, for the GB/s figure.
     int total = 0;
 
-    srand(time(0));
-
     int *v1, *v2, *v3;
 
     // Setup number of threads to use
@@ -43,19 +43,19 @@ int main(){
 
     // Parallelise population of vectors and sum the values.
     cout << "Running Threads";
-    #pragma omp parallel shared(v1, v2, v3, size) default(none)
+    #pragma omp parallel shared(v1, v2, v3, size, addStart, addStop) default(none)
     {
-        // Seed for the random number generator
-        unsigned int seed = omp_get_thread_num();
         // Printing of thread numbers as created.
-        printf(", %d", seed);
+        printf(", %d", omp_get_thread_num());
 
         // Fill random vectors
-        randomVector(v1, size, seed);
-        randomVector(v2, size, seed);
+        randomVector(v1, size, RNG_SEED_A);
+        randomVector(v2, size, RNG_SEED_B);
 
-        // Wait for random vector to fill
+        // Wait for random vector to fill, then time the add pass on its own.
         #pragma omp barrier
+        #pragma omp single
+        addStart = omp_get_wtime();
 
         // Parallelise for loop to add v1 and v2 components
         #pragma omp for
@@ -64,6 +64,9 @@ int main(){
             v3[i] = v1[i] + v2[i];
         }
 
+        #pragma omp barrier
+        #pragma omp single
+        addStop = omp_get_wtime();
     }
 
     auto stop = high_resolution_clock::now();
@@ -76,6 +79,8 @@ int main(){
         <<  size << " Elements)." << endl;
     cout << " Time taken by function: " << duration.count() << " microseconds" << endl;
     cout << " Time taken by function: " << duration.count()/1000000.0 << " seconds" << endl;
+    cout << " Add pass: " << (addStop - addStart) * 1000000 << " microseconds, "
+        << size * 12.0 / (addStop - addStart) / 1e9 << " GB/s (v1 and v2 read, v3 written)" << endl;
 
     // Free Memory
     free(v1);
@@ -0,0 +1,133 @@
+// COMPILE COMMAND: g++ -O2 -fopenmp -pthread OMP_25.cpp -o omp25
+// Usage: ./omp25 [--large]
+    // --large: Vectors on 2MB huge pages, v3 written with non-temporal stores,
+    //          and the add pass compared against the host's STREAM peak.
+#include <iostream>
+#include <cstdlib>
+#include <time.h>
+#include <chrono>
+#include <cstring>
+
+// include Open MP library
+#include <omp.h>
+#include "../../Common/add_reduce.h" // Fused SIMD add and 64-bit sum.
+#include "../../Common/large_vectors.h" // Huge-page vectors and the STREAM peak.
+#include "../../Common/rng.h" // Counter-based random numbers.
+
+using namespace std::chrono;
+using namespace std;
+
+void randomVector(int vector[], int size, uint64_t seed)
+{
+    // Parallelise for loop to set elements to random numbers
+    #pragma omp for
+    for (int i = 0; i < size; i++)
+    {
+        // Element i of stream seed, 0-99, the same whichever thread sets it.
+        vector[i] = rng_int(seed, i, 100);
+    }
+}
+
+int main(int argc, char **argv){
+
+    bool large = argc > 1 && strcmp(argv[1], "--large") == 0;
+    unsigned long size = 150000000; // 150,000,000
+    const int THREADS = 8;
+    long long total = 0;
+    double addStart = 0, addStop = 0;
+
+    // One partial sum per thread, each on its own cache line so the threads don't share one.
+    long long partial[THREADS][8] = {{0}};
+
+    int *v1, *v2, *v3;
+
+    // Setup number of threads to use
+    omp_set_num_threads(THREADS);
+
+    // Start time of vector randomisation and addition
+    auto start = high_resolution_clock::now();
+
+    // Allocate vector size
+    v1 = (int *) large_alloc(size * sizeof(int), large);
+    v2 = (int *) large_alloc(size * sizeof(int), large);
+    v3 = (int *) large_alloc(size * sizeof(int), large);
+
+    // Parallelise population of vectors, then add and sum them in one pass.
+    cout << "Running Threads";
+    #pragma omp parallel shared(v1, v2, v3, size, partial, addStart, addStop, large) default(none)
+    {
+        // Printing of thread numbers as created.
+        printf(", %d", omp_get_thread_num());
+
+        // Fill random vectors
+        randomVector(v1, size, RNG_SEED_A);
+        randomVector(v2, size, RNG_SEED_B);
+
+        // Fault v3 in now (as STREAM initialises its arrays) so the timed pass
+        // measures memory bandwidth rather than page faults.
+        if (large)
+        {
+            #pragma omp for
+            for (unsigned long i = 0; i < size; i++)
+            {
+                v3[i] = 0;
+            }
+        }
+
+        // Wait for random vector to fill, then time the add pass on its own.
+        #pragma omp barrier
+        #pragma omp single
+        addStart = omp_get_wtime();
+
+        // Each thread adds and sums its own contiguous block, the same block the
+        // static schedule of randomVector filled.
+        int threads = omp_get_num_threads();
+        int id = omp_get_thread_num();
+        long first = (long) size * id / threads;
+        long last = (long) size * (id + 1) / threads;
+        partial[id][0] = add_reduce(v1, v2, v3, first, last, large);
+
+        #pragma omp barrier
+        #pragma omp single
+        addStop = omp_get_wtime();
+    }
+
+    // Combine the per-thread partials.
+    for (int t = 0; t < THREADS; t++)
+    {
+        total += partial[t][0];
+    }
+
+    auto stop = high_resolution_clock::now();
+
+    // End time of vector randomisation and addition
+    auto duration = duration_cast<microseconds>(stop - start);
+
+    // Ensure that total is calculating correctly.
+    long long totalCheck = 0;
+    for (unsigned long i = 0; i < size; i++)
+    {
+        totalCheck += v1[i];
+        totalCheck += v2[i];
+    }
+
+    // Print Summary
+    cout << ",\nOMP: Fused SIMD add and sum, per-thread partials: 2.5 ("
+    << THREADS << " Threads, " <<  size << " Elements, " << add_reduce_kernel_name(large) << " kernel, " << large_alloc_kind << " pages). \nTotal Value: "
+    << total << ", expecting: " << totalCheck <<endl;
+    cout << " Time taken by function: " << duration.count() << " microseconds" << endl;
+    cout << " Time taken by function: " << duration.count()/1000000.0 << " seconds" << endl;
+    cout << " Add pass: " << (addStop - addStart) * 1000000 << " microseconds, "
+        << add_reduce_gbs(size, addStop - addStart) << " GB/s (v1 and v2 read, v3 written)" << endl;
+    if (large)
+    {
+        print_stream_peak(THREADS, add_reduce_gbs(size, addStop - addStart), add_reduce_streams(large));
+    }
+
+    // Free Memory
+    large_free(v1, size * sizeof(int), large);
+    large_free(v2, size * sizeof(int), large);
+    large_free(v3, size * sizeof(int), large);
+
+    return 0;
+}
@@ -2,18 +2,18 @@
 #include <cstdlib>
 #include <time.h>
 #include <chrono>
-
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 using namespace std::chrono;
 using namespace std;
 
 // Populates the vector passed with random values
-void randomVector(int vector[], int size)
+void randomVector(int vector[], int size, uint64_t seed)
 {
     for (int i = 0; i < size; i++)
     {
-        // Values of 0-99.
-        vector[i] = rand() % 100;
+        // Values of 0-99, element i of stream seed.
+        vector[i] = rng_int(seed, i, 100);
     }
 }
 
@@ -22,8 +22,6 @@ int main(){
 
     unsigned long size = 150000000; // 150,000,000
 
-    srand(time(0));
-
     int *v1, *v2, *v3;
 
     // Start timer
@@ -35,8 +33,8 @@ int main(){
     v3 = (int *) malloc(size * sizeof(int *));
 
     // Populates V1 and V2 with interger values 0-99.
-    randomVector(v1, size);
-    randomVector(v2, size);
+    randomVector(v1, size, RNG_SEED_A);
+    randomVector(v2, size, RNG_SEED_B);
 
     // Sums corrosponding elements in V1 and V2 adding the result to V3.
     for (int i = 0; i < size; i++)
@@ -1,45 +1,80 @@
-// Compile: mpicxx MPI_MM.cpp -o mpi
+// Compile: mpicxx -O2 MPI_MM.cpp -o mpi
 // Run Head: mpirun -np 4 ./mpi
 // Run Cluster: sudo mpirun -np 4 -hostfile ./cluster ./mpi
+// Run Pipelined: mpirun -np 4 ./mpi --pipeline (overlaps B/C transfers with compute)
+// Run Generated: mpirun -np 4 ./mpi --generate (each rank makes its own rows of A and its own B)
+// Run SUMMA:   mpirun -np 4 ./mpi --summa 2400 (2D process grid, see summa_node)
+// Scaling:     ./scaling.sh (strong and weak scaling of the SUMMA mode)
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include <cstring>
+#include <cstdint>
 #include <mpi.h>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/partition.h" // Weighted Scatterv/Gatherv partitions.
+#include "../../Common/mpi_pipeline.h" // Pipelined mode driver.
+#include "gemm.h" // Packed panel SIMD multiplication engine.
 
 using namespace std::chrono;
 using namespace std;
 
 #define SIZE 1200 // For ease of adjusting matrix size.
-int **matrix_a, **matrix_b, **result_m; // Global Pointers
+#define PIPE_ROWS 192 // Rows multiplied between MPI progress calls in the pipelined mode.
+#define SUMMA_PANEL 256 // Widest k panel broadcast per SUMMA step.
+#define SUMMA_CHECKS 16 // Entries of C each rank checks after a SUMMA run.
+#define SUMMA_WRITE_MAX 2000 // Largest SUMMA result gathered to rank 0 and written out.
+Matrix<int> *matrix_a, *matrix_b, *result_m; // Global Pointers
+bool generate_input = false; // --generate: no scatter of A or broadcast of B, every rank generates its own.
 
-// Initialise Matrix 
-void init_matrix(int **&matrix, bool fill);
+// Initialise Matrix, filled with rows [first_row, first_row + rows) of the SIZE x SIZE matrix seed.
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed = RNG_SEED_A, int first_row = 0);
 
 // Deallocates the memory for the matrices 
 void deallocate_memory();
 
 // Sets all values in the matrix passed to zero.
-void init_zero(int **&matrix);
+void init_zero(Matrix<int> &matrix);
 
 // Prints the matrix passed to the screen 
-void print_matrix(int **&matrix);
+void print_matrix(Matrix<int> &matrix);
 
 // Prints the performance results
 void print_results(int calc_time, int size);
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix);
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix);
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix. 
-void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition);
+void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition);
 
 // Head Node process control function
-void head_node(int num_tasks, int rank);
+void head_node(int num_tasks, int rank, double weight);
 
 // Worker Node process control function
-void worker_node(int num_tasks, int rank);
+void worker_node(int num_tasks, int rank, double weight);
+
+// Pipelined mode, B panels and C panels move while the previous panel is multiplied.
+void pipeline_node(int num_tasks, int rank, double weight);
+
+// Multiplies this rank's rows of A by one panel of B.
+void multiply_panel(const int *panel_b, int *panel_c, int partition, int width, MPI_Request *pending);
+
+// SUMMA on a 2D process grid, each rank only holds one block of A, B and C.
+void summa_node(int num_tasks, int n);
+
+// Value of element (i, j) of matrix a (which = 0) or b (which = 1).
+int element_value(int i, int j, int n, int which);
+
+// First row/column of block p when n is split over num_blocks, and its length.
+int block_start(int n, int num_blocks, int p);
+int block_size(int n, int num_blocks, int p);
+
+// Index of the block that holds row/column k.
+int block_owner(int n, int num_blocks, int k);
 
 
 int main(int argc, char **argv) 
@@ -53,18 +88,67 @@ int main(int argc, char **argv)
     MPI_Comm_size(MPI_COMM_WORLD , &num_pocesses); // Get the number of tasts/processes.
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank i.e. process ID.
     MPI_Get_processor_name(name, &name_len); // Find the processors name. 
+    double weight = parse_weight(argc, argv); // Share of the rows for this node (--weight w).
+
+    // Modes: ./mpi --generate, ./mpi --pipeline, ./mpi --summa [n]
+    bool pipeline = false, summa = false;
+    int summa_size = SIZE;
+    for (int i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--generate") == 0)
+        {
+            generate_input = true;
+        }
+        if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipeline = true;
+        }
+        if (strcmp(argv[i], "--summa") == 0)
+        {
+            summa = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                summa_size = atoi(argv[++i]);
+            }
+        }
+    }
+
+    // The pipelined mode streams A and B from the head node, SUMMA has its own layout.
+    if (pipeline && (generate_input || summa))
+    {
+        if (rank == 0)
+        {
+            printf("\n--pipeline can't be combined with --generate or --summa.\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (pipeline)
+    {
+        pipeline_node(num_pocesses, rank, weight);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (summa)
+    {
+        summa_node(num_pocesses, summa_size);
+        MPI_Finalize();
+        return 0;
+    }
 
     auto start = high_resolution_clock::now();
 
     if (rank == 0)
     {
         printf("\n%s is entering the head_node function", name);
-        head_node(num_pocesses, rank);
+        head_node(num_pocesses, rank, weight);
     }
     else
     {
         printf("\n%s is entering the worker_node function", name);
-        worker_node(num_pocesses, rank);
+        worker_node(num_pocesses, rank, weight);
     }
     int val = MPI_Barrier(MPI_COMM_WORLD);
     //printf("\n%s has completed all work", name);
@@ -78,7 +162,7 @@ int main(int argc, char **argv)
         int calc_time = duration_cast<microseconds>(stop - start).count();
 
         // Write results to text file. 
-        write_matrix("MPI_Distributed.txt", calc_time, result_m);
+        write_matrix("MPI_Distributed.txt", calc_time, *result_m);
 
         // print_matrix(result_m); // TEST Print Function. 
 
@@ -94,26 +178,20 @@ int main(int argc, char **argv)
     return 0;
 }
 
-// Initialise Matrix 
-void init_matrix(int **&matrix, bool fill)
+// Initialise Matrix (rows x SIZE)
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed, int first_row)
 {
-    // Allocate the memory to the arrays
-    matrix = (int**) malloc(sizeof(int*) * SIZE * SIZE);
-    int* temp = (int *) malloc(sizeof(int) * SIZE * SIZE);
-
-    for (int i = 0; i < SIZE; ++i)
-    {
-        matrix[i] = &temp[i * SIZE];
-    }
+    // Allocate the memory to the matrix, one aligned block.
+    matrix = new Matrix<int>(rows, SIZE);
 
-    // Populate with random values.
+    // Populate with random values, element (first_row + i, j) of stream seed.
     if (fill) 
     {
-        for (int i = 0; i < SIZE; ++i)
+        for (int i = 0; i < rows; ++i)
         {
             for (int j = 0; j < SIZE; ++j)
             {
-                matrix[i][j] = rand() % 100;
+                (*matrix)[i][j] = rng_int(seed, (uint64_t) (first_row + i) * SIZE + j, 100);
             }
         }
     }
@@ -121,7 +199,7 @@ void init_matrix(int **&matrix, bool fill)
 }
 
 // Sets all values in the matrix passed to zero.
-void init_zero(int **&matrix)
+void init_zero(Matrix<int> &matrix)
 {
     for (int i=0; i<SIZE; i++)
     {
@@ -133,65 +211,342 @@ void init_zero(int **&matrix)
 }
 
 // Head Node Tasks
-void head_node(int num_pocesses, int rank)
+void head_node(int num_pocesses, int rank, double weight)
 {
-    
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, Matrix<int>::padded_ld(SIZE), weight, num_pocesses, counts, displs);
+
+    int partition = counts[rank] / Matrix<int>::padded_ld(SIZE); // Number of rows for this process
+
     // Declare Matrices and allocate memory for each.
-    // Populate matrices a and b with random values. 
-    init_matrix(matrix_a, true);
-    init_matrix(matrix_b, true);
-    init_matrix(result_m, false);
+    // Populate matrices a and b with random values, with --generate only the
+    // head node's own rows of A (the first ones).
+    init_matrix(matrix_a, generate_input ? partition : SIZE, true);
+    init_matrix(matrix_b, SIZE, true, RNG_SEED_B);
+    init_matrix(result_m, SIZE, false);
 
     // print_matrix(matrix_a); // TEST Print Function.
     // print_matrix(matrix_b);
 
-    int partition = SIZE/num_pocesses; // Number of rows per process
-    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
+    int broadcast_size = SIZE * matrix_b->ld(); // Number of elements to be broadcast (padded rows)
 
-    // Scatter Matrix A to Nodes
-    MPI_Scatter(&matrix_a[0][0], scatter_size, MPI_INT, &matrix_a, 0, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!generate_input)
+    {
+        // Scatter Matrix A to Nodes, the head node's own rows stay in place.
+        MPI_Scatterv(matrix_a->data(), counts, displs, MPI_INT, MPI_IN_PLACE, counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
 
-    // Broadcast Entire Matrix B to Nodes
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+        // Broadcast Entire Matrix B to Nodes
+        MPI_Bcast(matrix_b->data(), broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
     // Perform the multiplication 
-    multiply_matrix(matrix_a, matrix_b, result_m, partition);
+    multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
     printf("\nWorker: %d has Completed Matrix Multiplication", rank);
 
     // Gather results from Nodes and write to resuts matrix
-    MPI_Gather(MPI_IN_PLACE, scatter_size, MPI_INT, &result_m[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(MPI_IN_PLACE, counts[rank], MPI_INT, result_m->data(), counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    free(counts);
+    free(displs);
 
 }
 
 // Worker Node tasks
-void worker_node(int num_pocesses, int rank)
+void worker_node(int num_pocesses, int rank, double weight)
 {
-    // Declare and allocate memory to receive data sent. 
-    init_matrix(matrix_a, false);
-    init_matrix(matrix_b, false);
-    init_matrix(result_m, false);
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, Matrix<int>::padded_ld(SIZE), weight, num_pocesses, counts, displs);
+
+    int partition = counts[rank] / Matrix<int>::padded_ld(SIZE); // Number of rows for this process
+
+    // Declare and allocate memory to receive data sent, or with --generate
+    // fill this rank's rows of A and all of B here.
+    int first_row = displs[rank] / Matrix<int>::padded_ld(SIZE);
+    init_matrix(matrix_a, partition, generate_input, RNG_SEED_A, first_row);
+    init_matrix(matrix_b, SIZE, generate_input, RNG_SEED_B);
+    init_matrix(result_m, partition, false);
 
-    int partition = SIZE/num_pocesses; // Number of rows per process
-    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
+    int broadcast_size = SIZE * matrix_b->ld(); // Number of elements to be broadcast (padded rows)
 
     // Receive the matrix data from the head node. 
-    MPI_Scatter(NULL, scatter_size, MPI_INT, &matrix_a[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!generate_input)
+    {
+        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, matrix_a->data(), counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(matrix_b->data(), broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    }
     
 
     // Perform the multiplication 
-    multiply_matrix(matrix_a, matrix_b, result_m, partition);
+    multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
     printf("\nWorker: %d has Completed Matrix Multiplication", rank);
 
     // Gather the results
-    MPI_Gather(&result_m[0][0], scatter_size, MPI_INT, NULL, scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(result_m->data(), counts[rank], MPI_INT, NULL, NULL, NULL, MPI_INT, 0, MPI_COMM_WORLD);
+    free(counts);
+    free(displs);
 
 }
 
+// Pipelined multiplication that overlaps communication with computation,
+// see Common/mpi_pipeline.h. multiply_panel does the work on each panel.
+void pipeline_node(int num_pocesses, int rank, double weight)
+{
+    // Rows of A and C for each process and the first row of each.
+    int *rows = (int *) malloc(num_pocesses * sizeof(int));
+    int *first = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, 1, weight, num_pocesses, rows, first);
+
+    // The head node holds all of A, B and C, the workers a slab of A.
+    if (rank == 0)
+    {
+        init_matrix(matrix_a, SIZE, true);
+        init_matrix(matrix_b, SIZE, true, RNG_SEED_B);
+        init_matrix(result_m, SIZE, false);
+    }
+    else
+    {
+        init_matrix(matrix_a, rows[rank], false);
+    }
+
+    double seconds = pipeline_run(matrix_a, matrix_b, result_m, SIZE, rows, first, multiply_panel,
+        "MPI", gemm_kernel_name<int>());
+    if (rank == 0)
+    {
+        write_matrix("MPI_Pipelined.txt", (int) (seconds * 1000000), *result_m);
+    }
+    free(rows);
+    free(first);
+    deallocate_memory();
+}
+
+// Multiplies this rank's slab of A by one panel of B, PIPE_ROWS rows at a time.
+// MPI only moves nonblocking collectives along when it is called, so the
+// requests in flight are tested between blocks.
+void multiply_panel(const int *panel_b, int *panel_c, int partition, int width, MPI_Request *pending)
+{
+    int flag;
+    for (int i=0; i<partition; i+=PIPE_ROWS)
+    {
+        gemm(min(PIPE_ROWS, partition - i), width, SIZE, (*matrix_a)[i], matrix_a->ld(), panel_b, width,
+            panel_c + (size_t) i * width, width);
+        MPI_Testall(PIPE_REQUESTS, pending, &flag, MPI_STATUSES_IGNORE);
+    }
+}
+
+// SUMMA (Scalable Universal Matrix Multiplication Algorithm) on a 2D process grid.
+// The grid is built with MPI_Cart_create and A, B and C are split into matching
+// blocks (block, not block-cyclic, uneven sizes are allowed). Each rank generates
+// its own blocks of A and B, so nothing is scattered and per-rank memory is O(n^2/p).
+// For every k panel the owning grid column broadcasts its slice of A along each
+// grid row, the owning grid row broadcasts its slice of B down each grid column,
+// and every rank adds panel_a x panel_b into its block of C.
+void summa_node(int num_pocesses, int n)
+{
+    // Build the process grid, as square as MPI can make it.
+    int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2], rank;
+    MPI_Comm grid, row_comm, col_comm;
+    MPI_Dims_create(num_pocesses, 2, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &grid);
+    MPI_Comm_rank(grid, &rank);
+    MPI_Cart_coords(grid, rank, 2, coords);
+
+    if (n < dims[0] || n < dims[1])
+    {
+        if (rank == 0)
+        {
+            printf("\nSUMMA needs at least %d rows for a %d x %d grid.\n", max(dims[0], dims[1]), dims[0], dims[1]);
+        }
+        MPI_Comm_free(&grid);
+        return;
+    }
+
+    // Communicators for this rank's grid row (rank = grid column) and grid column (rank = grid row).
+    int keep_row[2] = {0, 1}, keep_col[2] = {1, 0};
+    MPI_Cart_sub(grid, keep_row, &row_comm);
+    MPI_Cart_sub(grid, keep_col, &col_comm);
+
+    // This rank's block of A, B and C.
+    int row0 = block_start(n, dims[0], coords[0]), rows = block_size(n, dims[0], coords[0]);
+    int col0 = block_start(n, dims[1], coords[1]), cols = block_size(n, dims[1], coords[1]);
+
+    double start = MPI_Wtime();
+    Matrix<int> block_a(rows, cols), block_b(rows, cols), block_c(rows, cols);
+    for (int i=0; i<rows; i++)
+    {
+        for (int j=0; j<cols; j++)
+        {
+            block_a[i][j] = element_value(row0 + i, col0 + j, n, 0);
+            block_b[i][j] = element_value(row0 + i, col0 + j, n, 1);
+        }
+    }
+
+    // Receive buffers for one k panel, rows x SUMMA_PANEL of A and SUMMA_PANEL x cols of B.
+    int *panel_a = (int *) gemm_alloc(sizeof(int) * rows * SUMMA_PANEL);
+    int *panel_b = (int *) gemm_alloc(sizeof(int) * SUMMA_PANEL * block_b.ld());
+
+    MPI_Barrier(grid);
+    double generated = MPI_Wtime();
+
+    // Walk k in panels that never cross a block boundary of A's columns or B's rows,
+    // so each panel has exactly one owner in the grid row and one in the grid column.
+    for (int k0=0; k0<n; )
+    {
+        int a_owner = block_owner(n, dims[1], k0);
+        int b_owner = block_owner(n, dims[0], k0);
+        int k1 = min(k0 + SUMMA_PANEL, n);
+        k1 = min(k1, block_start(n, dims[1], a_owner) + block_size(n, dims[1], a_owner));
+        k1 = min(k1, block_start(n, dims[0], b_owner) + block_size(n, dims[0], b_owner));
+        int width = k1 - k0;
+
+        // A panel: the owner sends a strided column slice straight from its block,
+        // the others receive it packed (rows x width).
+        const int *a = panel_a;
+        int lda = width;
+        if (coords[1] == a_owner)
+        {
+            MPI_Datatype slice;
+            MPI_Type_vector(rows, width, block_a.ld(), MPI_INT, &slice);
+            MPI_Type_commit(&slice);
+            MPI_Bcast(&block_a[0][k0 - col0], 1, slice, a_owner, row_comm);
+            MPI_Type_free(&slice);
+            a = &block_a[0][k0 - col0];
+            lda = block_a.ld();
+        }
+        else
+        {
+            MPI_Bcast(panel_a, rows * width, MPI_INT, a_owner, row_comm);
+        }
+
+        // B panel: whole rows of the owner's block, already contiguous.
+        const int *b = panel_b;
+        if (coords[0] == b_owner)
+        {
+            b = block_b[k0 - row0];
+        }
+        MPI_Bcast((void *) b, width * block_b.ld(), MPI_INT, b_owner, col_comm);
+
+        gemm(rows, cols, width, a, lda, b, block_b.ld(), block_c[0], block_c.ld());
+        k0 = k1;
+    }
+
+    MPI_Barrier(grid);
+    double multiplied = MPI_Wtime();
+
+    // Check a few entries of this rank's block of C against a direct dot product.
+    int errors = 0, total_errors = 0;
+    for (int s=0; s<SUMMA_CHECKS; s++)
+    {
+        int i = (int) (((long long) s * 7919) % rows);
+        int j = (int) (((long long) s * 104729) % cols);
+        int expected = 0;
+        for (int k=0; k<n; k++)
+        {
+            expected += element_value(row0 + i, k, n, 0) * element_value(k, col0 + j, n, 1);
+        }
+        if (block_c[i][j] != expected)
+        {
+            errors++;
+        }
+    }
+    MPI_Reduce(&errors, &total_errors, 1, MPI_INT, MPI_SUM, 0, grid);
+
+    // Gather C to rank 0 block by block (small problems only), each block lands
+    // straight in its place through a strided datatype.
+    double gather_time = 0;
+    if (n <= SUMMA_WRITE_MAX)
+    {
+        double gather_start = MPI_Wtime();
+        if (rank == 0)
+        {
+            Matrix<int> result(n, n);
+            for (int i=0; i<rows; i++)
+            {
+                memcpy(result[row0 + i] + col0, block_c[i], sizeof(int) * cols);
+            }
+            for (int p=1; p<num_pocesses; p++)
+            {
+                int pc[2];
+                MPI_Cart_coords(grid, p, 2, pc);
+                MPI_Datatype place;
+                MPI_Type_vector(block_size(n, dims[0], pc[0]), block_size(n, dims[1], pc[1]), result.ld(), MPI_INT, &place);
+                MPI_Type_commit(&place);
+                MPI_Recv(&result[block_start(n, dims[0], pc[0])][block_start(n, dims[1], pc[1])], 1, place, p, 0, grid, MPI_STATUS_IGNORE);
+                MPI_Type_free(&place);
+            }
+            gather_time = MPI_Wtime() - gather_start;
+            write_matrix("MPI_SUMMA.txt", (int) ((multiplied - generated) * 1000000), result);
+        }
+        else
+        {
+            MPI_Datatype place;
+            MPI_Type_vector(rows, cols, block_c.ld(), MPI_INT, &place);
+            MPI_Type_commit(&place);
+            MPI_Send(block_c[0], 1, place, 0, 0, grid);
+            MPI_Type_free(&place);
+        }
+    }
+
+    if (rank == 0)
+    {
+        double calc_time = multiplied - generated;
+        cout << "\nSUMMA multiplication of a " << n << " X " << n << " Matrix on a " << dims[0] << " x " << dims[1]
+            << " process grid (" << gemm_kernel_name<int>() << " kernel)." << endl;
+        cout << "Generation time: " << generated - start << " seconds." << endl;
+        cout << "Multiply time:   " << calc_time << " seconds. (" << 2.0 * n * n * n / calc_time / 1e9 << " GOP/s)" << endl;
+        if (n <= SUMMA_WRITE_MAX)
+        {
+            cout << "Gather time:     " << gather_time << " seconds. (written to MPI_SUMMA.txt)" << endl;
+        }
+        else
+        {
+            cout << "Result not gathered, larger than " << SUMMA_WRITE_MAX << " X " << SUMMA_WRITE_MAX << "." << endl;
+        }
+        cout << "Spot check:      " << (total_errors == 0 ? "passed" : "FAILED") << " (" << total_errors << " of "
+            << SUMMA_CHECKS * num_pocesses << " entries wrong)." << endl << endl;
+    }
+
+    free(panel_a);
+    free(panel_b);
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+    MPI_Comm_free(&grid);
+}
+
+// Value of element (i, j) of n x n matrix a (which = 0) or b (which = 1), 0 to 99.
+// Counter-based, so any rank can generate any block on its own, and at n = SIZE
+// the matrices are the same ones init_matrix fills.
+int element_value(int i, int j, int n, int which)
+{
+    return rng_int(which == 0 ? RNG_SEED_A : RNG_SEED_B, (uint64_t) i * n + j, 100);
+}
+
+// First row/column of block p, the first n % num_blocks blocks get one extra.
+int block_start(int n, int num_blocks, int p)
+{
+    return p * (n / num_blocks) + min(p, n % num_blocks);
+}
+
+int block_size(int n, int num_blocks, int p)
+{
+    return n / num_blocks + (p < n % num_blocks ? 1 : 0);
+}
+
+// Index of the block that holds row/column k.
+int block_owner(int n, int num_blocks, int k)
+{
+    int q = n / num_blocks, r = n % num_blocks;
+    if (k < r * (q + 1))
+    {
+        return k / (q + 1);
+    }
+    return r + (k - r * (q + 1)) / q;
+}
+
 // Prints the matrix passed to the screen 
-void print_matrix(int **&matrix)
+void print_matrix(Matrix<int> &matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -209,13 +564,17 @@ void print_matrix(int **&matrix)
 void print_results(int calc_time, int size)
 {
     cout << "\n\nCalculation time: " << calc_time << " microseconds.\nMPI Distributed processing of a " 
-        << size << " X " << size << " Matrix." << endl;
+        << size << " X " << size << " Matrix (" << gemm_kernel_name<int>() << " kernel)." << endl;
     cout << "                  " << calc_time/1000000.0 << " seconds." << endl;
+    if (generate_input)
+    {
+        cout << "Input generated in place on every rank, A not scattered and B not broadcast." << endl;
+    }
     cout << endl;
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix)
 {
     ofstream fstream(f_name); // Creates the txt file. 
 
@@ -226,10 +585,10 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 
     // Writes the matrix passed to the file. 
     fstream << "\n";
-    for (int i=0; i<SIZE; i++)
+    for (int i=0; i<matrix.rows(); i++)
     {
         fstream << "|";
-        for (int j=0; j<SIZE; j++)
+        for (int j=0; j<matrix.cols(); j++)
         {
             fstream << matrix[i][j] << "|";
         }
@@ -240,25 +599,17 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix. 
-void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition)
+void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition)
 {
-    for (int i=0; i<partition; i++)
-    {
-        for (int j=0; j<SIZE; j++)
-        {
-            for (int k=0; k<SIZE; k++)
-            {
-                result_m[i][j] += (matrix_a[i][k] * matrix_b[k][j]);
-            }
-        }
-    }
+    gemm(partition, SIZE, SIZE, matrix_a[0], matrix_a.ld(), matrix_b[0], matrix_b.ld(),
+        result_m[0], result_m.ld());
 }
 
 void deallocate_memory()
 {
-    free(matrix_a);
-    free(matrix_b);
-    free(result_m); 
+    delete matrix_a;
+    delete matrix_b;
+    delete result_m; 
 
     matrix_a = NULL;
     matrix_b = NULL;
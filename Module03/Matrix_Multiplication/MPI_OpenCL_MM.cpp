@@ -1,46 +1,102 @@
-// Compile: mpicxx MPI_OpenCL_MM.cpp -o ocl -lOpenCL
+// Compile: mpicxx -O2 -fopenmp MPI_OpenCL_MM.cpp -o ocl -lOpenCL
 // Run Cluster: sudo mpirun -np 4 -hostfile ./cluster ./ocl
+// Run Co-scheduled: mpirun -np 4 ./ocl --cosched (rows split between the OpenCL device and the CPU cores)
+// Run Zero-copy: mpirun -np 4 ./ocl --zero-copy (buffers wrap the matrices, see setup_kernel_memory)
+// Run Generated: mpirun -np 4 ./ocl --generate (each rank makes its own rows of A and its own B)
+// The first run on a device tries every kernel variant and saves the fastest
+// to multiply_matrix.tune, delete that file to tune again. Compiled kernels are
+// cached in .ocl_cache (or $OCL_CACHE_DIR) so later runs skip the build.
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include <cstring>
 #include <mpi.h>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/partition.h" // Weighted Scatterv/Gatherv partitions.
+#include "../../Common/ocl_runtime.h" // Persistent OpenCL runtime with a program binary cache.
+#include "gemm.h" // Packed panel SIMD multiplication engine, the CPU side of --cosched.
+#include <omp.h>
 #include <CL/cl.h>
 
 using namespace std::chrono;
 using namespace std;
 
 #define SIZE 190 // For ease of adjusting matrix size.
-const int TS = 4;
-int **matrix_a, **matrix_b, **result_m; // Global Pointers
+#define TUNE_FILE "multiply_matrix.tune" // Fastest kernel variant found per device and size.
+#define TUNE_RUNS 3 // Timed runs of each variant while tuning, the fastest counts.
+#define TUNE_CHECKS 8 // Elements of C checked against the host for each variant.
+#define COSCHED_ROWS 32 // Rows of A split between the device and the CPU each round of --cosched.
+#define COSCHED_START 0.5 // Device share of the first round.
+#define COSCHED_MIN_SHARE 0.05 // Both sides keep at least this share so they are still measured.
+#define COSCHED_SMOOTH 0.5 // Weight of the latest round when updating the device share.
+Matrix<int> *matrix_a, *matrix_b, *result_m; // Global Pointers
 
 // OpenCL Variables
 cl_mem buf_mA, buf_mB, buf_mR; // Declares a buffer memory object for each matrix.
-cl_device_id device_id; // Active Device ID.
-cl_context context; // Context where kernel is executed and memory managment is defined.
-cl_program program; // Program consisting of kernels identified with the "kernel" qualifier.
-cl_kernel kernel; // Kernal object to encapsulate the specific __kernel function.
-cl_command_queue queue; // Command Queue to run Kernal functions.
+OclRuntime *ocl = NULL; // Device, context, queue, cached programs and buffer pool, created once per rank.
+cl_kernel kernel = NULL; // Kernal object to encapsulate the specific __kernel function, owned by ocl.
+cl_command_queue queue; // Command Queue to run Kernal functions, owned by ocl.
 cl_event event = NULL; // Event object used to track the status of a command.
+bool cosched = false; // --cosched: split each rank's rows between the device and an OpenMP CPU kernel.
+bool zero_copy = false; // --zero-copy: buffers use the matrices in place, C is never uploaded.
+bool generate_input = false; // --generate: no scatter of A or broadcast of B, every rank generates its own.
 int err; // A variable to hold error codes.
 
-size_t local[2] = {TS, TS}; // Local Working group size (i.e. 2D matrices)
+size_t local[2] = {1, 1}; // Local Working group size (i.e. 2D matrices), set per kernel variant.
 size_t global[2] = {(size_t)SIZE, (size_t)SIZE}; // Number of rows & columns: Or number of threads with indices i & J (row & column) fr results_m.
 
+// One build of the multiply kernel. The tiled kernel is compiled with these as
+// -D options (see multiply_matrix.cl), the naive kernel ignores them.
+struct kernel_variant
+{
+    const char *kernel; // Kernel function in multiply_matrix.cl.
+    int tsm, tsn, tsk; // Block of C per work-group and depth of the __local tiles.
+    int wptm, wptn; // Block of C per work-item (register blocking).
+    int vw; // Vector width of the B loads.
+};
+
+// Candidates tried by the autotuner, the naive kernel first as the baseline.
+const kernel_variant variants[] = {
+    {"multiply_matrix", 0, 0, 0, 1, 1, 1},
+    {"multiply_matrix_tiled", 16, 16, 16, 1, 1, 1},
+    {"multiply_matrix_tiled", 16, 16, 16, 2, 2, 2},
+    {"multiply_matrix_tiled", 32, 32, 16, 4, 4, 4},
+    {"multiply_matrix_tiled", 32, 64, 16, 4, 8, 8},
+    {"multiply_matrix_tiled", 64, 64, 16, 8, 8, 8},
+    {"multiply_matrix_tiled", 64, 64, 32, 8, 4, 4},
+    {"multiply_matrix_tiled", 128, 64, 16, 8, 8, 8},
+};
+const int NUM_VARIANTS = sizeof(variants) / sizeof(variants[0]);
+
 //////////////////////////////// OpenCL FUNCTIONS Sigs ////////////////////////////////
-// Create a device and return the device ID.
-cl_device_id create_device();
+// Writes the -D build options of kernel variant v (empty for the naive kernel).
+void variant_options(int v, char *options);
+
+// Makes kernel variant v the current kernel, built once and then reused from the runtime's cache.
+// False if the variant doesn't build on this device.
+bool build_variant(int v);
+
+// Sets the global and local work sizes of kernel variant v for partition rows.
+void set_variant_range(int v, int partition);
+
+// Runs the current kernel once, returns the OpenCL error code.
+cl_int enqueue_variant(int v);
 
-// Creates the device, defines the context, creates the command queue and kernel.
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname);
+// Times kernel variant v on this rank's rows, -1 if the device can't run it or its results are wrong.
+double time_variant(int v, int partition);
 
-// Defines the program; sets context, device, and passing the file name. Returns program object.
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename);
+// Returns the fastest kernel variant for this device and partition, from TUNE_FILE or by timing them all.
+int autotune(int partition, int rank);
 
-// Defines buffer object and writes buffer object to host memory (command queue).
+// Takes buffer objects from the runtime's pool and writes the matrices to them (command queue).
 void setup_kernel_memory(int partition); // Partition represents the size of data chunks to be distributed.
 
+// Waits for the kernel and brings this rank's rows of C back into result_m.
+void read_result(int partition);
+
 // Copies the kernel arguments.
 void copy_kernel_args(int partition); // Partition represents the size of data chunks to be distributed.
 
@@ -48,32 +104,38 @@ void copy_kernel_args(int partition); // Partition represents the size of data c
 void free_memory();
 
 //////////////////////////////// STANDARD FUNCTIONS Sigs ////////////////////////////////
-// Initialise Matrix
-void init_matrix(int **&matrix, bool fill);
+// Initialise Matrix, filled with rows [first_row, first_row + rows) of the SIZE x SIZE matrix seed.
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed = RNG_SEED_A, int first_row = 0);
 
 // Prints the matrix passed to the screen
-void print_matrix(int **&matrix);
+void print_matrix(Matrix<int> &matrix);
 
 // Prints the performance results
 void print_results(int calc_time, int size);
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix);
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix);
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix.
-// void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition);
+// void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition);
 
 // Head Node process control function
-void head_node(int num_tasks, int rank);
+void head_node(int num_tasks, int rank, double weight);
 
 // Worker Node process control function
-void worker_node(int num_tasks, int rank);
+void worker_node(int num_tasks, int rank, double weight);
 
 // Deallocates the memory for the matrices
 void deallocate_memory();
 
-// Initiates OpenCL when called
-void run_openCL(int partition);
+// Initiates OpenCL when called, multiplies this rank's rows of A by B into result_m.
+void run_openCL(int partition, int rank);
+
+// Multiplies rows [start, stop) of A by B on the CPU cores with OpenMP.
+void multiply_rows_cpu(int start, int stop);
+
+// Co-scheduled multiply, rounds of rows shared between the device and the CPU by measured speed.
+void run_cosched(int partition, int rank, int v);
 
 
 int main(int argc, char **argv)
@@ -87,18 +149,37 @@ int main(int argc, char **argv)
     MPI_Comm_size(MPI_COMM_WORLD , &num_pocesses); // Get the number of tasts/processes.
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank i.e. process ID.
     MPI_Get_processor_name(name, &name_len); // Find the processors name.
+    double weight = parse_weight(argc, argv); // Share of the rows for this node (--weight w).
+
+    // Co-scheduled mode: ./ocl --cosched, zero-copy buffers: ./ocl --zero-copy,
+    // generated input: ./ocl --generate
+    for (int i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--generate") == 0)
+        {
+            generate_input = true;
+        }
+        if (strcmp(argv[i], "--cosched") == 0)
+        {
+            cosched = true;
+        }
+        if (strcmp(argv[i], "--zero-copy") == 0)
+        {
+            zero_copy = true;
+        }
+    }
 
     auto start = high_resolution_clock::now();
 
     if (rank == 0)
     {
         printf("\n%s is entering the head_node function", name);
-        head_node(num_pocesses, rank);
+        head_node(num_pocesses, rank, weight);
     }
     else
     {
         printf("\n%s is entering the worker_node function", name);
-        worker_node(num_pocesses, rank);
+        worker_node(num_pocesses, rank, weight);
     }
     int val = MPI_Barrier(MPI_COMM_WORLD);
     printf("\n%s has completed all work", name);
@@ -112,9 +193,9 @@ int main(int argc, char **argv)
         int calc_time = duration_cast<microseconds>(stop - start).count();
 
         // Write results to text file.
-        write_matrix("MPI_OpenCL_Dist_Parallel.txt", calc_time, result_m);
+        write_matrix("MPI_OpenCL_Dist_Parallel.txt", calc_time, *result_m);
 
-        print_matrix(result_m); // TEST Print Function.
+        print_matrix(*result_m); // TEST Print Function.
 
         // Print Summary of Calulation Time.
         print_results(calc_time, SIZE);
@@ -130,127 +211,110 @@ int main(int argc, char **argv)
 }
 
 
-// Initialise Matrix
-void init_matrix(int **&matrix, bool fill)
+// Initialise Matrix (rows x SIZE)
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed, int first_row)
 {
-    // Allocate the memory to the arrays
-    matrix = (int**) malloc(sizeof(int*) * SIZE * SIZE);
-    int* column = (int *) malloc(sizeof(int) * SIZE * SIZE);
-
-    for (int i = 0; i < SIZE; ++i)
-    {
-        matrix[i] = &column[i * SIZE];
-    }
+    // Allocate the memory to the matrix, one page aligned block so zero-copy buffers can wrap it.
+        // Unpadded (ld == SIZE) as the OpenCL kernel indexes rows as i*N.
+    matrix = new Matrix<int>(rows, SIZE, false, OCL_HOST_ALIGN);
 
-    // Populate with random values.
+    // Populate with random values, element (first_row + i, j) of stream seed, rows in parallel.
     if (fill)
     {
-        for (int i = 0; i < SIZE; ++i)
+        #pragma omp parallel for
+        for (int i = 0; i < rows; ++i)
         {
             for (int j = 0; j < SIZE; ++j)
             {
-                matrix[i][j] = rand() % 100;
+                (*matrix)[i][j] = rng_int(seed, (uint64_t) (first_row + i) * SIZE + j, 100);
             }
         }
     }
-
-}
-
-// Initialise Matrix
-void init_matrix(int **&matrix, int rows)
-{
-    // Allocate the memory to the arrays
-    matrix = (int**) malloc(sizeof(int*) * rows * SIZE);
-    int* column = (int *) malloc(sizeof(int) * SIZE * SIZE);
-
-    for (int i = 0; i < SIZE; ++i)
-    {
-        matrix[i] = &column[i * SIZE];
-    }
-
+    
 }
 
 // Head Node Tasks
-void head_node(int num_pocesses, int rank)
+void head_node(int num_pocesses, int rank, double weight)
 {
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, SIZE, weight, num_pocesses, counts, displs);
+
+    int partition = counts[rank] / SIZE; // Number of rows for this process
+    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
 
     // Declare Matrices and allocate memory for each.
-    // Populate matrices a and b with random values.
-    init_matrix(matrix_a, true);
-    init_matrix(matrix_b, true);
-    init_matrix(result_m, false);
+    // Populate matrices a and b with random values, with --generate only the
+    // head node's own rows of A (the first ones).
+    init_matrix(matrix_a, generate_input ? partition : SIZE, true);
+    init_matrix(matrix_b, SIZE, true, RNG_SEED_B);
+    init_matrix(result_m, SIZE, false);
 
     // print_matrix(matrix_a); // TEST Print Function.
     // print_matrix(matrix_b);
     // print_matrix(result_m);
 
-    int partition = SIZE/num_pocesses; // Number of rows per process
-    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
-
-    // Scatter Matrix A to Nodes
-    MPI_Scatter(&matrix_a[0][0], scatter_size, MPI_INT, &matrix_a, 0, MPI_INT, 0, MPI_COMM_WORLD);
-    // Broadcast Entire Matrix B to Nodes
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!generate_input)
+    {
+        // Scatter Matrix A to Nodes, the head node's own rows stay in place.
+        MPI_Scatterv(matrix_a->data(), counts, displs, MPI_INT, MPI_IN_PLACE, counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
+        // Broadcast Entire Matrix B to Nodes
+        MPI_Bcast(matrix_b->data(), broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
     // Perform the multiplication
-    //run_openCL(partition);
-    local[0] = partition, local[1] = SIZE;
-    global[0] = partition, global[1]= SIZE;
-    // Setup the device, define context, create command queue and kernel.
-    setup_openCL_device_context_queue_kernel((char *)"./multiply_matrix.cl", (char *)"multiply_matrix");
-    setup_kernel_memory(partition);
-    copy_kernel_args(partition);
-    clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, &event);
-    clWaitForEvents(1, &event);
-    clEnqueueReadBuffer(queue, buf_mR, CL_TRUE, 0, partition * SIZE * sizeof(int), &result_m[0][0], 0, NULL, NULL);
-    //multiply_matrix(matrix_a, matrix_b, result_m, partition);
+    run_openCL(partition, rank);
+    //multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
     printf("\nWorker: %d has Completed Matrix Multiplication", rank);
 
     // Gather results from Nodes and write to resuts matrix
-    MPI_Gather(MPI_IN_PLACE, scatter_size, MPI_INT, &result_m[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(MPI_IN_PLACE, counts[rank], MPI_INT, result_m->data(), counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    free(counts);
+    free(displs);
 }
 
 // Worker Node tasks
-void worker_node(int num_pocesses, int rank)
+void worker_node(int num_pocesses, int rank, double weight)
 {
-    int partition = SIZE/num_pocesses; // Number of rows per process
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, SIZE, weight, num_pocesses, counts, displs);
+
+    int partition = counts[rank] / SIZE; // Number of rows for this process
     int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
 
 
-    // Declare and allocate memory to receive data sent.
-    init_matrix(matrix_a, partition);
-    init_matrix(matrix_b, false);
-    init_matrix(result_m, partition);
+    // Declare and allocate memory to receive data sent, or with --generate
+    // fill this rank's rows of A and all of B here.
+    init_matrix(matrix_a, partition, generate_input, RNG_SEED_A, displs[rank] / SIZE);
+    init_matrix(matrix_b, SIZE, generate_input, RNG_SEED_B);
+    init_matrix(result_m, partition, false);
 
     // Receive the matrix data from the head node.
-    MPI_Scatter(NULL, scatter_size, MPI_INT, &matrix_a[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!generate_input)
+    {
+        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, matrix_a->data(), counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(matrix_b->data(), broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
 
     // Perform the multiplication
-    //run_openCL(partition);
-    local[0] = partition, local[1] = SIZE;
-    global[0] = partition, global[1]= SIZE;
-    // Setup the device, define context, create command queue and kernel.
-    setup_openCL_device_context_queue_kernel((char *)"./multiply_matrix.cl", (char *)"multiply_matrix");
-    setup_kernel_memory(partition);
-    copy_kernel_args(partition);
-    clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, &event);
-    clWaitForEvents(1, &event);
-    clEnqueueReadBuffer(queue, buf_mR, CL_TRUE, 0, partition * SIZE * sizeof(int), &result_m[0][0], 0, NULL, NULL);
+    run_openCL(partition, rank);
 
-    // multiply_matrix(matrix_a, matrix_b, result_m, partition);
+    // multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
     printf("\nWorker: %d has Completed Matrix Multiplication", rank);
 
     // Gather the results
-    MPI_Gather(&result_m[0][0], scatter_size, MPI_INT, NULL, scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(result_m->data(), counts[rank], MPI_INT, NULL, NULL, NULL, MPI_INT, 0, MPI_COMM_WORLD);
+    free(counts);
+    free(displs);
 
 }
 
 // Prints the matrix passed to the screen
-void print_matrix(int **&matrix)
+void print_matrix(Matrix<int> &matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -270,11 +334,15 @@ void print_results(int calc_time, int size)
     cout << "\n\nCalculation time: " << calc_time << " microseconds.\nMPI Distributed processing of a "
         << size << " X " << size << " Matrix." << endl;
     cout << "                  " << calc_time/1000000.0 << " seconds." << endl;
+    if (generate_input)
+    {
+        cout << "Input generated in place on every rank, A not scattered and B not broadcast." << endl;
+    }
     cout << endl;
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix)
 {
     ofstream fstream(f_name); // Creates the txt file.
 
@@ -300,7 +368,7 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix.
-// void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition)
+// void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition)
 // {
 //     for (int i=0; i<partition; i++)
 //     {
@@ -316,9 +384,9 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 
 void deallocate_memory()
 {
-    free(matrix_a);
-    free(matrix_b);
-    free(result_m);
+    delete matrix_a;
+    delete matrix_b;
+    delete result_m; 
 
     matrix_a = NULL;
     matrix_b = NULL;
@@ -328,16 +396,10 @@ void deallocate_memory()
 // Free memory.
 void free_memory()
 {
-    //free the buffers
-    clReleaseMemObject(buf_mA);
-    clReleaseMemObject(buf_mB);
-    clReleaseMemObject(buf_mR);
-
-    //free opencl objects
-    clReleaseKernel(kernel);
-    clReleaseCommandQueue(queue);
-    clReleaseProgram(program);
-    clReleaseContext(context);
+    //free the buffers and opencl objects, all owned by the runtime
+    delete ocl;
+    ocl = NULL;
+    kernel = NULL;
 }
 
 // Copy kernel Args.
@@ -346,7 +408,7 @@ void copy_kernel_args(int partition)
     //Comment: Sets the argument value for a specific argument of the kernel.
             // To execute a kernel, the kernel arguments must be set.
      // Parameters;
-        // Kernel: The kernal object as defined in setup_openCL_device_context_queue_kernel.
+        // Kernel: The kernal object as defined in build_variant.
         // 0: Arg index, Arguments to the kernel are referred by indices that go from 0 for the leftmost argument to n - 1
         // Sizeof(int): Argument size, If the argument is a memory object, the size is the size of the memory object.
         // (void *)&SZ: arg_value is a pointer to data that should be used as the argument value for argument specified by arg_index.
@@ -370,136 +432,391 @@ void copy_kernel_args(int partition)
 // Set up memory buffers.
 void setup_kernel_memory(int partition)
 {
-    //Comment: Creates the buffer objects.
-    buf_mA = clCreateBuffer(context, CL_MEM_READ_WRITE, partition * SIZE * sizeof(int), NULL, NULL);
-    buf_mB = clCreateBuffer(context, CL_MEM_READ_WRITE, SIZE * SIZE * sizeof(int), NULL, NULL);
-    buf_mR = clCreateBuffer(context, CL_MEM_READ_WRITE, partition * SIZE * sizeof(int), NULL, NULL);
-
-    // Copy matrices to the GPU
-    clEnqueueWriteBuffer(queue, buf_mA, CL_TRUE, 0, partition * SIZE * sizeof(int), &matrix_a[0][0], 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, buf_mB, CL_TRUE, 0, SIZE * SIZE * sizeof(int), &matrix_b[0][0], 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, buf_mR, CL_TRUE, 0, partition * SIZE * sizeof(int), &result_m[0][0], 0, NULL, NULL);
+    // Zero-copy: on a CPU device (or one sharing host memory) the buffers are the matrices
+        // themselves (CL_MEM_USE_HOST_PTR) and nothing is copied. Other devices get pinned
+        // buffers, A and B are copied in through a map and C is never uploaded.
+    if (zero_copy)
+    {
+        buf_mA = ocl->input_buffer(matrix_a->data(), partition * SIZE * sizeof(int));
+        buf_mB = ocl->input_buffer(matrix_b->data(), SIZE * SIZE * sizeof(int));
+        buf_mR = ocl->output_buffer(result_m->data(), partition * SIZE * sizeof(int));
+        return;
+    }
+
+    //Comment: Takes the buffer objects from the pool, created on first use.
+        // A and B are only read by the kernel, C only written.
+    buf_mA = ocl->buffer(partition * SIZE * sizeof(int), CL_MEM_READ_ONLY);
+    buf_mB = ocl->buffer(SIZE * SIZE * sizeof(int), CL_MEM_READ_ONLY);
+    buf_mR = ocl->buffer(partition * SIZE * sizeof(int), CL_MEM_WRITE_ONLY);
+
+    // Copy A and B to the GPU. C is output only, there is nothing to upload.
+    clEnqueueWriteBuffer(queue, buf_mA, CL_TRUE, 0, partition * SIZE * sizeof(int), matrix_a->data(), 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, buf_mB, CL_TRUE, 0, SIZE * SIZE * sizeof(int), matrix_b->data(), 0, NULL, NULL);
 }
 
-// Creates the device, defines the context, creates the command queue and kernel.
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname)
+// Brings C back. Zero-copy buffers are mapped, which on a CPU device only waits
+// for the kernel as buf_mR already is result_m.
+void read_result(int partition)
 {
-    device_id = create_device();
-    cl_int err;
+    if (zero_copy)
+    {
+        ocl->read_output(buf_mR, result_m->data(), partition * SIZE * sizeof(int));
+    }
+    else
+    {
+        clEnqueueReadBuffer(queue, buf_mR, CL_TRUE, 0, partition * SIZE * sizeof(int), result_m->data(), 0, NULL, NULL);
+    }
+}
 
-    // Defines the context, the environment within which kernels execute and in which synchronization.
-    context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
-    if (err < 0)
+// Multiplies this rank's rows of A by B on the OpenCL device with the fastest kernel variant.
+void run_openCL(int partition, int rank)
+{
+    if (partition == 0)
     {
-        perror("Couldn't create a context");
-        exit(1);
+        return;
     }
 
-    program = build_program(context, device_id, filename);
+    // Setup the device, context and command queue once, then the buffers.
+        // Co-scheduling times the device side with event profiling.
+    ocl = new OclRuntime(cosched ? CL_QUEUE_PROFILING_ENABLE : 0);
+    queue = ocl->queue();
+    setup_kernel_memory(partition);
 
-    // Creates a host or device command queue on a specific device.
-    queue = clCreateCommandQueueWithProperties(context, device_id, 0, &err);
-    if (err < 0)
+    int v = autotune(partition, rank);
+    if (!build_variant(v))
     {
-        perror("Couldn't create a command queue");
+        printf("\nP%d: couldn't build the multiplication kernel.\n", rank);
         exit(1);
-    };
+    }
+    if (cosched)
+    {
+        run_cosched(partition, rank, v);
+    }
+    else
+    {
+        copy_kernel_args(partition);
+        set_variant_range(v, partition);
+        err = enqueue_variant(v);
+        if (err < 0)
+        {
+            printf("Couldn't run the %s kernel, error = %d\n", variants[v].kernel, err);
+            exit(1);
+        }
+        read_result(partition);
+    }
 
-    // Creates the kernal object
-    kernel = clCreateKernel(program, kernelname, &err);
-    if (err < 0)
+    // Done with the device copies. Zero-copy buffers are released for good so
+    // the matrices they wrapped belong to the host again for the gather.
+    ocl->release(buf_mA);
+    ocl->release(buf_mB);
+    ocl->release(buf_mR);
+
+    char label[32];
+    snprintf(label, sizeof(label), "\nRank %d, ", rank);
+    ocl->print_startup(label);
+}
+
+// Writes the -D build options of kernel variant v (empty for the naive kernel).
+void variant_options(int v, char *options)
+{
+    const kernel_variant &k = variants[v];
+    options[0] = '\0';
+    if (k.tsm > 0)
     {
-        perror("Couldn't create a kernel");
-        printf("error =%d", err);
-        exit(1);
-    };
+        sprintf(options, "-DTSM=%d -DTSN=%d -DTSK=%d -DWPTM=%d -DWPTN=%d -DVW=%d", k.tsm, k.tsn, k.tsk, k.wptm, k.wptn, k.vw);
+    }
 }
 
-// Builds and returns the program object.
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename)
+// Makes kernel variant v the current kernel. Each variant is compiled (or loaded
+// from the binary cache) the first time only, the runtime keeps it after that.
+// Returns false if the variant doesn't build on this device.
+bool build_variant(int v)
 {
-    cl_program program;
-    FILE *program_handle;
-    char *program_buffer, *program_log;
-    size_t program_size, log_size;
+    char options[256];
+    variant_options(v, options);
+    kernel = ocl->try_kernel("./multiply_matrix.cl", variants[v].kernel, options);
+    return kernel != NULL;
+}
 
-    /* Read program file and place content into buffer */
-    program_handle = fopen(filename, "r");
-    if (program_handle == NULL)
+// Sets the global and local work sizes of kernel variant v for partition rows.
+void set_variant_range(int v, int partition)
+{
+    const kernel_variant &k = variants[v];
+    if (k.tsm == 0)
     {
-        perror("Couldn't find the program file");
-        exit(1);
+        // Naive kernel: one work-item per element, the runtime picks the work-group size.
+        global[0] = partition, global[1] = SIZE;
+        return;
     }
 
-    fseek(program_handle, 0, SEEK_END);
-    program_size = ftell(program_handle);
-    rewind(program_handle);
-    program_buffer = (char *)malloc(program_size + 1);
-    program_buffer[program_size] = '\0';
-    fread(program_buffer, sizeof(char), program_size, program_handle);
-    fclose(program_handle);
+    // Tiled kernel: dimension 0 runs along the columns, rounded up to whole tiles.
+    local[0] = k.tsn / k.wptn;
+    local[1] = k.tsm / k.wptm;
+    global[0] = ((SIZE + k.tsn - 1) / k.tsn) * local[0];
+    global[1] = ((partition + k.tsm - 1) / k.tsm) * local[1];
+}
 
-    //Comment: Creates a program object for a context, and loads the source code specified by the context (ctx)
-    program = clCreateProgramWithSource(ctx, 1, (const char **)&program_buffer, &program_size, &err);
-    if (err < 0)
+// Runs the current kernel once and waits for it, returns the OpenCL error code.
+cl_int enqueue_variant(int v)
+{
+    cl_int status = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, variants[v].tsm == 0 ? NULL : local, 0, NULL, &event);
+    if (status == CL_SUCCESS)
     {
-        perror("Couldn't create the program");
-        exit(1);
+        clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+        event = NULL;
     }
-    free(program_buffer);
+    return status;
+}
 
-    /* Build program
+// Times kernel variant v on this rank's rows. Returns -1 if it doesn't build, if
+// the work-group or __local tiles are too big for the device, or if its results are wrong.
+double time_variant(int v, int partition)
+{
+    const kernel_variant &k = variants[v];
+    if (k.tsm > 0)
+    {
+        size_t max_group, group_size, local_mem;
+        cl_ulong device_local_mem;
+        clGetDeviceInfo(ocl->device(), CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL);
+        clGetDeviceInfo(ocl->device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(device_local_mem), &device_local_mem, NULL);
+        group_size = (k.tsn / k.wptn) * (k.tsm / k.wptm);
+        local_mem = (size_t) k.tsk * (k.tsm + k.tsn) * sizeof(int);
+        if (group_size > max_group || local_mem > device_local_mem)
+        {
+            return -1;
+        }
+    }
 
-   The fourth parameter accepts options that configure the compilation.
-   These are similar to the flags used by gcc. For example, you can
-   define a macro with the option -DMACRO=VALUE and turn off optimization
-   with -cl-opt-disable.
-   */
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (err < 0)
+    if (!build_variant(v))
+    {
+        return -1;
+    }
+    if (k.tsm > 0)
     {
+        // The kernel itself may be limited to smaller groups (registers, private memory).
+        size_t kernel_group;
+        clGetKernelWorkGroupInfo(kernel, ocl->device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_group), &kernel_group, NULL);
+        if ((size_t) (k.tsn / k.wptn) * (k.tsm / k.wptm) > kernel_group)
+        {
+            return -1;
+        }
+    }
+    copy_kernel_args(partition);
+    set_variant_range(v, partition);
 
-        /* Find size of log and print to std output */
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        program_log = (char *)malloc(log_size + 1);
-        program_log[log_size] = '\0';
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG, log_size + 1, program_log, NULL);
-        printf("%s\n", program_log);
-        free(program_log);
-        exit(1);
+    // First run warms up and is checked against the host.
+    if (enqueue_variant(v) != CL_SUCCESS)
+    {
+        return -1;
+    }
+    read_result(partition);
+    for (int c=0; c<TUNE_CHECKS; c++)
+    {
+        int i = (c == TUNE_CHECKS - 1) ? partition - 1 : (c * 7919) % partition;
+        int j = (c == TUNE_CHECKS - 1) ? SIZE - 1 : (c * 104729) % SIZE;
+        int expected = 0;
+        for (int k=0; k<SIZE; k++)
+        {
+            expected += (*matrix_a)[i][k] * (*matrix_b)[k][j];
+        }
+        if ((*result_m)[i][j] != expected)
+        {
+            return -1;
+        }
+    }
+
+    double best = -1;
+    for (int r=0; r<TUNE_RUNS; r++)
+    {
+        auto start = high_resolution_clock::now();
+        enqueue_variant(v);
+        double seconds = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1000000.0;
+        if (best < 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+// Returns the fastest kernel variant for this device and partition. Results are
+// kept in TUNE_FILE, one line per device and size:
+//     device name|rows|SIZE|kernel options
+// so only the first run on a device pays for trying every variant.
+int autotune(int partition, int rank)
+{
+    char device_name[256], line[512], key[300], options[256];
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+    snprintf(key, sizeof(key), "%s|%d|%d|", device_name, partition, SIZE);
+
+    // Use a saved result if there is one that still builds (the driver may have changed).
+    FILE *tune_file = fopen(TUNE_FILE, "r");
+    if (tune_file != NULL)
+    {
+        while (fgets(line, sizeof(line), tune_file) != NULL)
+        {
+            if (strncmp(line, key, strlen(key)) != 0)
+            {
+                continue;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            for (int v=0; v<NUM_VARIANTS; v++)
+            {
+                char saved[300];
+                variant_options(v, options);
+                snprintf(saved, sizeof(saved), "%s%s %s", key, variants[v].kernel, options);
+                if (strcmp(line, saved) == 0 && build_variant(v))
+                {
+                    fclose(tune_file);
+                    return v;
+                }
+            }
+        }
+        fclose(tune_file);
+    }
+
+    // Time every variant, the naive kernel always works so there is a fallback.
+    int fastest = 0;
+    double fastest_time = -1;
+    for (int v=0; v<NUM_VARIANTS; v++)
+    {
+        double seconds = time_variant(v, partition);
+        variant_options(v, options);
+        if (seconds < 0)
+        {
+            printf("\nP%d %s: %s %s skipped (does not build, does not fit or wrong result)", rank, device_name, variants[v].kernel, options);
+            continue;
+        }
+        printf("\nP%d %s: %s %s %.6f seconds", rank, device_name, variants[v].kernel, options, seconds);
+        if (fastest_time < 0 || seconds < fastest_time)
+        {
+            fastest = v;
+            fastest_time = seconds;
+        }
     }
 
-    return program;
+    variant_options(fastest, options);
+    printf("\nP%d %s: using %s %s", rank, device_name, variants[fastest].kernel, options);
+    tune_file = fopen(TUNE_FILE, "a");
+    if (tune_file != NULL)
+    {
+        fprintf(tune_file, "%s%s %s\n", key, variants[fastest].kernel, options);
+        fclose(tune_file);
+    }
+    return fastest;
 }
 
-// Create device object.
-cl_device_id create_device() {
-
-   cl_platform_id platform;
-   cl_device_id dev;
-   int err;
-
-   /* Identify a platform */
-   err = clGetPlatformIDs(1, &platform, NULL);
-   if(err < 0) {
-      perror("Couldn't identify a platform");
-      exit(1);
-   }
-
-   // Access a device
-   // GPU
-   err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
-   if(err == CL_DEVICE_NOT_FOUND) {
-      // CPU
-      printf("GPU not found\n");
-      err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
-   }
-   if(err < 0) {
-      perror("Couldn't access any devices");
-      exit(1);
-   }
-
-   return dev;
+// Multiplies rows [start, stop) of A by B into result_m, each OpenMP thread runs
+// the engine on its own slab of rows.
+void multiply_rows_cpu(int start, int stop)
+{
+    #pragma omp parallel
+    {
+        int threads = omp_get_num_threads();
+        int id = omp_get_thread_num();
+        int first = start + ((stop - start) * id) / threads;
+        int last = start + ((stop - start) * (id + 1)) / threads;
+
+        if (last > first)
+        {
+            gemm(last - first, SIZE, SIZE, (*matrix_a)[first], matrix_a->ld(), (*matrix_b)[0], matrix_b->ld(),
+                (*result_m)[first], result_m->ld());
+        }
+    }
 }
 
-// void run_openCL(int partition) // Move OpenCL Duplicate Code here.
+// Co-scheduled multiply. The rows are taken COSCHED_ROWS at a time, the first
+// share of each round goes to the device and the rest to the CPU, both running
+// at once. The device share is then moved towards the split that would have
+// made both sides finish together:
+//     share = device rows/s / (device rows/s + CPU rows/s)
+// so a slow device (or a CPU OpenCL device competing with OpenMP for the same
+// cores) ends up with fewer rows. A and B are already on the device, the device
+// rows of A are copied into a tile buffer and their rows of C read straight back.
+void run_cosched(int partition, int rank, int v)
+{
+    cl_mem buf_tA = ocl->buffer(COSCHED_ROWS * SIZE * sizeof(int));
+    cl_mem buf_tR = ocl->buffer(COSCHED_ROWS * SIZE * sizeof(int));
+    const int SZ = SIZE;
+
+    // The autotuner's check run left results in result_m, the CPU side adds to C.
+        // buf_mR is done with, it may wrap result_m (--zero-copy) so it goes before the host writes there.
+    ocl->release(buf_mR);
+    buf_mR = NULL;
+    result_m->fill(0);
+
+    double share = COSCHED_START;
+    int device_rows = 0, rounds = 0;
+    double device_time = 0, cpu_time = 0;
+
+    for (int row0=0; row0<partition; row0+=COSCHED_ROWS)
+    {
+        int rows = min(COSCHED_ROWS, partition - row0);
+        int g = (int) (share * rows + 0.5); // Rows for the device this round.
+        cl_event copy_event = NULL, read_event = NULL;
+
+        if (g > 0)
+        {
+            clEnqueueCopyBuffer(queue, buf_mA, buf_tA, (size_t) row0 * SIZE * sizeof(int), 0,
+                (size_t) g * SIZE * sizeof(int), 0, NULL, &copy_event);
+            clSetKernelArg(kernel, 0, sizeof(int), (void *) &g);
+            clSetKernelArg(kernel, 1, sizeof(int), (void *) &SZ);
+            clSetKernelArg(kernel, 2, sizeof(int), (void *) &SZ);
+            clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *) &buf_tA);
+            clSetKernelArg(kernel, 4, sizeof(cl_mem), (void *) &buf_mB);
+            clSetKernelArg(kernel, 5, sizeof(cl_mem), (void *) &buf_tR);
+            set_variant_range(v, g);
+            err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, variants[v].tsm == 0 ? NULL : local, 0, NULL, NULL);
+            if (err < 0)
+            {
+                printf("Couldn't run the %s kernel, error = %d\n", variants[v].kernel, err);
+                exit(1);
+            }
+            clEnqueueReadBuffer(queue, buf_tR, CL_FALSE, 0, (size_t) g * SIZE * sizeof(int), (*result_m)[row0],
+                0, NULL, &read_event);
+            clFlush(queue); // Start the device before the CPU gets busy.
+        }
+
+        // The CPU's rows, while the device works on its own.
+        auto start = high_resolution_clock::now();
+        multiply_rows_cpu(row0 + g, row0 + rows);
+        double t_cpu = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1000000.0;
+
+        // Device time from the start of the copy to the end of the read.
+        double t_device = 0;
+        if (g > 0)
+        {
+            cl_ulong begin, end;
+            clWaitForEvents(1, &read_event);
+            clGetEventProfilingInfo(copy_event, CL_PROFILING_COMMAND_START, sizeof(begin), &begin, NULL);
+            clGetEventProfilingInfo(read_event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+            t_device = (end - begin) / 1000000000.0;
+            clReleaseEvent(copy_event);
+            clReleaseEvent(read_event);
+        }
+
+        // Move the share towards the rate-balanced split. Skipped when either
+        // time is too short to measure.
+        if (g > 0 && rows > g && t_device > 0 && t_cpu > 0)
+        {
+            double device_rate = g / t_device;
+            double cpu_rate = (rows - g) / t_cpu;
+            double target = device_rate / (device_rate + cpu_rate);
+            share = COSCHED_SMOOTH * target + (1 - COSCHED_SMOOTH) * share;
+            share = max(COSCHED_MIN_SHARE, min(1 - COSCHED_MIN_SHARE, share));
+        }
+
+        device_rows += g;
+        device_time += t_device;
+        cpu_time += t_cpu;
+        rounds++;
+    }
+
+    ocl->release(buf_tA);
+    ocl->release(buf_tR);
+
+    printf("\nRank %d co-scheduled %d rounds: %d rows on %s (%.3f s), %d rows on %d CPU threads (%.3f s), final device share %.0f%%",
+        rank, rounds, device_rows, ocl->device_name(), device_time, partition - device_rows, omp_get_max_threads(),
+        cpu_time, share * 100);
+}
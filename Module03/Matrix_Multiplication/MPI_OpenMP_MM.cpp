@@ -1,47 +1,80 @@
-// Compile: mpicxx -fopenmp MPI_OpenMP_MM.cpp -o omp
+// Compile: mpicxx -O2 -fopenmp MPI_OpenMP_MM.cpp -o omp
 // Run Head: mpirun -np 4 ./omp
 // Run Cluster: sudo mpirun -np 4 -hostfile ./cluster ./omp
+// Run Pipelined: mpirun -np 4 ./omp --pipeline (overlaps B/C transfers with compute)
+// Run Shared B: mpirun -np 4 ./omp --shared (one copy of B per node, see distribute_matrix_b)
+// Run Generated: mpirun -np 4 ./omp --generate (each rank makes its own rows of A and its own B)
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include <cstring>
 #include <mpi.h>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
 #include <omp.h>
+#include "../../Common/partition.h" // Weighted Scatterv/Gatherv partitions.
+#include "../../Common/mpi_pipeline.h" // Pipelined mode driver.
+#include "gemm.h" // Packed panel SIMD multiplication engine.
 
 using namespace std::chrono;
 using namespace std;
 
 #define SIZE 2400 // For ease of adjusting matrix size.
+#define PIPE_ROWS 192 // Rows multiplied between MPI progress calls in the pipelined mode.
 //#define THREADS 6 // 4-8 Threads for a 4 physical core machine. 
-int **matrix_a, **matrix_b, **result_m; // Global Pointers
+Matrix<int> *matrix_a, *matrix_b, *result_m; // Global Pointers
 
-// Initialise Matrix 
-void init_matrix(int **&matrix, bool fill);
+// Node-local shared B (--shared).
+bool shared_b = false; // One copy of B per node instead of one per rank.
+MPI_Comm node_comm = MPI_COMM_NULL; // Ranks on this node.
+MPI_Comm leader_comm = MPI_COMM_NULL; // Rank 0 of every node.
+MPI_Win b_window = MPI_WIN_NULL; // Shared memory window holding B.
+bool generate_input = false; // --generate: no scatter of A or broadcast of B, every rank generates its own.
+
+// Initialise Matrix, filled with rows [first_row, first_row + rows) of the SIZE x SIZE matrix seed.
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed = RNG_SEED_A, int first_row = 0);
 
 // Deallocates the memory for the matrices 
 void deallocate_memory();
 
+// Sets every value of the matrix to a random number 0-99 from stream seed,
+// matrix row i being row first_row + i of the whole matrix.
+void fill_matrix(Matrix<int> &matrix, uint64_t seed, int first_row = 0);
+
+// Gives every rank matrix B, one copy per rank or one shared copy per node.
+void distribute_matrix_b(int rank);
+
+// Releases the shared memory window holding B (--shared).
+void release_matrix_b();
+
 // Sets all values in the matrix passed to zero.
-void init_zero(int **&matrix);
+void init_zero(Matrix<int> &matrix);
 
 // Prints the matrix passed to the screen 
-void print_matrix(int **&matrix);
+void print_matrix(Matrix<int> &matrix);
 
 // Prints the performance results
 void print_results(int calc_time, int size);
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix);
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix);
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix. 
-void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition);
+void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition);
 
 // Head Node process control function
-void head_node(int num_tasks, int rank);
+void head_node(int num_tasks, int rank, double weight);
 
 // Worker Node process control function
-void worker_node(int num_tasks, int rank);
+void worker_node(int num_tasks, int rank, double weight);
+
+// Pipelined mode, B panels and C panels move while the previous panel is multiplied.
+void pipeline_node(int num_tasks, int rank, double weight);
+
+// Multiplies this rank's rows of A by one panel of B with every thread.
+void multiply_panel(const int *panel_b, int *panel_c, int partition, int width, MPI_Request *pending);
 
 
 int main(int argc, char **argv) 
@@ -54,22 +87,60 @@ int main(int argc, char **argv)
 
     // Setting up and starting the parallel process.
     MPI_Status status; // Required to receive routines.
-    MPI_Init(&argc, &argv); // Initialise the MPI environment.
+    int provided; // Only the master thread calls MPI.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided); // Initialise the MPI environment.
     MPI_Comm_size(MPI_COMM_WORLD , &num_pocesses); // Get the number of tasts/processes.
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank i.e. process ID.
     MPI_Get_processor_name(name, &name_len); // Find the processors name. 
+    double weight = parse_weight(argc, argv); // Share of the rows for this node (--weight w).
+
+    // Shared B: ./omp --shared, generated input: ./omp --generate, pipelined: ./omp --pipeline
+    bool pipeline = false;
+    for (int i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--shared") == 0)
+        {
+            shared_b = true;
+        }
+        if (strcmp(argv[i], "--generate") == 0)
+        {
+            generate_input = true;
+        }
+        if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipeline = true;
+        }
+    }
+
+    // The pipelined mode streams A and B from the head node, one panel of B at a time.
+    if (pipeline && (generate_input || shared_b))
+    {
+        if (rank == 0)
+        {
+            printf("\n--pipeline can't be combined with --generate or --shared.\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (pipeline)
+    {
+        pipeline_node(num_pocesses, rank, weight);
+        MPI_Finalize();
+        return 0;
+    }
 
     auto start = high_resolution_clock::now();
 
     if (rank == 0)
     {
         printf("\n%s is entering the head_node function", name); // TEST Print Function
-        head_node(num_pocesses, rank);
+        head_node(num_pocesses, rank, weight);
     }
     else
     {
         printf("\n%s is entering the worker_node function", name); // TEST Print Function
-        worker_node(num_pocesses, rank);
+        worker_node(num_pocesses, rank, weight);
     }
     
     // printf("\n%s has completed all work", name); // TEST Print Function
@@ -84,7 +155,7 @@ int main(int argc, char **argv)
         int calc_time = duration_cast<microseconds>(stop - start).count();
 
         // Write results to text file. 
-        write_matrix("MPI_OpenMP_Dist_Parallel.txt", calc_time, result_m);
+        write_matrix("MPI_OpenMP_Dist_Parallel.txt", calc_time, *result_m);
 
         // print_matrix(result_m); // TEST Print Function. 
 
@@ -100,34 +171,116 @@ int main(int argc, char **argv)
     return 0;
 }
 
-// Initialise Matrix 
-void init_matrix(int **&matrix, bool fill)
+// Initialise Matrix (rows x SIZE)
+void init_matrix(Matrix<int> *&matrix, int rows, bool fill, uint64_t seed, int first_row)
 {
-    // Allocate the memory to the arrays
-    matrix = (int**) malloc(sizeof(int*) * SIZE * SIZE);
-    int* column = (int *) malloc(sizeof(int) * SIZE * SIZE);
+    // Allocate the memory to the matrix, one aligned block.
+    matrix = new Matrix<int>(rows, SIZE);
 
-    for (int i = 0; i < SIZE; ++i)
+    // Populate with random values.
+    if (fill) 
     {
-        matrix[i] = &column[i * SIZE];
+        fill_matrix(*matrix, seed, first_row);
     }
+    
+}
 
-    // Populate with random values.
-    if (fill) 
+// Sets every value of the matrix to a random number 0-99, element (first_row + i, j)
+// of stream seed. Rows are filled in parallel, the values don't depend on which thread.
+void fill_matrix(Matrix<int> &matrix, uint64_t seed, int first_row)
+{
+    #pragma omp parallel for
+    for (int i = 0; i < matrix.rows(); ++i)
     {
-        for (int i = 0; i < SIZE; ++i)
+        for (int j = 0; j < matrix.cols(); ++j)
         {
-            for (int j = 0; j < SIZE; ++j)
-            {
-                matrix[i][j] = rand() % 100;
-            }
+            matrix[i][j] = rng_int(seed, (uint64_t) (first_row + i) * matrix.cols() + j, 100);
         }
     }
-    
+}
+
+// Gives every rank matrix B, filled with random values by the head node.
+// Normally every rank receives its own copy with MPI_Bcast. With --shared the
+// ranks of each node share one copy in an MPI_Win_allocate_shared window:
+// only the node leaders take part in the broadcast, and every other rank on
+// the node and all of its threads read B in place. With --generate whoever
+// holds a copy fills it and nothing is broadcast.
+void distribute_matrix_b(int rank)
+{
+    int ld = Matrix<int>::padded_ld(SIZE);
+
+    if (!shared_b)
+    {
+        init_matrix(matrix_b, SIZE, rank == 0 || generate_input, RNG_SEED_B);
+        if (!generate_input)
+        {
+            MPI_Bcast(matrix_b->data(), SIZE * ld, MPI_INT, 0, MPI_COMM_WORLD);
+        }
+        return;
+    }
+
+    // Ranks that can share memory, the lowest world rank leads (rank 0 on the head node).
+    int node_rank, node_size, nodes = 0;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+    // The leader allocates the whole matrix, the other ranks map the leader's segment.
+    int *base;
+    MPI_Aint bytes = node_rank == 0 ? (MPI_Aint) SIZE * ld * sizeof(int) : 0;
+    MPI_Win_allocate_shared(bytes, sizeof(int), MPI_INFO_NULL, node_comm, &base, &b_window);
+    if (node_rank != 0)
+    {
+        MPI_Aint size;
+        int disp_unit;
+        MPI_Win_shared_query(b_window, 0, &size, &disp_unit, &base);
+    }
+    matrix_b = new Matrix<int>(base, SIZE, SIZE, ld);
+
+    // Leaders fill / receive B, the fences make it visible to the whole node.
+    MPI_Win_fence(0, b_window);
+    if (node_rank == 0)
+    {
+        if (rank == 0 || generate_input)
+        {
+            fill_matrix(*matrix_b, RNG_SEED_B);
+        }
+        if (!generate_input)
+        {
+            MPI_Bcast(matrix_b->data(), SIZE * ld, MPI_INT, 0, leader_comm);
+        }
+        MPI_Comm_size(leader_comm, &nodes);
+    }
+    MPI_Win_fence(0, b_window);
+
+    if (rank == 0)
+    {
+        printf("\nShared B: %d node(s), %d rank(s) on the head node share one %.1f MB copy.",
+            nodes, node_size, (double) bytes / (1024 * 1024));
+    }
+}
+
+// Releases the shared memory window holding B (--shared).
+void release_matrix_b()
+{
+    if (!shared_b)
+    {
+        return;
+    }
+
+    delete matrix_b; // Only the wrapper, the window owns the memory.
+    matrix_b = NULL;
+    MPI_Win_free(&b_window);
+    if (leader_comm != MPI_COMM_NULL)
+    {
+        MPI_Comm_free(&leader_comm);
+    }
+    MPI_Comm_free(&node_comm);
 }
 
 // Sets all values in the matrix passed to zero.
-void init_zero(int **&matrix)
+void init_zero(Matrix<int> &matrix)
 {
     for (int i=0; i<SIZE; i++)
     {
@@ -139,78 +292,153 @@ void init_zero(int **&matrix)
 }
 
 // Head Node Tasks
-void head_node(int num_pocesses, int rank)
+void head_node(int num_pocesses, int rank, double weight)
 {
-    
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, Matrix<int>::padded_ld(SIZE), weight, num_pocesses, counts, displs);
+
+    int partition = counts[rank] / Matrix<int>::padded_ld(SIZE); // Number of rows for this process
+
     // Declare Matrices and allocate memory for each.
-    // Populate matrices a and b with random values. 
-    init_matrix(matrix_a, true);
-    init_matrix(matrix_b, true);
-    init_matrix(result_m, false);
+    // Populate matrix a with random values, b is set up by distribute_matrix_b.
+    // With --generate only the head node's own rows of A (the first ones).
+    init_matrix(matrix_a, generate_input ? partition : SIZE, true);
+    init_matrix(result_m, SIZE, false);
 
     // print_matrix(matrix_a); // TEST Print Function.
-    // print_matrix(matrix_b);
-
-    int partition = SIZE/num_pocesses; // Number of rows per process
-    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
 
-    // Scatter Matrix A to Nodes
-    MPI_Scatter(&matrix_a[0][0], scatter_size, MPI_INT, &matrix_a, 0, MPI_INT, 0, MPI_COMM_WORLD);
+    // Scatter Matrix A to Nodes, the head node's own rows stay in place.
+    if (!generate_input)
+    {
+        MPI_Scatterv(matrix_a->data(), counts, displs, MPI_INT, MPI_IN_PLACE, counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
-    // Broadcast Entire Matrix B to Nodes
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Broadcast Entire Matrix B to Nodes (or one shared copy per node)
+    distribute_matrix_b(rank);
 
     // Begin OpenMP Parallel Process
     // printf("\nWorker: %d is entering OpenMP Parallel Region", rank); // TEST Print function
     #pragma omp parallel default(none) shared(matrix_a, matrix_b, result_m, partition)
     {
         // Perform the multiplication 
-        multiply_matrix(matrix_a, matrix_b, result_m, partition);
+        multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
         printf("\nThread: %d has Completed Matrix Multiplication", omp_get_thread_num());
 
         #pragma omp barrier // Wait for all threads to finish.
     }
 
     // Gather results from Nodes and write to resuts matrix
-    MPI_Gather(MPI_IN_PLACE, scatter_size, MPI_INT, &result_m[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(MPI_IN_PLACE, counts[rank], MPI_INT, result_m->data(), counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    release_matrix_b();
+    free(counts);
+    free(displs);
 
 }
 
 // Worker Node tasks
-void worker_node(int num_pocesses, int rank)
+void worker_node(int num_pocesses, int rank, double weight)
 {
-    // Declare and allocate memory to receive data sent. 
-    init_matrix(matrix_a, false);
-    init_matrix(matrix_b, false);
-    init_matrix(result_m, false);
+    // Elements of A (and C) for each process, any SIZE and process count.
+    int *counts = (int *) malloc(num_pocesses * sizeof(int));
+    int *displs = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, Matrix<int>::padded_ld(SIZE), weight, num_pocesses, counts, displs);
 
-    int partition = SIZE/num_pocesses; // Number of rows per process
-    int broadcast_size = (SIZE * SIZE); // Number of elements to be broadcast
-    int scatter_size = (SIZE * SIZE)/num_pocesses; // Number of elements to be scattered
+    int partition = counts[rank] / Matrix<int>::padded_ld(SIZE); // Number of rows for this process
+
+    // Declare and allocate memory to receive data sent, or with --generate
+    // fill this rank's rows of A here.
+    int first_row = displs[rank] / Matrix<int>::padded_ld(SIZE);
+    init_matrix(matrix_a, partition, generate_input, RNG_SEED_A, first_row);
+    init_matrix(result_m, partition, false);
 
     // Receive the matrix data from the head node. 
-    MPI_Scatter(NULL, scatter_size, MPI_INT, &matrix_a[0][0], scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&matrix_b[0][0], broadcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!generate_input)
+    {
+        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, matrix_a->data(), counts[rank], MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    distribute_matrix_b(rank);
     
     // Begin OpenMP Parallel Process
     // printf("\nWorker: %d is entering OpenMP Parallel Region", rank); // TEST Print Function
     #pragma omp parallel default(none) shared(matrix_a, matrix_b, result_m, partition, rank)
     {
         // Perform the multiplication 
-        multiply_matrix(matrix_a, matrix_b, result_m, partition);
+        multiply_matrix(*matrix_a, *matrix_b, *result_m, partition);
         printf("\nThread: %d has Completed Matrix Multiplication", omp_get_thread_num());
 
         #pragma omp barrier // Wait for all threads to finish.
     }
 
     // Gather the results
-    MPI_Gather(&result_m[0][0], scatter_size, MPI_INT, NULL, scatter_size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(result_m->data(), counts[rank], MPI_INT, NULL, NULL, NULL, MPI_INT, 0, MPI_COMM_WORLD);
+    release_matrix_b();
+    free(counts);
+    free(displs);
+
+}
+
+// Pipelined multiplication that overlaps communication with computation,
+// see Common/mpi_pipeline.h. multiply_panel does the work on each panel.
+void pipeline_node(int num_pocesses, int rank, double weight)
+{
+    // Rows of A and C for each process and the first row of each.
+    int *rows = (int *) malloc(num_pocesses * sizeof(int));
+    int *first = (int *) malloc(num_pocesses * sizeof(int));
+    partition_work(SIZE, 1, weight, num_pocesses, rows, first);
+
+    // The head node holds all of A, B and C, the workers a slab of A.
+    if (rank == 0)
+    {
+        init_matrix(matrix_a, SIZE, true);
+        init_matrix(matrix_b, SIZE, true, RNG_SEED_B);
+        init_matrix(result_m, SIZE, false);
+    }
+    else
+    {
+        init_matrix(matrix_a, rows[rank], false);
+    }
+
+    double seconds = pipeline_run(matrix_a, matrix_b, result_m, SIZE, rows, first, multiply_panel,
+        "MPI & OpenMP", gemm_kernel_name<int>());
+    if (rank == 0)
+    {
+        write_matrix("MPI_OpenMP_Pipelined.txt", (int) (seconds * 1000000), *result_m);
+    }
+    free(rows);
+    free(first);
+    deallocate_memory();
+}
+
+// Multiplies this rank's slab of A by one panel of B. Each thread takes a
+// share of the rows and runs it PIPE_ROWS rows at a time. MPI only moves
+// nonblocking collectives along when it is called, so the master thread tests
+// the requests in flight between its blocks (MPI_THREAD_FUNNELED).
+void multiply_panel(const int *panel_b, int *panel_c, int partition, int width, MPI_Request *pending)
+{
+    #pragma omp parallel default(none) shared(matrix_a, panel_b, panel_c, partition, width, pending)
+    {
+        int threads = omp_get_num_threads();
+        int id = omp_get_thread_num();
+        int start = (partition * id) / threads;
+        int stop = (partition * (id + 1)) / threads;
+        int flag;
 
+        for (int i=start; i<stop; i+=PIPE_ROWS)
+        {
+            gemm(min(PIPE_ROWS, stop - i), width, SIZE, (*matrix_a)[i], matrix_a->ld(), panel_b, width,
+                panel_c + (size_t) i * width, width);
+            if (id == 0)
+            {
+                MPI_Testall(PIPE_REQUESTS, pending, &flag, MPI_STATUSES_IGNORE);
+            }
+        }
+    }
 }
 
 // Prints the matrix passed to the screen 
-void print_matrix(int **&matrix)
+void print_matrix(Matrix<int> &matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -228,13 +456,17 @@ void print_matrix(int **&matrix)
 void print_results(int calc_time, int size)
 {
     cout << "\nCalculation time: " << calc_time << " microseconds.\nMPI Distributed processing of a " 
-        << size << " X " << size << " Matrix." << endl;
+        << size << " X " << size << " Matrix (" << gemm_kernel_name<int>() << " kernel)." << endl;
     cout << "                  " << calc_time/1000000.0 << " seconds." << endl;
+    if (generate_input)
+    {
+        cout << "Input generated in place on every rank, A not scattered and B not broadcast." << endl;
+    }
     cout << endl;
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix)
 {
     ofstream fstream(f_name); // Creates the txt file. 
 
@@ -260,26 +492,26 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix. 
-void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m, int partition)
+// Called by every thread of the parallel region, each thread runs the engine on its own slab of rows.
+void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m, int partition)
 {
-    # pragma omp for // OpenMP for loop declaration
-    for (int i=0; i<partition; i++)
+    int threads = omp_get_num_threads();
+    int id = omp_get_thread_num();
+    int start = (partition * id) / threads;
+    int stop = (partition * (id + 1)) / threads;
+
+    if (stop > start)
     {
-        for (int j=0; j<SIZE; j++)
-        {
-            for (int k=0; k<SIZE; k++)
-            {
-                result_m[i][j] += (matrix_a[i][k] * matrix_b[k][j]);
-            }
-        }
+        gemm(stop - start, SIZE, SIZE, matrix_a[start], matrix_a.ld(), matrix_b[0], matrix_b.ld(),
+            result_m[start], result_m.ld());
     }
 }
 
 void deallocate_memory()
 {
-    free(matrix_a);
-    free(matrix_b);
-    free(result_m); 
+    delete matrix_a;
+    delete matrix_b;
+    delete result_m; 
 
     matrix_a = NULL;
     matrix_b = NULL;
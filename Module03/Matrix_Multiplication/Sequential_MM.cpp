@@ -1,30 +1,21 @@
-// On Mac RUN WITH: clang++ Sequential_MM.cpp -o seq -std=c++11
-// On Windows RUN WITH: g++ Sequential_MM.cpp -o seq -std=c++11
+// On Mac RUN WITH: clang++ -O2 Sequential_MM.cpp -o seq -std=c++11
+// On Windows RUN WITH: g++ -O2 Sequential_MM.cpp -o seq -std=c++11
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include "../../Common/matrix.h" // Contiguous, aligned matrix type.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "gemm.h" // Packed panel SIMD multiplication engine.
 
 using namespace std::chrono;
 using namespace std;
 
 #define SIZE 1200 // For ease of adjusting matrix size.
 
-// Initialise Matrix bay allocating memory space.
-void init_matrix(int **&matrix, int size)
-{
-    // Array of pointers 
-    matrix = (int**) malloc(sizeof(int*) * size);
-    // 2nd allocation for integer space. 
-    for (int i=0; i<size; i++) 
-    {
-        matrix[i] = (int*) malloc(sizeof(int) * size);
-    }
-}
-
 // Sets all values in the matrix passed to zero.
-void init_zero(int **&matrix)
+void init_zero(Matrix<int> &matrix)
 {
     for (int i=0; i<SIZE; i++)
     {
@@ -35,32 +26,20 @@ void init_zero(int **&matrix)
     }
 }
 
-// Deallocates the memory space. 
-void deallocate_matrix(int **&matrix, int size)
-{
-    for (int i=0; i<size; i++) 
-    {
-        free(matrix[i]); 
-        matrix[i] = NULL;
-    }
-    free(matrix); 
-    matrix = NULL;
-}
-
 // Random generation of values to populate matrix.
-void random_matrix(int **&matrix, unsigned int seed)
+void random_matrix(Matrix<int> &matrix, uint64_t seed)
 {
     for (int i=0; i<SIZE; i++)
     {
         for (int j=0; j<SIZE; j++)
         {
-            matrix[i][j] = rand_r(&seed) % 100;
+            matrix[i][j] = rng_int(seed, (uint64_t) i * SIZE + j, 100);
         }
     } 
 }
 
 // Prints the matrix passed to the screen 
-void print_matrix(int **&matrix)
+void print_matrix(Matrix<int> &matrix)
 {
     cout << "\n";
     for (int i=0; i<SIZE; i++)
@@ -75,7 +54,7 @@ void print_matrix(int **&matrix)
 }
 
 // Writes the matrix to a text file.
-void write_matrix(string f_name, int calc_time, int **&matrix)
+void write_matrix(string f_name, int calc_time, Matrix<int> &matrix)
 {
     ofstream fstream(f_name); // Creates the txt file. 
 
@@ -100,44 +79,34 @@ void write_matrix(string f_name, int calc_time, int **&matrix)
 }
 
 // Takes three matrices, multipys a and b storing the result in the result_m matrix. 
-void multiply_matrix(int **&matrix_a, int **&matrix_b, int **&result_m)
+void multiply_matrix(Matrix<int> &matrix_a, Matrix<int> &matrix_b, Matrix<int> &result_m)
 {
-    for (int i=0; i<SIZE; i++)
-    {
-        for (int j=0; j<SIZE; j++)
-        {
-            for (int k=0; k<SIZE; k++)
-            {
-                result_m[i][j] += (matrix_a[i][k] * matrix_b[k][j]);
-            }
-        }
-    }
+    gemm(SIZE, SIZE, SIZE, matrix_a[0], matrix_a.ld(), matrix_b[0], matrix_b.ld(),
+        result_m[0], result_m.ld());
 }
 
  // Print Summary of Calulation Time.
 void print_results(int calc_time, int size)
 {
     cout << "\nCalculation time: " << calc_time << " microseconds.\nSEQUENTIAL processing of a " 
-        << SIZE << " X " << SIZE << " Matrix." << endl;
+        << SIZE << " X " << SIZE << " Matrix (" << gemm_kernel_name<int>() << " kernel)." << endl;
     cout << "                  " << calc_time/1000000.0 << " seconds." << endl;
     cout << endl;
 }
 
 int main() 
 {
-    int **matrix_a, **matrix_b, **result_m;
-    
-    // Allocateing the memory Space for each Matrix
-    init_matrix(matrix_a, SIZE);
-    init_matrix(matrix_b, SIZE);
-    init_matrix(result_m, SIZE);
+    // Allocateing the memory Space for each Matrix, one aligned block each.
+    Matrix<int> matrix_a(SIZE, SIZE);
+    Matrix<int> matrix_b(SIZE, SIZE);
+    Matrix<int> result_m(SIZE, SIZE);
 
     // Ensuring no garbage values exist
     init_zero(result_m);
 
     // Populate matrices a and b with random values. 
-    random_matrix(matrix_a, 5);
-    random_matrix(matrix_b, 3);
+    random_matrix(matrix_a, RNG_SEED_A);
+    random_matrix(matrix_b, RNG_SEED_B);
 
     // print_matrix(matrix_a); // TEST Print Functions. 
     // print_matrix(matrix_b);
@@ -162,10 +131,6 @@ int main()
     // Print Summary of Calulation Time.
     print_results(calc_time, SIZE);
 
-    // Deallocate Memory & set pointer to NULL.
-    deallocate_matrix(matrix_a, SIZE); 
-    deallocate_matrix(matrix_b, SIZE); 
-    deallocate_matrix(result_m, SIZE); 
-
+    // Matrix memory is released when the matrices go out of scope.
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,421 @@
+// Packed panel (GotoBLAS style) matrix multiplication engine.
+//
+// gemm(m, n, k, a, lda, b, ldb, c, ldc) computes C += A x B for int, float or
+// double row-major matrices with leading dimensions lda, ldb and ldc (see the
+// Matrix<T> type in Common/matrix.h). Blocks of A and B are packed into contiguous
+// 64-byte aligned buffers, then a register blocked micro-kernel computes one
+// GEMM_MR x nr tile of C at a time. The micro-kernel is picked at runtime from
+// the CPU's features (AVX-512 -> AVX2 -> portable C++), set GEMM_KERNEL to
+// "avx512", "avx2" or "scalar" in the environment to force one for testing.
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+
+#define GEMM_MR 6       // Micro-tile rows, shared by every kernel.
+#define GEMM_NR_MAX 32  // Widest micro-tile (AVX-512 int / float).
+#define GEMM_MC 96      // Rows of A per packed block (multiple of GEMM_MR), sized for L2.
+#define GEMM_KC 256     // Depth per packed block, a KC x NR micro-panel of B stays in L1.
+#define GEMM_NC 4096    // Columns of B per packed block, sized for L3.
+
+// A micro-kernel computes c = a_panel x b_panel for one GEMM_MR x nr tile.
+    // a: kc x GEMM_MR packed column by column, b: kc x nr packed row by row,
+    // c: GEMM_MR x nr tile (overwritten, 64-byte aligned).
+template <typename T>
+struct gemm_kernel
+{
+    const char *name;
+    int nr;
+    void (*micro)(int kc, const T *a, const T *b, T *c);
+};
+
+//////////////////////////////// MICRO-KERNELS ////////////////////////////////
+// Portable micro-kernel (8 columns), used when no SIMD kernel is available.
+template <typename T>
+static void micro_scalar(int kc, const T *a, const T *b, T *c)
+{
+    T acc[GEMM_MR][8] = {};
+    for (int p=0; p<kc; p++)
+    {
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            for (int j=0; j<8; j++)
+            {
+                acc[r][j] += a[r] * b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += 8;
+    }
+    memcpy(c, acc, sizeof(acc));
+}
+
+// AVX2 int32: 6 x 16 tile held in 12 ymm accumulators (vpmulld + vpaddd).
+__attribute__((target("avx2")))
+static void micro_int_avx2(int kc, const int *a, const int *b, int *c)
+{
+    __m256i acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm256_setzero_si256();
+        acc[r][1] = _mm256_setzero_si256();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m256i b0 = _mm256_load_si256((const __m256i *) b);
+        __m256i b1 = _mm256_load_si256((const __m256i *) (b + 8));
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m256i ar = _mm256_set1_epi32(a[r]);
+            acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_mullo_epi32(ar, b0));
+            acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_mullo_epi32(ar, b1));
+        }
+        a += GEMM_MR;
+        b += 16;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm256_store_si256((__m256i *) (c + r*16), acc[r][0]);
+        _mm256_store_si256((__m256i *) (c + r*16 + 8), acc[r][1]);
+    }
+}
+
+// AVX2 float: 6 x 16 tile, fused multiply-add.
+__attribute__((target("avx2,fma")))
+static void micro_float_avx2(int kc, const float *a, const float *b, float *c)
+{
+    __m256 acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m256 ar = _mm256_broadcast_ss(a + r);
+            acc[r][0] = _mm256_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(ar, b1, acc[r][1]);
+        }
+        a += GEMM_MR;
+        b += 16;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm256_store_ps(c + r*16, acc[r][0]);
+        _mm256_store_ps(c + r*16 + 8, acc[r][1]);
+    }
+}
+
+// AVX2 double: 6 x 8 tile, fused multiply-add.
+__attribute__((target("avx2,fma")))
+static void micro_double_avx2(int kc, const double *a, const double *b, double *c)
+{
+    __m256d acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm256_setzero_pd();
+        acc[r][1] = _mm256_setzero_pd();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m256d b0 = _mm256_load_pd(b);
+        __m256d b1 = _mm256_load_pd(b + 4);
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m256d ar = _mm256_broadcast_sd(a + r);
+            acc[r][0] = _mm256_fmadd_pd(ar, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_pd(ar, b1, acc[r][1]);
+        }
+        a += GEMM_MR;
+        b += 8;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm256_store_pd(c + r*8, acc[r][0]);
+        _mm256_store_pd(c + r*8 + 4, acc[r][1]);
+    }
+}
+
+// AVX-512 int32: 6 x 32 tile held in 12 zmm accumulators.
+__attribute__((target("avx512f")))
+static void micro_int_avx512(int kc, const int *a, const int *b, int *c)
+{
+    __m512i acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm512_setzero_si512();
+        acc[r][1] = _mm512_setzero_si512();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m512i b0 = _mm512_load_si512(b);
+        __m512i b1 = _mm512_load_si512(b + 16);
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m512i ar = _mm512_set1_epi32(a[r]);
+            acc[r][0] = _mm512_add_epi32(acc[r][0], _mm512_mullo_epi32(ar, b0));
+            acc[r][1] = _mm512_add_epi32(acc[r][1], _mm512_mullo_epi32(ar, b1));
+        }
+        a += GEMM_MR;
+        b += 32;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm512_store_si512(c + r*32, acc[r][0]);
+        _mm512_store_si512(c + r*32 + 16, acc[r][1]);
+    }
+}
+
+// AVX-512 float: 6 x 32 tile, fused multiply-add.
+__attribute__((target("avx512f")))
+static void micro_float_avx512(int kc, const float *a, const float *b, float *c)
+{
+    __m512 acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m512 ar = _mm512_set1_ps(a[r]);
+            acc[r][0] = _mm512_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(ar, b1, acc[r][1]);
+        }
+        a += GEMM_MR;
+        b += 32;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm512_store_ps(c + r*32, acc[r][0]);
+        _mm512_store_ps(c + r*32 + 16, acc[r][1]);
+    }
+}
+
+// AVX-512 double: 6 x 16 tile, fused multiply-add.
+__attribute__((target("avx512f")))
+static void micro_double_avx512(int kc, const double *a, const double *b, double *c)
+{
+    __m512d acc[GEMM_MR][2];
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        acc[r][0] = _mm512_setzero_pd();
+        acc[r][1] = _mm512_setzero_pd();
+    }
+    for (int p=0; p<kc; p++)
+    {
+        __m512d b0 = _mm512_load_pd(b);
+        __m512d b1 = _mm512_load_pd(b + 8);
+        #pragma GCC unroll 6
+        for (int r=0; r<GEMM_MR; r++)
+        {
+            __m512d ar = _mm512_set1_pd(a[r]);
+            acc[r][0] = _mm512_fmadd_pd(ar, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_pd(ar, b1, acc[r][1]);
+        }
+        a += GEMM_MR;
+        b += 16;
+    }
+    #pragma GCC unroll 6
+    for (int r=0; r<GEMM_MR; r++)
+    {
+        _mm512_store_pd(c + r*16, acc[r][0]);
+        _mm512_store_pd(c + r*16 + 8, acc[r][1]);
+    }
+}
+
+//////////////////////////////// KERNEL DISPATCH ////////////////////////////////
+// Picks the widest ISA the CPU supports, unless GEMM_KERNEL forces one
+// (a forced ISA the CPU lacks falls back to the best one it has below it).
+static inline int gemm_detect_isa()
+{
+    const char *force = getenv("GEMM_KERNEL");
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    if (force != NULL && strcmp(force, "scalar") == 0) {return 0;}
+    if (force != NULL && strcmp(force, "avx2") == 0) {return avx2 ? 1 : 0;}
+    // "avx512", or nothing forced.
+    return avx512 ? 2 : (avx2 ? 1 : 0);
+}
+
+// ISA in use: 0 = scalar, 1 = AVX2, 2 = AVX-512. Detected once, the static
+// initialiser is thread-safe, so OpenMP threads can call gemm() together.
+static inline int gemm_isa()
+{
+    static const int isa = gemm_detect_isa();
+    return isa;
+}
+
+template <typename T>
+inline gemm_kernel<T> select_kernel()
+{
+    gemm_kernel<T> kernel = {"scalar", 8, micro_scalar<T>};
+    return kernel;
+}
+
+template <>
+inline gemm_kernel<int> select_kernel<int>()
+{
+    gemm_kernel<int> kernels[3] = {{"scalar", 8, micro_scalar<int>},
+        {"avx2", 16, micro_int_avx2}, {"avx512", 32, micro_int_avx512}};
+    return kernels[gemm_isa()];
+}
+
+template <>
+inline gemm_kernel<float> select_kernel<float>()
+{
+    gemm_kernel<float> kernels[3] = {{"scalar", 8, micro_scalar<float>},
+        {"avx2", 16, micro_float_avx2}, {"avx512", 32, micro_float_avx512}};
+    return kernels[gemm_isa()];
+}
+
+template <>
+inline gemm_kernel<double> select_kernel<double>()
+{
+    gemm_kernel<double> kernels[3] = {{"scalar", 8, micro_scalar<double>},
+        {"avx2", 8, micro_double_avx2}, {"avx512", 16, micro_double_avx512}};
+    return kernels[gemm_isa()];
+}
+
+//////////////////////////////// PACKING ////////////////////////////////
+// Packs rows [i0, i0+mc) x columns [k0, k0+kc) of A into GEMM_MR row micro-panels,
+// each stored column by column. Rows past mc are zero padded.
+template <typename T>
+static void pack_a(const T *a, int lda, int i0, int k0, int mc, int kc, T *packed)
+{
+    for (int ir=0; ir<mc; ir+=GEMM_MR)
+    {
+        int rows = std::min(GEMM_MR, mc - ir);
+        for (int p=0; p<kc; p++)
+        {
+            for (int r=0; r<GEMM_MR; r++)
+            {
+                *packed++ = (r < rows) ? a[(size_t) (i0 + ir + r) * lda + k0 + p] : T(0);
+            }
+        }
+    }
+}
+
+// Packs rows [k0, k0+kc) x columns [j0, j0+nc) of B into nr column micro-panels,
+// each stored row by row. Columns past nc are zero padded.
+template <typename T>
+static void pack_b(const T *b, int ldb, int k0, int j0, int kc, int nc, int nr, T *packed)
+{
+    for (int jr=0; jr<nc; jr+=nr)
+    {
+        int cols = std::min(nr, nc - jr);
+        for (int p=0; p<kc; p++)
+        {
+            const T *b_row = b + (size_t) (k0 + p) * ldb + j0 + jr;
+            int j = 0;
+            for (; j<cols; j++) {*packed++ = b_row[j];}
+            for (; j<nr; j++) {*packed++ = T(0);}
+        }
+    }
+}
+
+static inline void *gemm_alloc(size_t bytes)
+{
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 64, bytes) != 0)
+    {
+        perror("Couldn't allocate the GEMM packing buffers");
+        exit(1);
+    }
+    return ptr;
+}
+
+//////////////////////////////// DRIVER ////////////////////////////////
+// C (m x n) += A (m x k) x B (k x n). Safe to call from several threads at once
+// on disjoint rows of C, each call uses its own packing buffers.
+template <typename T>
+void gemm(int m, int n, int k, const T *a, int lda, const T *b, int ldb, T *c, int ldc)
+{
+    gemm_kernel<T> kernel = select_kernel<T>();
+    const int nr = kernel.nr;
+    const int nc_max = ((std::min(n, GEMM_NC) + nr - 1) / nr) * nr;
+
+    T *a_packed = (T *) gemm_alloc(sizeof(T) * GEMM_MC * GEMM_KC);
+    T *b_packed = (T *) gemm_alloc(sizeof(T) * GEMM_KC * nc_max);
+    T *tile = (T *) gemm_alloc(sizeof(T) * GEMM_MR * GEMM_NR_MAX);
+
+    for (int jc=0; jc<n; jc+=GEMM_NC)
+    {
+        int nc = std::min(GEMM_NC, n - jc);
+        for (int pc=0; pc<k; pc+=GEMM_KC)
+        {
+            int kc = std::min(GEMM_KC, k - pc);
+            pack_b(b, ldb, pc, jc, kc, nc, nr, b_packed);
+
+            for (int ic=0; ic<m; ic+=GEMM_MC)
+            {
+                int mc = std::min(GEMM_MC, m - ic);
+                pack_a(a, lda, ic, pc, mc, kc, a_packed);
+
+                for (int jr=0; jr<nc; jr+=nr)
+                {
+                    int cols = std::min(nr, nc - jr);
+                    for (int ir=0; ir<mc; ir+=GEMM_MR)
+                    {
+                        int rows = std::min(GEMM_MR, mc - ir);
+                        kernel.micro(kc, a_packed + ir*kc, b_packed + jr*kc, tile);
+
+                        // Adds the valid part of the tile into C.
+                        for (int r=0; r<rows; r++)
+                        {
+                            T *c_row = c + (size_t) (ic + ir + r) * ldc + jc + jr;
+                            const T *t_row = tile + r*nr;
+                            for (int j=0; j<cols; j++)
+                            {
+                                c_row[j] += t_row[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(a_packed);
+    free(b_packed);
+    free(tile);
+}
+
+// Name of the micro-kernel gemm<T> will run on this CPU.
+template <typename T>
+const char *gemm_kernel_name()
+{
+    return select_kernel<T>().name;
+}
+
+#endif
@@ -1,30 +1,164 @@
-// This function declares "multiply_matrix" as a kernal and makes it visable to the host 
-// code so it can be enqueued and executed by an application on an OpenCL device. 
+// This function declares "multiply_matrix" as a kernal and makes it visable to the host
+// code so it can be enqueued and executed by an application on an OpenCL device.
     // It can be executed on the OpenCL device only.
     // It can be called by the host
-    // If another _kernel function calls it, it is treated like a regular function call. 
+    // If another _kernel function calls it, it is treated like a regular function call.
 
     // M: Rows of A assigned to each process
     // N: Columns of A and also the rows of B
     // K: Columns of B
 
-__kernel void multiply_matrix( const int M, const int N, const int K, 
+// Naive kernel, one element of C per work-item read straight from global memory.
+// Kept as the baseline the autotuner in MPI_OpenCL_MM.cpp compares against.
+__kernel void multiply_matrix( const int M, const int N, const int K,
                                 const __global int *A, const __global int *B, __global int *C)
 {
-    // Thread Identifiers 
+    // Thread Identifiers
     const int i = get_global_id(0); // Row ID of Matrix C (0...M)
-    const int j = get_global_id(1); // Col ID of Matric C (0...N)
+    const int j = get_global_id(1); // Col ID of Matric C (0...K)
+
+    if (i >= M || j >= K)
+    {
+        return;
+    }
 
     // Compute a single element with each loop of K.
-    float sum = 0;
+    int sum = 0; // Integer accumulator, exact for int matrices (a float loses digits past 2^24).
     for (int k=0; k<N; k++)
     {
-        sum += A[i*N + k] * B[k*N + j];
+        sum += A[i*N + k] * B[k*K + j];
+    }
+
+    C[i*K + j] = sum; // Sore the results.
+}
+
+//////////////////////////////// TILED KERNEL ////////////////////////////////
+// Tile sizes are set by the host with -D build options, one build per variant.
+    // TSM x TSN: Block of C computed by each work-group.
+    // TSK: Depth of the A and B tiles held in __local memory per step.
+    // WPTM x WPTN: Block of C computed by each work-item (kept in registers).
+    // VW: Vector width used to load rows of B (1, 2, 4, 8 or 16).
+// Work-group size is (TSN/WPTN, TSM/WPTM), dimension 0 runs along the columns
+// of C so neighbouring work-items touch neighbouring addresses. Any M, N and K
+// work, tiles past the edges are zero filled and their results not stored.
+#ifndef TSM
+#define TSM 32
+#endif
+#ifndef TSN
+#define TSN 32
+#endif
+#ifndef TSK
+#define TSK 16
+#endif
+#ifndef WPTM
+#define WPTM 4
+#endif
+#ifndef WPTN
+#define WPTN 4
+#endif
+#ifndef VW
+#define VW 4
+#endif
+
+#define RTSM (TSM/WPTM) // Work-items along the rows of the tile.
+#define RTSN (TSN/WPTN) // Work-items along the columns of the tile.
+
+#define CAT(a, b) a##b
+#define XCAT(a, b) CAT(a, b)
+#if VW == 1
+#define intv int
+#define VLOAD(p) (*(p))
+#define VSTORE(v, p) (*(p) = (v))
+#else
+#define intv XCAT(int, VW)
+#define VLOAD(p) XCAT(vload, VW)(0, p)
+#define VSTORE(v, p) XCAT(vstore, VW)(v, 0, p)
+#endif
+
+__kernel void multiply_matrix_tiled( const int M, const int N, const int K,
+                                const __global int *A, const __global int *B, __global int *C)
+{
+    const int tc = get_local_id(0); // Column of this work-item in the tile (0...RTSN)
+    const int tr = get_local_id(1); // Row of this work-item in the tile (0...RTSM)
+    const int col0 = get_group_id(0) * TSN; // First column of C for this work-group
+    const int row0 = get_group_id(1) * TSM; // First row of C for this work-group
+    const int tid = tr * RTSN + tc;
+    const int threads = RTSM * RTSN;
+
+    // A is stored transposed so both tiles are read along their rows below.
+    __local int Asub[TSK][TSM];
+    __local int Bsub[TSK][TSN];
+
+    int acc[WPTM][WPTN];
+    for (int wm=0; wm<WPTM; wm++)
+    {
+        for (int wn=0; wn<WPTN; wn++)
+        {
+            acc[wm][wn] = 0;
+        }
     }
-    
-    C[i*N + j] = sum; // Sore the results.
 
-    /*
-        NOTE: 
-    */
+    for (int t=0; t<N; t+=TSK)
+    {
+        // Load the TSM x TSK tile of A, every work-item takes a share.
+        for (int l=tid; l<TSM*TSK; l+=threads)
+        {
+            int r = l / TSK, c = l % TSK;
+            int gr = row0 + r, gc = t + c;
+            Asub[c][r] = (gr < M && gc < N) ? A[gr*N + gc] : 0;
+        }
+
+        // Load the TSK x TSN tile of B, VW columns at a time.
+        for (int l=tid; l<TSK*(TSN/VW); l+=threads)
+        {
+            int r = l / (TSN/VW), c = (l % (TSN/VW)) * VW;
+            int gr = t + r, gc = col0 + c;
+            if (gr < N && gc + VW <= K)
+            {
+                intv v = VLOAD(B + gr*K + gc);
+                VSTORE(v, &Bsub[r][c]);
+            }
+            else
+            {
+                for (int v=0; v<VW; v++)
+                {
+                    Bsub[r][c + v] = (gr < N && gc + v < K) ? B[gr*K + gc + v] : 0;
+                }
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Multiply the tiles, WPTM x WPTN results per work-item.
+        for (int k=0; k<TSK; k++)
+        {
+            int breg[WPTN];
+            for (int wn=0; wn<WPTN; wn++)
+            {
+                breg[wn] = Bsub[k][tc + wn*RTSN];
+            }
+            for (int wm=0; wm<WPTM; wm++)
+            {
+                int a = Asub[k][tr + wm*RTSM];
+                for (int wn=0; wn<WPTN; wn++)
+                {
+                    acc[wm][wn] += a * breg[wn];
+                }
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Store the results that fall inside C.
+    for (int wm=0; wm<WPTM; wm++)
+    {
+        int gr = row0 + tr + wm*RTSM;
+        for (int wn=0; wn<WPTN; wn++)
+        {
+            int gc = col0 + tc + wn*RTSN;
+            if (gr < M && gc < K)
+            {
+                C[gr*K + gc] = acc[wm][wn];
+            }
+        }
+    }
 }
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Strong and weak scaling runs for the SUMMA mode of MPI_MM.cpp.
+# Usage: ./scaling.sh [max_ranks] [base_size]
+#   Strong scaling: base_size x base_size matrices on 1..max_ranks ranks.
+#   Weak scaling:   n = base_size * sqrt(ranks), so each rank holds the same
+#                   amount of A, B and C (the work per rank grows by sqrt(ranks)).
+# Extra mpirun options (e.g. "-hostfile ./cluster" or "--oversubscribe") can be
+# passed through MPIRUN_ARGS.
+
+MAX_RANKS=${1:-8}
+BASE=${2:-1200}
+
+mpicxx -O2 MPI_MM.cpp -o mpi || exit 1
+
+run() {
+    mpirun $MPIRUN_ARGS -np $1 ./mpi --summa $2 | grep "Multiply time" | awk '{print $3, $5}' | tr -d '('
+}
+
+echo "Strong scaling, n = $BASE"
+echo "ranks  n       seconds   GOP/s    speedup  efficiency"
+base_time=""
+for ((p=1; p<=MAX_RANKS; p*=2)); do
+    read secs gops <<< "$(run $p $BASE)"
+    [ -z "$base_time" ] && base_time=$secs
+    awk -v p=$p -v n=$BASE -v s=$secs -v g=$gops -v t=$base_time \
+        'BEGIN { printf "%-6d %-7d %-9.4f %-8.2f %-8.2f %.1f%%\n", p, n, s, g, t/s, 100*t/(s*p) }'
+done
+
+echo
+echo "Weak scaling, n = $BASE * sqrt(ranks)"
+echo "ranks  n       seconds   GOP/s    efficiency"
+base_time=""
+for ((p=1; p<=MAX_RANKS; p*=2)); do
+    n=$(awk -v b=$BASE -v p=$p 'BEGIN { printf "%d", b * sqrt(p) }')
+    read secs gops <<< "$(run $p $n)"
+    [ -z "$base_time" ] && base_time=$secs
+    # Work per rank grows by sqrt(p) at constant memory, scale the ideal time to match.
+    awk -v p=$p -v n=$n -v s=$secs -v g=$gops -v t=$base_time \
+        'BEGIN { printf "%-6d %-7d %-9.4f %-8.2f %.1f%%\n", p, n, s, g, 100*t*sqrt(p)/s }'
+done
@@ -0,0 +1,296 @@
+// COMPILE: mpicxx -O2 -fopenmp MPI_Qsort.cpp -o mpiQS
+// RUN HEAD: mpirun -np 4 ./mpiQS
+// RUN CLUSTER: sudo mpirun -np 8 -hostfile ./cluster ./mpiQS
+// Options: --size n           total elements, split over the ranks (default SIZE)
+//          --per-rank n       n elements on every rank instead (weak scaling)
+//          --input uniform|few|sorted|reverse     (default few, random 0-999)
+//          --algorithm auto|quick|radix|counting|sample   local OpenMP sort (default auto)
+//          --weight w         share of the elements for this node, as in the other MPI programs
+// weak_scaling.sh runs 1 to 16 ranks at a fixed number of elements per rank.
+//
+// Distributed sample sort: every rank generates and sorts its own part with the
+// OpenMP sort, picks regularly spaced samples, and the samples are shared with
+// MPI_Allgather so all ranks agree on the same splitters. MPI_Alltoallv then
+// sends each key to the rank whose key range holds it, and every rank merges
+// the sorted runs it received. The result is globally sorted: rank r holds the
+// r-th slice of the sorted vector, about as many elements as it started with.
+
+#include <mpi.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "../../Common/partition.h" // Weighted partitions.
+#include "../../Common/rng.h" // Counter-based random numbers.
+#include "../../Common/quicksort.h" // Input patterns and options of the local sort.
+#include "../../Common/omp_sort.h" // Local OpenMP sorts.
+
+using namespace std;
+using namespace std::chrono;
+
+#define SIZE 16000000 // Default number of elements, over all ranks.
+#define OMP_LIMIT 1000 // quick_sort_OMP's task cutoff for the local sort.
+#define SAMPLES_PER_RANK 256 // Regular samples each rank contributes to the splitter choice.
+
+// Fills this rank's part, element first + k of the whole vector.
+void rand_fill(int* vec, int count, long first, long total, qs_input input, uint64_t seed)
+{
+    #pragma omp parallel for schedule(static)
+    for (int k=0; k<count; k++)
+    {
+        vec[k] = qs_value(first + k, total, input, seed);
+    }
+}
+
+// Sum of the elements, to check that no key is lost or duplicated.
+long long checksum(int* vec, int count)
+{
+    long long sum = 0;
+    #pragma omp parallel for reduction(+:sum)
+    for (int k=0; k<count; k++)
+    {
+        sum += vec[k];
+    }
+    return sum;
+}
+
+// Splitters that cut the sorted vector so rank r ends up with about counts[r]
+// elements. Every rank sends SAMPLES_PER_RANK regularly spaced keys of its
+// sorted part, each standing for counts[r] / SAMPLES_PER_RANK elements, and all
+// ranks pick the same num_tasks - 1 splitters from the same gathered samples.
+void choose_splitters(int* vec, int count, int num_tasks, const int* counts, int* splitters)
+{
+    int local[SAMPLES_PER_RANK];
+    for (int s=0; s<SAMPLES_PER_RANK; s++)
+    {
+        local[s] = count > 0 ? vec[(long) count * s / SAMPLES_PER_RANK] : INT_MAX;
+    }
+
+    int* samples = (int*) malloc(sizeof(int) * SAMPLES_PER_RANK * num_tasks);
+    MPI_Allgather(local, SAMPLES_PER_RANK, MPI_INT, samples, SAMPLES_PER_RANK, MPI_INT, MPI_COMM_WORLD);
+
+    // Sort the samples by key, carrying the number of elements each one stands for.
+    pair<int, double>* weighted = (pair<int, double>*) malloc(sizeof(pair<int, double>) * SAMPLES_PER_RANK * num_tasks);
+    for (int r=0; r<num_tasks; r++)
+    {
+        for (int s=0; s<SAMPLES_PER_RANK; s++)
+        {
+            weighted[r * SAMPLES_PER_RANK + s] = make_pair(samples[r * SAMPLES_PER_RANK + s],
+                (double) counts[r] / SAMPLES_PER_RANK);
+        }
+    }
+    sort(weighted, weighted + SAMPLES_PER_RANK * num_tasks);
+
+    // Splitter r is the sample where the running count passes the end of rank r's share.
+    double below = 0, target = 0;
+    int next = 0;
+    for (int r=0; r<num_tasks-1; r++)
+    {
+        target += counts[r];
+        while (next < SAMPLES_PER_RANK * num_tasks - 1 && below + weighted[next].second < target)
+        {
+            below += weighted[next].second;
+            next++;
+        }
+        splitters[r] = weighted[next].first;
+    }
+    free(samples);
+    free(weighted);
+}
+
+// Merges the num_runs sorted runs of data (run r is [starts[r], starts[r + 1]))
+// pairwise, log2(num_runs) rounds with the pairs of a round merged in parallel.
+// Returns the buffer that holds the result, data or spare.
+int* merge_runs(int* data, int* spare, long* starts, int num_runs)
+{
+    int* src = data;
+    int* dst = spare;
+    long* bounds = (long*) malloc(sizeof(long) * (num_runs + 1));
+    memcpy(bounds, starts, sizeof(long) * (num_runs + 1));
+
+    for (int runs = num_runs; runs > 1; runs = (runs + 1) / 2)
+    {
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int pair_first = 0; pair_first < runs; pair_first += 2)
+        {
+            long lo = bounds[pair_first];
+            long mid = bounds[min(pair_first + 1, runs)];
+            long hi = bounds[min(pair_first + 2, runs)];
+            merge(src + lo, src + mid, src + mid, src + hi, dst + lo);
+        }
+        // The merged runs start at every second boundary.
+        for (int r = 0; r <= (runs + 1) / 2; r++)
+        {
+            bounds[r] = bounds[min(2 * r, runs)];
+        }
+        swap(src, dst);
+    }
+    free(bounds);
+    return src;
+}
+
+int main(int argc, char** argv)
+{
+    int num_tasks, rank, name_len;
+    char name[MPI_MAX_PROCESSOR_NAME];
+
+    // Setting up and starting the Parallel Processes
+    MPI_Init(&argc,&argv); // Initialize the MPI environment
+    MPI_Comm_size(MPI_COMM_WORLD, &num_tasks); // Get the number of tasks/process
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank i.e. process i.d.
+    MPI_Get_processor_name(name, &name_len); // Find the processor name
+
+    // Options, the same on every rank.
+    const char* per_rank = qs_arg(argc, argv, "--per-rank");
+    const char* size_arg = qs_arg(argc, argv, "--size");
+    long total = per_rank != NULL ? atol(per_rank) * num_tasks : size_arg != NULL ? atol(size_arg) : SIZE;
+    qs_input input = (qs_input) qs_lookup(qs_arg(argc, argv, "--input"), qs_input_names, 4, QS_FEW_UNIQUE);
+    sort_algorithm algorithm = (sort_algorithm) qs_lookup(qs_arg(argc, argv, "--algorithm"), sort_names, 5, SORT_AUTO);
+    qs_options opts;
+    opts.scheme = QS_THREE_WAY;
+    opts.pivot = QS_PIVOT_NINTHER;
+    opts.fallbacks = 0;
+    if (total < 1 || total > INT_MAX)
+    {
+        if (rank == 0)
+        {
+            printf("The total number of elements must be between 1 and %d.\n", INT_MAX);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Elements for each process, equal unless --weight is given.
+    int *counts = (int*) malloc(num_tasks * sizeof(int));
+    int *displs = (int*) malloc(num_tasks * sizeof(int));
+    partition_work(total, 1, per_rank != NULL ? 1.0 : parse_weight(argc, argv), num_tasks, counts, displs);
+    int count = counts[rank];
+
+    // Each rank generates only its own part of the vector.
+    int* local = (int*) malloc(sizeof(int) * max(count, 1));
+    if (local == NULL)
+    {
+        perror("Couldn't allocate the local vector");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    rand_fill(local, count, displs[rank], total, input, RNG_SEED_A);
+    long long input_sum = checksum(local, count);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = high_resolution_clock::now();
+
+    // 1. Local OpenMP sort.
+    sort_algorithm used = sort_OMP(local, count, OMP_LIMIT, &opts, algorithm);
+    auto sorted = high_resolution_clock::now();
+
+    // 2. Splitters from the gathered samples.
+    int* splitters = (int*) malloc(sizeof(int) * max(num_tasks - 1, 1));
+    choose_splitters(local, count, num_tasks, counts, splitters);
+    auto split = high_resolution_clock::now();
+
+    // 3. Send every key to its rank: keys <= splitters[r] and > splitters[r - 1] go to rank r.
+    int* send_counts = (int*) malloc(sizeof(int) * num_tasks);
+    int* send_displs = (int*) malloc(sizeof(int) * num_tasks);
+    int* recv_counts = (int*) malloc(sizeof(int) * num_tasks);
+    int* recv_displs = (int*) malloc(sizeof(int) * num_tasks);
+    int begin = 0;
+    for (int r=0; r<num_tasks; r++)
+    {
+        int end = r < num_tasks-1 ? upper_bound(local + begin, local + count, splitters[r]) - local : count;
+        send_displs[r] = begin;
+        send_counts[r] = end - begin;
+        begin = end;
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+
+    long* run_starts = (long*) malloc(sizeof(long) * (num_tasks + 1));
+    run_starts[0] = 0;
+    for (int r=0; r<num_tasks; r++)
+    {
+        recv_displs[r] = run_starts[r];
+        run_starts[r + 1] = run_starts[r] + recv_counts[r];
+    }
+    int received = run_starts[num_tasks];
+    int* incoming = (int*) malloc(sizeof(int) * max(received, 1));
+    int* spare = (int*) malloc(sizeof(int) * max(received, 1));
+    if (incoming == NULL || spare == NULL)
+    {
+        perror("Couldn't allocate the receive buffers");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Alltoallv(local, send_counts, send_displs, MPI_INT, incoming, recv_counts, recv_displs, MPI_INT, MPI_COMM_WORLD);
+    auto exchanged = high_resolution_clock::now();
+
+    // 4. Merge the num_tasks sorted runs that arrived.
+    int* result = merge_runs(incoming, spare, run_starts, num_tasks);
+    auto stop = high_resolution_clock::now();
+
+    // Check: every rank in order, no key lost, and each rank's last key <= the next rank's first.
+    long long output_sum = checksum(result, received);
+    int in_order = qs_is_sorted(result, received) ? 1 : 0;
+    int ends[3] = {received > 0, received > 0 ? result[0] : 0, received > 0 ? result[received - 1] : 0};
+    int* all_ends = (int*) malloc(sizeof(int) * 3 * num_tasks);
+    MPI_Gather(ends, 3, MPI_INT, all_ends, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    long long sums[2] = {input_sum, output_sum}, total_sums[2];
+    MPI_Reduce(sums, total_sums, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    int all_in_order;
+    MPI_Reduce(&in_order, &all_in_order, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+
+    // Slowest rank's time for each phase, and the largest output part.
+    double phases[5] = {
+        duration_cast<microseconds>(sorted - start).count() / 1000000.0,
+        duration_cast<microseconds>(split - sorted).count() / 1000000.0,
+        duration_cast<microseconds>(exchanged - split).count() / 1000000.0,
+        duration_cast<microseconds>(stop - exchanged).count() / 1000000.0,
+        duration_cast<microseconds>(stop - start).count() / 1000000.0};
+    double slowest[5];
+    MPI_Reduce(phases, slowest, 5, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    int largest;
+    MPI_Reduce(&received, &largest, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0)
+    {
+        bool globally_sorted = all_in_order == 1 && total_sums[0] == total_sums[1];
+        int previous = INT_MIN;
+        for (int r=0; r<num_tasks; r++)
+        {
+            if (all_ends[3 * r])
+            {
+                globally_sorted = globally_sorted && previous <= all_ends[3 * r + 1];
+                previous = all_ends[3 * r + 2];
+            }
+        }
+
+        printf("\nMPI sample sort of %ld elements (%s input) on %d ranks x %d threads, local %s sort",
+            total, qs_input_names[input], num_tasks, omp_get_max_threads(), sort_names[used]);
+        if (used == SORT_QUICK || used == SORT_SAMPLE)
+        {
+            printf(" (%s partition, %s pivot)", qs_scheme_names[opts.scheme], qs_pivot_names[opts.pivot]);
+        }
+        printf(".\n");
+        printf(" Local sort:    %.4f seconds\n", slowest[0]);
+        printf(" Splitters:     %.4f seconds\n", slowest[1]);
+        printf(" Alltoallv:     %.4f seconds\n", slowest[2]);
+        printf(" Merge:         %.4f seconds\n", slowest[3]);
+        printf(" Total time:    %.4f seconds, %.1f M elements/s\n", slowest[4], total / slowest[4] / 1e6);
+        printf(" Largest part:  %d elements, %.3fx the average\n", largest, (double) largest * num_tasks / total);
+        printf(" Globally sorted: %s\n\n", globally_sorted ? "yes" : "NO");
+    }
+
+    free(counts);
+    free(displs);
+    free(local);
+    free(splitters);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(run_starts);
+    free(incoming);
+    free(spare);
+    free(all_ends);
+
+    MPI_Finalize(); // Finalise the MPI environment.
+    return 0;
+}
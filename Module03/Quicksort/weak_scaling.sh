@@ -0,0 +1,33 @@
+#!/bin/bash
+# Weak scaling runs for MPI_Qsort.cpp: every rank holds the same number of elements.
+# Usage: ./weak_scaling.sh [max_ranks] [per_rank] [input]
+#   per_rank elements on each of 1, 2, 4 ... max_ranks ranks. Sorting is
+#   O(n log n) and the all-to-all grows with the rank count, so the ideal time
+#   rises by log2(n) / log2(per_rank), the efficiency column allows for that.
+# Each rank sorts with OMP_NUM_THREADS threads (default 1, so the ranks alone
+# fill the cores). Extra mpirun options (e.g. "-hostfile ./cluster" or
+# "--oversubscribe") can be passed through MPIRUN_ARGS.
+
+MAX_RANKS=${1:-16}
+PER_RANK=${2:-4000000}
+INPUT=${3:-uniform}
+export OMP_NUM_THREADS=${OMP_NUM_THREADS:-1}
+
+mpicxx -O2 -fopenmp MPI_Qsort.cpp -o mpiQS || exit 1
+
+run() {
+    mpirun $MPIRUN_ARGS -np $1 ./mpiQS --per-rank $PER_RANK --input $INPUT |
+        awk '/Alltoallv:/ { a = $2 } /Total time:/ { t = $3 } /Largest part:/ { l = $5 } /Globally sorted:/ { s = $3 }
+             END { print t, a, l, s }'
+}
+
+echo "Weak scaling, $PER_RANK $INPUT elements per rank, $OMP_NUM_THREADS thread(s) per rank"
+echo "ranks  n           seconds   alltoallv  imbalance  sorted  efficiency"
+base_time=""
+for ((p=1; p<=MAX_RANKS; p*=2)); do
+    read secs exchange largest sorted <<< "$(run $p)"
+    [ -z "$base_time" ] && base_time=$secs
+    awk -v p=$p -v m=$PER_RANK -v s=$secs -v a=$exchange -v l=$largest -v ok=$sorted -v t=$base_time \
+        'BEGIN { n = m * p; printf "%-6d %-11d %-9.4f %-10.4f %-10s %-7s %.1f%%\n",
+                 p, n, s, a, l, ok, 100 * t * (log(n) / log(m)) / s }'
+done
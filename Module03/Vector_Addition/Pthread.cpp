@@ -1,65 +1,63 @@
-// RUN WITH: clang++ program.cpp -o run -std=c++11
+// COMPILE COMMAND: g++ -O2 -fopenmp-simd -pthread Pthread.cpp -o pthread -std=c++11
+// Usage: ./pthread [--large]
+    // --large: Vectors on 2MB huge pages, v3 written with non-temporal stores,
+    //          and the add pass compared against the host's STREAM peak.
 
 #include <iostream>
 #include <cstdlib>
 #include <time.h>
 #include <chrono>
-#include <pthread.h>
+#include <cstring>
+#include "../../Common/thread_pool.h" // Persistent worker pool.
+#include "../../Common/add_reduce.h" // Fused SIMD add and 64-bit sum.
+#include "../../Common/large_vectors.h" // Huge-page vectors and the STREAM peak.
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 using namespace std::chrono;
 using namespace std;
 
-void randomVector(int vector[], int start, int end, unsigned int seed)
+void randomVector(int vector[], int start, int end, uint64_t seed)
 {
-    for (int i = start; i < end; i++)
-    {
-        // Populates the vector passed with random numbers from 0 to 99.
-        vector[i] = rand_r(&seed) % 100;
-    }
+    // Populates the vector passed with random numbers from 0 to 99, element i
+    // of stream seed, so the vector doesn't depend on how it was partitioned.
+    rng_fill(vector, start, end, seed, 100);
 }
 
 struct Data
 {
     int *v1, *v2, *v3;
-    unsigned int seed;
+    bool large; // Huge pages and non-temporal stores to v3.
 };
 
-struct thread_data {
-   int start;
-   int stop;
-   Data *vecData;
+// One worker's sum of v3, on its own cache line so the workers don't share one.
+struct alignas(64) partial_sum
+{
+    long long value;
 };
 
 
-void *addVector(void *args)
+void fillVectors(Data *data, long start, long stop)
 {
-    // Parse args
-    struct thread_data *tData;
-    tData = (struct thread_data*) args;
-
     // Fill vectors 1 and 2.
-    randomVector(tData->vecData->v1, tData->start, tData->stop, tData->vecData->seed);
-    randomVector(tData->vecData->v2, tData->start, tData->stop, tData->vecData->seed);
+    randomVector(data->v1, start, stop, RNG_SEED_A);
+    randomVector(data->v2, start, stop, RNG_SEED_B);
 
-    // Calculate sum
-    for (int i = tData->start; i < tData->stop; i++)
+    // Fault v3 in now (as STREAM initialises its arrays) so the timed pass
+    // measures memory bandwidth rather than page faults.
+    if (data->large)
     {
-        tData->vecData->v3[i] = tData->vecData->v1[i] + tData->vecData->v2[i];
+        memset(data->v3 + start, 0, (stop - start) * sizeof(int));
     }
-
-    pthread_exit(NULL);
 }
 
 
-int main(){
+int main(int argc, char **argv){
 
     unsigned long size = 150000000; // 150,000,000
     const int THREADS = 8;
-    int partition = size / THREADS;
-    int total = 0;
-    int totalCheck = 0;
-
-    srand(time(0));
+    long long total = 0;
+    long long totalCheck = 0;
+    bool large = argc > 1 && strcmp(argv[1], "--large") == 0;
 
     int *v1, *v2, *v3;
 
@@ -68,52 +66,43 @@ int main(){
 
     // Declares the values held by Vn as an unsigned long and the number to be held as "size" = 100,000,000.
 	// Then allocates memory on the heap for each of the soon to be created vectors.
-    v1 = (int *) malloc(size * sizeof(int *));
-    v2 = (int *) malloc(size * sizeof(int *));
-    v3 = (int *) malloc(size * sizeof(int *));
+    v1 = (int *) large_alloc(size * sizeof(int), large);
+    v2 = (int *) large_alloc(size * sizeof(int), large);
+    v3 = (int *) large_alloc(size * sizeof(int), large);
 
     // Adding vectors to the Data struct for ease of passing.
     Data data;
     data.v1 = v1;
     data.v2 = v2;
     data.v3 = v3;
+    data.large = large;
 
-    // Create a thread for number of THREADS.
-    pthread_t threads[THREADS];
-    struct thread_data threadData[THREADS];
+    // The threads are started once here and reused by both passes below.
+    ThreadPool pool(THREADS);
+    partial_sum partials[THREADS] = {};
 
-    for (int i = 0; i < THREADS; i++)
-    {
-        data.seed = i+1;
-
-        // Partition indexes
-        threadData[i].start = partition * i;
-        threadData[i].stop = threadData[i].start + partition;
-        threadData[i].vecData = &data;
-
-        if (i == THREADS - 1)
-        {
-            threadData[i].stop = size;
-        }
-        //cout << "Partition: " << data.start << " to " << data.stop << endl;
-        // Create and run thread
-        pthread_create(&threads[i], NULL, addVector, &threadData[i]);
-    }
+    // Both passes use the static schedule, so each worker adds the same
+    // (balanced) block it filled, and finds it in its own cache / NUMA node.
+    pool.parallel_for(0, size, [&](long first, long last, int) {
+        fillVectors(&data, first, last);
+    });
 
-    // Joining threads
-    for (int i = 0; i < THREADS; i++)
-    {
-        pthread_join(threads[i], NULL);
-    }
+    // Add the vectors and sum the result in one pass, timed on its own.
+    auto addStart = high_resolution_clock::now();
+    pool.parallel_for(0, size, [&](long first, long last, int worker) {
+        partials[worker].value = add_reduce(data.v1, data.v2, data.v3, first, last, large);
+    });
+    auto addStop = high_resolution_clock::now();
 
     auto stop = high_resolution_clock::now();
 
     // Calculating the duration in micro seconds from start to stop.
     auto duration = duration_cast<milliseconds>(stop - start);
 
-    for (int i = 0; i < size; i++)
+    // Combine the per-worker partial sums.
+    for (int i = 0; i < THREADS; i++)
     {
-        total += data.v3[i];
+        total += partials[i].value;
     }
     // Ensure that total is calculating correctly.
     for (int i = 0; i < size; i++)
@@ -124,14 +113,22 @@ int main(){
 
     // Print Summary
     cout << "pThread: for comparision (" << THREADS << " Threads, "
-        <<  size << " Elements). \nTotal Value: "
+        <<  size << " Elements, " << large_alloc_kind << " pages). \nTotal Value: "
     << total << ", expecting: " << totalCheck <<endl;
     cout << " Time taken by function: " << duration.count() << " milliseconds" << endl;
     cout << " Time taken by function: " << duration.count()/1000.0 << " seconds" << endl;
+    double addSeconds = duration_cast<microseconds>(addStop - addStart).count() / 1000000.0;
+    cout << " Add pass (" << add_reduce_kernel_name(large) << " kernel): " << addSeconds << " seconds, "
+        << add_reduce_gbs(size, addSeconds) << " GB/s (v1 and v2 read, v3 written)" << endl;
+    if (large)
+    {
+        print_stream_peak(THREADS, add_reduce_gbs(size, addSeconds), add_reduce_streams(large));
+    }
+    cout << " Pool dispatch: " << pool_dispatch_us(pool, 1000) << " microseconds per parallel_for" << endl;
 
-    free(v1);
-    free(v2);
-    free(v3);
+    large_free(v1, size * sizeof(int), large);
+    large_free(v2, size * sizeof(int), large);
+    large_free(v3, size * sizeof(int), large);
 
     return 0;
 }
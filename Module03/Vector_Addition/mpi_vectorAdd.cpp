@@ -3,31 +3,35 @@
 // COMPILE: mpicxx mpi_vectorAdd.cpp -o vec.o
 // RUN HEAD: mpirun -np 6 ./vec.o
 // RUN CLUSTER: sudo mpirun -np 6 -hostfile ./cluster ./vec.o
+// WEIGHTED: mpirun -np 1 ./vec.o --weight 2 : -np 3 ./vec.o (node 0 takes twice the share)
+// GENERATED: mpirun -np 6 ./vec.o --generate (each rank makes only its own part of v1 and v2,
+//            nothing is scattered or gathered and no rank holds a full vector, give it to
+//            every group of a weighted run)
 
 #include <mpi.h>
 #include <cstdlib>
 #include <iostream>
 #include <time.h>
 #include <chrono>
+#include <cstring>
+#include "../../Common/partition.h" // Weighted Scatterv/Gatherv partitions.
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 using namespace std;
 using namespace std::chrono;
 
 #define SIZE 102000000  //102,000,000
 
-// Populates vectors with random numbers 1-99.
-void rand_vector(int vector[], int size)
+// Populates vectors with random numbers 0-99, element i of stream seed.
+void rand_vector(int vector[], int size, uint64_t seed)
 {
-    for (int i = 0; i < size; i++)
-    {
-        vector[i] = rand() % 100;
-    }
+    rng_fill(vector, 0, size, seed, 100);
 }
 
 
-int vector_add(int v1[], int v2[], int v3[], int partition)
+long long vector_add(int v1[], int v2[], int v3[], int partition)
 {
-    int sum = 0;
+    long long sum = 0; // 102M elements of 0-198 add up to about 1e10, past INT_MAX.
     // Sum the values of the vector.
     for (int i = 0; i<partition; i++)
     {
@@ -43,12 +47,17 @@ int main(int argc, char** argv)
     int num_tasks, rank, name_len, tag=1;
     char name[MPI_MAX_PROCESSOR_NAME];
 
-    // Creating the pointes and allocating the memory.
-    int *v1, *v2, *v3, *v1_sub, *v2_sub, *v3_sub, total_sum;
-
-    v1 = (int*) malloc(SIZE * sizeof(int));
-    v2 = (int*) malloc(SIZE * sizeof(int));
-    v3 = (int*) malloc(SIZE * sizeof(int));
+    // Creating the pointes, the memory is allocated once the rank is known.
+    int *v1 = NULL, *v2 = NULL, *v3 = NULL, *v1_sub, *v2_sub, *v3_sub;
+    long long total_sum;
+    bool generate_input = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--generate") == 0)
+        {
+            generate_input = true;
+        }
+    }
 
     // Setting up and starting the Parallel Processes
     MPI_Status status; // Required to receive routines
@@ -57,37 +66,66 @@ int main(int argc, char** argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank i.e. process i.d.
     MPI_Get_processor_name(name, &name_len); // Find the processor name// Find the processor name
 
-    int partition = SIZE/num_tasks;
+    // Elements for each process, any SIZE and process count.
+    int *counts = (int*) malloc(num_tasks * sizeof(int));
+    int *displs = (int*) malloc(num_tasks * sizeof(int));
+    partition_work(SIZE, 1, parse_weight(argc, argv), num_tasks, counts, displs);
+    int partition = counts[rank];
+    auto setup_start = high_resolution_clock::now();
 
     v1_sub = (int*) malloc(partition * sizeof(int));
     v2_sub = (int*) malloc(partition * sizeof(int));
     v3_sub = (int*) malloc(partition * sizeof(int));
+    double local_mb = 3.0 * partition * sizeof(int) / (1024 * 1024); // Vector memory on this rank.
 
-    if (rank == 0)
+    if (generate_input)
     {
-        rand_vector(v1, SIZE);
-        rand_vector(v2, SIZE);
-
-        total_sum = 0;
+        // This rank's elements of v1 and v2 straight from the generator.
+        rng_fill_slice(v1_sub, displs[rank], partition, RNG_SEED_A, 100);
+        rng_fill_slice(v2_sub, displs[rank], partition, RNG_SEED_B, 100);
     }
+    else if (rank == 0)
+    {
+        // Only the head node holds the full vectors.
+        v1 = (int*) malloc(SIZE * sizeof(int));
+        v2 = (int*) malloc(SIZE * sizeof(int));
+        v3 = (int*) malloc(SIZE * sizeof(int));
+        local_mb += 3.0 * SIZE * sizeof(int) / (1024 * 1024);
+
+        rand_vector(v1, SIZE, RNG_SEED_A);
+        rand_vector(v2, SIZE, RNG_SEED_B);
+    }
+    total_sum = 0;
 
     auto start = high_resolution_clock::now();
 
-    if (rank == 0)
+    if (!generate_input)
     {
-        printf("%s Broadcast %d elements::Sending instructions\n"
-        ,name, SIZE);
+        if (rank == 0)
+        {
+            printf("%s Broadcast %d elements::Sending instructions\n"
+            ,name, SIZE);
+        }
+        MPI_Scatterv(v1, counts, displs, MPI_INT, v1_sub, partition, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Scatterv(v2, counts, displs, MPI_INT, v2_sub, partition, MPI_INT, 0, MPI_COMM_WORLD);
     }
-    MPI_Scatter(v1, partition, MPI_INT, v1_sub, partition, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Scatter(v2, partition, MPI_INT, v2_sub, partition, MPI_INT, 0, MPI_COMM_WORLD);
+    double setup_time = duration_cast<microseconds>(high_resolution_clock::now() - setup_start).count() / 1000.0;
 
-    int local_sum = 0;
+    long long local_sum = 0;
     local_sum = vector_add(v1_sub, v2_sub, v3_sub, partition);
 
-    MPI_Gather(v3_sub, partition, MPI_INT, v3, partition, MPI_INT, 0, MPI_COMM_WORLD);
+    // With --generate v3 stays spread over the ranks, only the sum comes back.
+    if (!generate_input)
+    {
+        MPI_Gatherv(v3_sub, partition, MPI_INT, v3, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    }
     printf(" P%d has completed adding %d elements.\"\n", rank, partition);
 
-    MPI_Reduce(&local_sum, &total_sum, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_sum, &total_sum, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Slowest setup and largest footprint over the ranks.
+    double local[2] = {setup_time, local_mb}, largest[2];
+    MPI_Reduce(local, largest, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
     if (rank == 0)
     {
@@ -96,15 +134,19 @@ int main(int argc, char** argv)
         cout << "Total time taken: " << duration.count()
             << " milliseconds (" << duration.count()/1000.0
             << " seconds).\n Total sum: " << total_sum << endl;
+        printf(" Data setup: %.1f milliseconds, %s.\n Largest per-rank vector memory: %.1f MB.\n", largest[0],
+            generate_input ? "each rank generated its own elements" : "generated on the head node and scattered", largest[1]);
     }
 
     // Freeing the allocated memory.
-    free(v1); v1 = NULL;
+    free(v1); v1 = NULL; // NULL on the workers and with --generate.
     free(v2); v2 = NULL;
     free(v3); v3 = NULL;
     free(v1_sub); v1_sub = NULL;
     free(v2_sub); v2_sub = NULL;
     free(v3_sub); v3_sub = NULL;
+    free(counts); counts = NULL;
+    free(displs); displs = NULL;
 
     // Finalize the MPI environment
     MPI_Finalize();
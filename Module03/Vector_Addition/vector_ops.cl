@@ -24,3 +24,41 @@ __kernel void add_vector(const int size, __global int* v1, __global int* v2, __g
 
     v3[globalIndex] = v1[globalIndex] + v2[globalIndex];
 }
+
+// Fused addition and sum. Each work-item adds its elements (v3 = v1 + v2, kept on the
+// device) and sums them in a 64-bit long, striding by the global size so any vector
+// length works with a fixed number of work-groups. The work-group then halves its
+// partial sums in __local memory (a tree, log2(local size) steps) and work-item 0
+// writes one partial per work-group. The local size must be a power of two.
+__kernel void add_reduce_vector(const int size, __global const int* v1, __global const int* v2,
+                                __global int* v3, __global long* partials, __local long* scratch) {
+
+    // Thread identifiers
+    const int localIndex = get_local_id(0);
+
+    // Add and sum this work-item's elements.
+    long sum = 0;
+    for (size_t i = get_global_id(0); i < (size_t)size; i += get_global_size(0))
+    {
+        int v = v1[i] + v2[i];
+        v3[i] = v;
+        sum += v;
+    }
+    scratch[localIndex] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Tree reduction of the work-group's partial sums.
+    for (int stride = get_local_size(0) / 2; stride > 0; stride /= 2)
+    {
+        if (localIndex < stride)
+        {
+            scratch[localIndex] += scratch[localIndex + stride];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (localIndex == 0)
+    {
+        partials[get_group_id(0)] = scratch[0];
+    }
+}
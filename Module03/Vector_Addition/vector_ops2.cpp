@@ -1,33 +1,56 @@
 // COMPILE COMMAND: g++ vector_ops2.cpp -o vec2 -lOpenCL
+// RUN: ./vec2 [size] [repeats] [--zero-copy] [--stream [queues]] [--host-sum]
+    // Repeats run the addition again on the same runtime and pooled buffers. Run it
+    // twice to compare a cold start (kernels compiled) with a warm one (cached binaries).
+    // --zero-copy wraps the host vectors instead of copying them (see setup_kernel_memory).
+    // --stream adds the vectors chunk by chunk over several queues (see stream_vectors), this is
+    // automatic when a vector is bigger than the device's largest allocation.
+    // The sum is reduced on the device and only one partial per work-group comes back,
+    // --host-sum also reads v3 back and checks the total against sum_vec.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <CL/cl.h>
 #include <cstdlib>
+#include <cstring>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include "../../Common/ocl_runtime.h" // Persistent OpenCL runtime with a program binary cache.
+#include "../../Common/rng.h" // Counter-based random numbers.
 
 #define PRINT 1
+#define STREAM_QUEUES 2 // Default number of command queues used by --stream.
+#define STREAM_CHUNK_MAX (32 << 20) // Largest chunk in bytes, smaller chunks overlap sooner.
+#define REDUCE_LOCAL 256 // Work-items per work-group in the reduction (a power of two).
+#define REDUCE_GROUPS 1024 // Most work-groups (and partial sums) per kernel launch.
 
 using namespace std;
 using namespace std::chrono;
 
 int SZ = 150000000;
 int *v1, *v2, *v3; // Creating addition Pointers & corrosponding buffers below.
+bool zero_copy = false; // --zero-copy: buffers use the host vectors in place, v3 is never uploaded.
+int stream_queues = 0; // --stream: number of command queues for the chunked add, 0 for one pass.
+bool host_sum = false; // --host-sum: also read v3 back and check the device total against sum_vec.
+long long total = 0; // Sum of v3, added up from the work-group partials.
+size_t reduce_local = REDUCE_LOCAL; // Work-group size of the reduction, limited by the device.
 
 // THE FOLLOWING DECLARATIONS ARE: (Data_type Variable_name) which are initialised later in the code.
 //Comment: Declares a buffer memory object variable which is needed for standard OpenCl API calls.
 cl_mem bufV1, bufV2, bufV3;
-//Comment: Declares an ID variable for the current active device and stores it in "device_id".
-cl_device_id device_id;
-//Comment: Declares a context object which is the environment in which the kernel is executed and memory managment is defined.
-cl_context context;
-//Comment: Declares a program object that will consist of a set of kernels identified with the "kernel" qualifier.
-cl_program program;
+//Comment: Buffer for the partial sums, one 64-bit long per work-group.
+cl_mem bufPartial;
+//Comment: The OpenCL runtime owns the device, context, command queue, programs and the buffer pool.
+    // It is created once and reused by every repeat.
+OclRuntime *ocl = NULL;
 //Comment: Declares a kernal object which will encapsulate the specific __kernel function.
 cl_kernel kernel;
-//Comment: Declares a Command Queue object. Memory, program and kernel objects are created using a context. Operations
+//Comment: The runtime's command queue. Memory, program and kernel objects are created using a context. Operations
     // on these objects are performed using a command queue.
 cl_command_queue queue;
+//Comment: Extra command queues used by --stream, also owned by the runtime.
+vector<cl_command_queue> stream_queue;
 //Comment: Declares an empty event object. Event objects can be used to track the status of a command.
 cl_event event = NULL;
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -35,39 +58,55 @@ cl_event event = NULL;
 int err; // A variable to hold error codes.
 
 // THE FOLLOWING DECLARATIONS ARE: Function signatures/prototypes defining parameters and return types.
-//Comment: Function to create a device and return the device ID.
-cl_device_id create_device();
-//Comment: One of the main functions; Creates the device, defines the context, creates the command queue and kernel.
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname);
-//Comment: Function to define the program setting the context, device, and passing the file name. Returns program object.
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename);
-//Comment: Function to define the buffer object and write the buffer object to the host memory (command queue).
+//Comment: Function to take buffers from the runtime's pool and write the vectors to them (command queue).
 void setup_kernel_memory();
+//Comment: Function to hand the buffers back to the pool for the next repeat.
+void release_kernel_memory();
 //Comment: Function to set the argument values for a specific argument of multiple kernels.
 void copy_kernel_args();
+//Comment: Function to add the whole vectors in one pass.
+void add_vectors();
+//Comment: Function to return the number of work-groups (and partial sums) for n elements.
+size_t reduce_groups(size_t n);
+//Comment: Function to pick the chunk size (in elements) for streaming from the device's memory limits.
+size_t stream_chunk(int queues);
+//Comment: Function to add the vectors chunk by chunk on several command queues, overlapping the copies and kernels.
+void stream_vectors(int queues);
 //Comment: Function to free all allocated memory for buffers and all objects.
 void free_memory();
 
 // More function signatures:
     // Initialise the vector & print the vector.
-void init(int *&A, int size);
+void init(int *&A, int size, uint64_t seed);
 void print(int *A, int size);
-int sum_vec(int *vec, int size);
+long long sum_vec(int *vec, int size);
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // Main method
 int main(int argc, char **argv)
 {
-    if (argc > 1)
-        SZ = atoi(argv[1]);
-
-    init(v1, SZ);
-    init(v2, SZ);
-    init(v3, SZ);
+    int repeats = 1, numbers = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--zero-copy") == 0)
+            zero_copy = true;
+        else if (strcmp(argv[i], "--host-sum") == 0)
+            host_sum = true;
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            stream_queues = STREAM_QUEUES;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                stream_queues = max(2, atoi(argv[++i]));
+        }
+        else if (numbers++ == 0)
+            SZ = atoi(argv[i]);
+        else
+            repeats = atoi(argv[i]);
+    }
 
-    //Comment: Defines the global work size i.e. allocates a region of global memory that remains constant
-        // during the execution of a kernel and is accessible to all work itmes executing in a context.
-    size_t global[1] = {(size_t)SZ};
+    init(v1, SZ, RNG_SEED_A);
+    init(v2, SZ, RNG_SEED_B);
+    init(v3, SZ, RNG_SEED_C);
 
     //initial vector
     //print(v1, SZ); //Printing of vectors for testing.
@@ -75,48 +114,78 @@ int main(int argc, char **argv)
 
     auto start = high_resolution_clock::now();
 
-    setup_openCL_device_context_queue_kernel((char *)"./vector_ops.cl", (char *)"add_vector");
-
-    setup_kernel_memory();
-    copy_kernel_args();
-
-    //Comment: Enqueues a command to execute a kernel on a device, returns cl_int. Parameters;
-        // Queue: The command queue itself, a valid host command-queue defined around line 200.
-        // Kernel: The kernel object that holds the main kernal function.
-        // 1: The number of dimensions used to specify the global work items in the work group.
-        // NULL: The global work-offset, NULL indicates that the global IDs start at offset (0, 0, 0)
-        // Global: The Global work size as defined above on line 65.
-        // 0: The local work size.
-        // NULL: The number of events in the wiat list. NULL indicates that the that this event will
-            // not wait on any other event to complete.
-        // Event: Returns an event object which can be used to identify a partiqular kernel instance.
-            // Ass event is set to NULL above, no event will be created for this instance.
-    clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global, NULL, 0, NULL, &event);
-    clWaitForEvents(1, &event);
+    //Comment: Creates the device, context and command queue once, then builds (or loads the cached
+        // binary of) vector_ops.cl and creates the kernel.
+    ocl = new OclRuntime();
+    queue = ocl->queue();
+    kernel = ocl->kernel("./vector_ops.cl", "add_reduce_vector");
+
+    //Comment: The tree reduction needs a power of two work-group size the kernel can run with.
+    size_t kernel_local;
+    clGetKernelWorkGroupInfo(kernel, ocl->device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_local), &kernel_local, NULL);
+    while (reduce_local > kernel_local && reduce_local > 1)
+        reduce_local /= 2;
+
+    //Comment: A vector bigger than the largest buffer the device can allocate can only be streamed.
+        // Zero-copy buffers over shared host memory are still limited to that size.
+    cl_ulong max_alloc;
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+    if (stream_queues == 0 && (cl_ulong)SZ * sizeof(int) > max_alloc)
+    {
+        printf(" %d ints do not fit in one device buffer (max %llu bytes), streaming instead.\n",
+                SZ, (unsigned long long)max_alloc);
+        stream_queues = STREAM_QUEUES;
+    }
+    if (stream_queues > 0 && zero_copy)
+    {
+        printf(" --zero-copy is ignored when streaming.\n");
+        zero_copy = false;
+    }
+    int startup = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
 
-    //Comment: Function command to read from, or write to, a buffer object from host memory. Parameters;
-        // Queue: The command queue itself, a valid host command-queue defined around line 200.
-        // Bufv: The buffer object delared above and defined in set_up_kernal_memory below.
-        // CL_TRUE: Blocking_read, as it is True the read command is blocking, clEnqueueReadBuffer
-            // does not return until the buffer data has been read and copied into memory pointed to by ptr
-        // 0: Offset in bytes in the buffer object to read from and write to.
-        // SZ * sizeof(int): Size of the data in bytes being read or written.
-        // v[0]: Pointer to the buffer in host memory where data is to be read into and written from.
-        // 0: Number of events in waitlist.
-        // NULL: Event waitlist, as num of events is 0, thsi must be NULL.
-        // NULL: Returns an event object, as it is NULL, it will not be possible for the application
-            // to query the status of this command or queue.
-    clEnqueueReadBuffer(queue, bufV3, CL_TRUE, 0, SZ * sizeof(int), &v3[0], 0, NULL, NULL);
+    int duration = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        auto repeat_start = high_resolution_clock::now();
+
+        //Comment: One pass over the whole vectors, or chunk by chunk when they don't fit on the device.
+        if (stream_queues > 0)
+            stream_vectors(stream_queues);
+        else
+            add_vectors();
+
+        int repeat_time = duration_cast<milliseconds>(high_resolution_clock::now() - repeat_start).count();
+        if (repeats > 1)
+        {
+            const char *note = (zero_copy && ocl->shares_host_memory()) ? " (host vectors wrapped)"
+                               : r == 0 ? " (buffers created)" : " (pooled buffers)";
+            printf(" Repeat %d: %d milliseconds%s\n", r + 1, repeat_time, note);
+        }
+    }
 
     auto stop = high_resolution_clock::now();
-    int duration = duration_cast<milliseconds>(stop - start).count();
-    int sum = sum_vec(v3, SZ);
+    duration = duration_cast<milliseconds>(stop - start).count();
 
     //result vector
     // print(v3, SZ);
-    printf("Total Number of Elements: %d. The Total Sum: %d\n", SZ, sum);
+    printf("Total Number of Elements: %d. The Total Sum: %lld\n", SZ, total);
+    if (host_sum)
+    {
+        long long check = sum_vec(v3, SZ);
+        printf(" Host sum of v3: %lld (%s)\n", check, check == total ? "matches" : "MISMATCH");
+    }
     printf(" Total processing time: %d milliseconds.\n\t    In seconds: %f\n",
             duration, duration/1000.0);
+    printf(" OpenCL startup: %d milliseconds.\n ", startup);
+    if (stream_queues > 0)
+        printf("Streamed in %zu-element chunks on %d queues: %.2f GB/s (%d x %d ints moved per repeat).\n ",
+                stream_chunk(stream_queues), stream_queues,
+                (host_sum ? 3.0 : 2.0) * SZ * sizeof(int) * repeats / (max(duration, 1) / 1000.0) / 1e9,
+                host_sum ? 3 : 2, SZ);
+    if (zero_copy)
+        printf("Zero-copy buffers: %zu bytes copied (%s)\n ", ocl->bytes_copied,
+                ocl->shares_host_memory() ? "device shares host memory" : "pinned host buffers");
+    ocl->print_startup("");
 
     //frees memory for device, kernel, queue, etc.
     //you will need to modify this to free your own buffers
@@ -126,14 +195,12 @@ int main(int argc, char **argv)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // The Actual Function Implementations from the above signatures.
-void init(int *&A, int size)
+void init(int *&A, int size, uint64_t seed)
 {
-    A = (int *)malloc(sizeof(int) * size);
+    //Comment: Page aligned so zero-copy buffers can use the vector in place.
+    A = (int *)OclRuntime::host_alloc(sizeof(int) * size);
 
-    for (long i = 0; i < size; i++)
-    {
-        A[i] = rand() % 100; // any number less than 100
-    }
+    rng_fill(A, 0, size, seed, 100); // any number less than 100, element i of stream seed
 }
 
 void print(int *A, int size)
@@ -165,9 +232,10 @@ void print(int *A, int size)
     printf("\n----------------------------\n");
 }
 
-int sum_vec(int* vec, int size)
+// Host check of the device total, 64-bit so it can't overflow.
+long long sum_vec(int* vec, int size)
 {
-    int sum = 0;
+    long long sum = 0;
     for (int i=0; i<size; i++)
     {
         sum += vec[i];
@@ -177,16 +245,9 @@ int sum_vec(int* vec, int size)
 
 void free_memory()
 {
-    //free the buffers
-    clReleaseMemObject(bufV1);
-    clReleaseMemObject(bufV2);
-    clReleaseMemObject(bufV3);
-
-    //free opencl objects
-    clReleaseKernel(kernel);
-    clReleaseCommandQueue(queue);
-    clReleaseProgram(program);
-    clReleaseContext(context);
+    //free the buffers and opencl objects, all owned by the runtime
+    delete ocl;
+    ocl = NULL;
 
     free(v1);
     free(v2);
@@ -199,7 +260,7 @@ void copy_kernel_args()
     //Comment: Sets the argument value for a specific argument of a kernel.
             // To execute a kernel, the kernel arguments must be set.
      // Parameters;
-        // Kernel: The kernal object as defined in setup_openCL_device_context_queue_kernel.
+        // Kernel: The kernal object created by the runtime in main.
         // 0: Arg index, Arguments to the kernel are referred by indices that go from 0 for the leftmost argument to n - 1
         // Sizeof(int): Argument size, If the argument is a memory object, the size is the size of the memory object.
         // (void *)&SZ: arg_value is a pointer to data that should be used as the argument value for argument specified by arg_index.
@@ -207,6 +268,9 @@ void copy_kernel_args()
     clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&bufV1);
     clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&bufV2);
     clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&bufV3);
+    clSetKernelArg(kernel, 4, sizeof(cl_mem), (void *)&bufPartial);
+    //Comment: A NULL value with a size allocates that much __local memory for the argument.
+    clSetKernelArg(kernel, 5, reduce_local * sizeof(cl_long), NULL);
 
     if (err < 0)
     {
@@ -218,164 +282,207 @@ void copy_kernel_args()
 
 void setup_kernel_memory()
 {
-    //Comment: Creates the buffer object. Parameters;
-        // Context: A valid OpenCL context used to create the buffer object as defined on line 220.
-        // CL_MEM_READ_WRITE: is a flag, a bit-field that is used to specify allocation and usage
+    //Comment: Zero-copy mode. On a CPU device (or one sharing host memory) the buffers are created with
+        // CL_MEM_USE_HOST_PTR over v1, v2 and v3 and no data moves at all. Other devices get pinned
+        // CL_MEM_ALLOC_HOST_PTR buffers, v1 and v2 are copied in through a map and v3 is left alone.
+    if (zero_copy)
+    {
+        bufV1 = ocl->input_buffer(&v1[0], SZ * sizeof(int));
+        bufV2 = ocl->input_buffer(&v2[0], SZ * sizeof(int));
+        bufV3 = ocl->output_buffer(&v3[0], SZ * sizeof(int));
+        bufPartial = ocl->buffer(REDUCE_GROUPS * sizeof(cl_long), CL_MEM_WRITE_ONLY);
+        return;
+    }
+
+    //Comment: Takes a buffer object from the runtime's pool, created on first use. Parameters;
+        // SZ * sizeof(int): The size in bytes of the buffer memory object needed.
+        // CL_MEM_READ_ONLY: is a flag, a bit-field that is used to specify allocation and usage
             // information such as the memory that should be used to allocate the buffer object and how it will be used.
-            // There seems to be 10 such flages, this one in partiqular specifies that the memory object will be read
-            // and written by a kernel. This is the default.
-        // SZ * sizeof(int): The size in bytes of the buffer memory object to be allocated.
-        // NULL: host_ptr is a pointer to the buffer data that may already be allocated by the application.
-        // NULL: Error code return, NULL means nothing will be returned.
-    bufV1 = clCreateBuffer(context, CL_MEM_READ_WRITE, SZ * sizeof(int), NULL, NULL);
-    bufV2 = clCreateBuffer(context, CL_MEM_READ_WRITE, SZ * sizeof(int), NULL, NULL);
-    bufV3 = clCreateBuffer(context, CL_MEM_READ_WRITE, SZ * sizeof(int), NULL, NULL);
-
-    // Copy vectors to the GPU
+            // There seems to be 10 such flages, this one in partiqular specifies that the memory object will only be
+            // read by a kernel. v3 is CL_MEM_WRITE_ONLY, only ever written by the kernel.
+    bufV1 = ocl->buffer(SZ * sizeof(int), CL_MEM_READ_ONLY);
+    bufV2 = ocl->buffer(SZ * sizeof(int), CL_MEM_READ_ONLY);
+    bufV3 = ocl->buffer(SZ * sizeof(int), CL_MEM_WRITE_ONLY);
+    bufPartial = ocl->buffer(REDUCE_GROUPS * sizeof(cl_long), CL_MEM_WRITE_ONLY);
+
+    // Copy the input vectors to the GPU. v3 is output only, there is nothing to upload.
     clEnqueueWriteBuffer(queue, bufV1, CL_TRUE, 0, SZ * sizeof(int), &v1[0], 0, NULL, NULL);
     clEnqueueWriteBuffer(queue, bufV2, CL_TRUE, 0, SZ * sizeof(int), &v2[0], 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, bufV3, CL_TRUE, 0, SZ * sizeof(int), &v3[0], 0, NULL, NULL);
 }
 
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname)
+void release_kernel_memory()
 {
-    device_id = create_device();
-    cl_int err;
-
-    //Comment: Defines the context, the environment within which kernels execute and in which synchronization
-        // and memory management is defined. Parameters;
-        // NULL: Properties, specifies a list of context property names and their corresponding values
-        // 1: Number of devices.
-        // device_id: devices, a pointer to a list of unique devices returned by clGetDeviceIds.
-        // NULL: pfn_notify is a Callback function, used by the OpenCL implementation to report information
-            // on errors during context creation.
-        // NULL: user_data will be passed as the user_data argument when pfn_notify is called, both are NULL no not relevant here.
-        // err:  Returns int ascociated with error, if err is set to NULL, no error code will be retunred.
-    context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a context");
-        exit(1);
-    }
+    //Comment: Hands the buffers back to the pool, the next repeat reuses them.
+    ocl->release(bufV1);
+    ocl->release(bufV2);
+    ocl->release(bufV3);
+    ocl->release(bufPartial);
+}
 
-    program = build_program(context, device_id, filename);
+void add_vectors()
+{
+    setup_kernel_memory();
+    copy_kernel_args();
 
-    //Comment: Creates a host or device command queue on a specific device.
-        // Parameters:
-            // Context: A valid OpenCL context used to create the buffer object as defined on line 220.
-            // Device: Must be a device or subdevice associated with the context.
-            // Properties (0): Specifies a list of properties for the command-queue and their corresponding values.
-                // The list is terminated with 0
-            // Error code: Returns int ascociated with error, if err is set to NULL, no error code will be retunred.
-    queue = clCreateCommandQueueWithProperties(context, device_id, 0, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a command queue");
-        exit(1);
-    };
+    //Comment: Enqueues a command to execute a kernel on a device, returns cl_int. Parameters;
+        // Queue: The command queue itself, a valid host command-queue defined around line 200.
+        // Kernel: The kernel object that holds the main kernal function.
+        // 1: The number of dimensions used to specify the global work items in the work group.
+        // NULL: The global work-offset, NULL indicates that the global IDs start at offset (0, 0, 0)
+        // Global: The Global work size, whole work-groups, each work item covers every global-size'th element.
+        // Local: The local work size, reduce_local work items share one partial sum.
+        // NULL: The number of events in the wiat list. NULL indicates that the that this event will
+            // not wait on any other event to complete.
+        // Event: Returns an event object which can be used to identify a partiqular kernel instance.
+            // Ass event is set to NULL above, no event will be created for this instance.
+    size_t groups = reduce_groups(SZ);
+    size_t global[1] = {groups * reduce_local};
+    size_t local[1] = {reduce_local};
+    clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global, local, 0, NULL, &event);
+    clWaitForEvents(1, &event);
 
+    //Comment: Only the partial sums come back, one long per work-group, and the host adds them up.
+    cl_long partials[REDUCE_GROUPS];
+    clEnqueueReadBuffer(queue, bufPartial, CL_TRUE, 0, groups * sizeof(cl_long), partials, 0, NULL, NULL);
+    total = 0;
+    for (size_t g = 0; g < groups; g++)
+        total += partials[g];
 
-    kernel = clCreateKernel(program, kernelname, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a kernel");
-        printf("error =%d", err);
-        exit(1);
-    };
+    //Comment: Function command to read from, or write to, a buffer object from host memory. Parameters;
+        // Queue: The command queue itself, a valid host command-queue defined around line 200.
+        // Bufv: The buffer object delared above and defined in set_up_kernal_memory below.
+        // CL_TRUE: Blocking_read, as it is True the read command is blocking, clEnqueueReadBuffer
+            // does not return until the buffer data has been read and copied into memory pointed to by ptr
+        // 0: Offset in bytes in the buffer object to read from and write to.
+        // SZ * sizeof(int): Size of the data in bytes being read or written.
+        // v[0]: Pointer to the buffer in host memory where data is to be read into and written from.
+        // 0: Number of events in waitlist.
+        // NULL: Event waitlist, as num of events is 0, thsi must be NULL.
+        // NULL: Returns an event object, as it is NULL, it will not be possible for the application
+            // to query the status of this command or queue.
+    //Comment: v3 itself is only read back for --host-sum. In zero-copy mode it is mapped instead,
+        // on a CPU device this only waits for the kernel as bufV3 already is v3.
+    if (host_sum && zero_copy)
+        ocl->read_output(bufV3, &v3[0], SZ * sizeof(int));
+    else if (host_sum)
+        clEnqueueReadBuffer(queue, bufV3, CL_TRUE, 0, SZ * sizeof(int), &v3[0], 0, NULL, NULL);
+    clReleaseEvent(event);
+    release_kernel_memory();
 }
 
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename)
+size_t reduce_groups(size_t n)
 {
+    //Comment: Enough work-groups for one element per work item, up to REDUCE_GROUPS. Past that each
+        // work item loops over several elements, which keeps the partials few for big vectors.
+    size_t groups = (n + reduce_local - 1) / reduce_local;
+    return max((size_t)1, min(groups, (size_t)REDUCE_GROUPS));
+}
 
-    cl_program program;
-    FILE *program_handle;
-    char *program_buffer, *program_log;
-    size_t program_size, log_size;
+size_t stream_chunk(int queues)
+{
+    //Comment: Each queue holds three chunk buffers (v1, v2 and v3) on the device. A chunk must fit in
+        // one allocation (CL_DEVICE_MAX_MEM_ALLOC_SIZE) and all of them together in the device's global
+        // memory, with half of it left for everything else. STREAM_CHUNK_MAX keeps chunks small enough that
+        // a copy on one queue starts while a kernel runs on another.
+    cl_ulong max_alloc, global_mem;
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+
+    cl_ulong bytes = min(max_alloc, global_mem / 2 / (3 * queues));
+    bytes = min(bytes, (cl_ulong)STREAM_CHUNK_MAX);
+    size_t chunk = (bytes / sizeof(int)) & ~(size_t)1023; // Whole multiples of 1024 elements.
+    return max(chunk, (size_t)1024);
+}
 
-    /* Read program file and place content into buffer */
-    program_handle = fopen(filename, "r");
-    if (program_handle == NULL)
-    {
-        perror("Couldn't find the program file");
-        exit(1);
-    }
-    fseek(program_handle, 0, SEEK_END);
-    program_size = ftell(program_handle);
-    rewind(program_handle);
-    program_buffer = (char *)malloc(program_size + 1);
-    program_buffer[program_size] = '\0';
-    fread(program_buffer, sizeof(char), program_size, program_handle);
-    fclose(program_handle);
-
-    //Comment: Creates a program object for a context, and loads the source code specified by the text
-        // strings in the strings array into the program object.
-        // Parameters;
-        // ctx: A valid OpenCL context used to create the buffer object as defined on line 220.
-        // 1: cl_unit count.
-        // (const char **)program_buffer: strings is an array of count pointers to optionally null-terminated character strings
-            // that make up the source code.
-        // program_size: lengths argument is an array with the number of chars in
-            // each string (the string length).
-        // err: Returns error code.
-    program = clCreateProgramWithSource(ctx, 1, (const char **)&program_buffer, &program_size, &err);
-    if (err < 0)
+void stream_vectors(int queues)
+{
+    size_t chunk = stream_chunk(queues);
+    size_t chunk_bytes = chunk * sizeof(int);
+
+    //Comment: Each queue gets its own chunk buffers. Queues are created on the first repeat and then reused.
+    while ((int)stream_queue.size() < queues)
+        stream_queue.push_back(ocl->create_queue());
+    vector<cl_mem> a(queues), b(queues), c(queues), p(queues);
+    vector<cl_event> done(queues, (cl_event)NULL); // Read of the last chunk in each queue's buffers.
+    for (int q = 0; q < queues; q++)
     {
-        perror("Couldn't create the program");
-        exit(1);
+        a[q] = ocl->buffer(chunk_bytes, CL_MEM_READ_ONLY);
+        b[q] = ocl->buffer(chunk_bytes, CL_MEM_READ_ONLY);
+        c[q] = ocl->buffer(chunk_bytes, CL_MEM_WRITE_ONLY);
+        p[q] = ocl->buffer(REDUCE_GROUPS * sizeof(cl_long), CL_MEM_WRITE_ONLY);
     }
-    free(program_buffer);
 
-    /* Build program
+    //Comment: Every chunk's partial sums land in their own slice of partials.
+    size_t chunks = (SZ + chunk - 1) / chunk;
+    vector<cl_long> partials(chunks * REDUCE_GROUPS, 0);
 
-   The fourth parameter accepts options that configure the compilation.
-   These are similar to the flags used by gcc. For example, you can
-   define a macro with the option -DMACRO=VALUE and turn off optimization
-   with -cl-opt-disable.
-   */
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (err < 0)
+    //Comment: Chunk k goes to queue k % queues. On each queue the chain is write v1, write v2 -> kernel -> read
+        // the partial sums (and v3 for --host-sum), linked with events, and the writes of a chunk wait for the read of the chunk that used the same buffers
+        // before. Nothing blocks the host, so while one queue copies the next chunk in, another runs its kernel and
+        // a third (or the first again) copies results out.
+    for (size_t offset = 0, k = 0; offset < (size_t)SZ; offset += chunk, k++)
     {
+        int q = k % queues;
+        cl_command_queue cq = stream_queue[q];
+        int n = (int)min(chunk, (size_t)SZ - offset);
+        size_t bytes = n * sizeof(int);
+        cl_event written[2], computed;
+        cl_uint waits = done[q] != NULL ? 1 : 0;
+
+        clEnqueueWriteBuffer(cq, a[q], CL_FALSE, 0, bytes, &v1[offset], waits, waits ? &done[q] : NULL, &written[0]);
+        clEnqueueWriteBuffer(cq, b[q], CL_FALSE, 0, bytes, &v2[offset], waits, waits ? &done[q] : NULL, &written[1]);
+
+        size_t groups = reduce_groups(n);
+        size_t global[1] = {groups * reduce_local};
+        size_t local[1] = {reduce_local};
+        clSetKernelArg(kernel, 0, sizeof(int), (void *)&n);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&a[q]);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&b[q]);
+        clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&c[q]);
+        clSetKernelArg(kernel, 4, sizeof(cl_mem), (void *)&p[q]);
+        clSetKernelArg(kernel, 5, reduce_local * sizeof(cl_long), NULL);
+        err = clEnqueueNDRangeKernel(cq, kernel, 1, NULL, global, local, 2, written, &computed);
+        if (err < 0)
+        {
+            perror("Couldn't enqueue the kernel");
+            printf("error = %d", err);
+            exit(1);
+        }
 
-        /* Find size of log and print to std output */
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG,
-                              0, NULL, &log_size);
-        program_log = (char *)malloc(log_size + 1);
-        program_log[log_size] = '\0';
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG,
-                              log_size + 1, program_log, NULL);
-        printf("%s\n", program_log);
-        free(program_log);
-        exit(1);
+        if (done[q] != NULL)
+            clReleaseEvent(done[q]);
+        if (host_sum)
+        {
+            cl_event result;
+            clEnqueueReadBuffer(cq, c[q], CL_FALSE, 0, bytes, &v3[offset], 1, &computed, &result);
+            clReleaseEvent(computed);
+            computed = result; // The partials read waits for this one, so done covers both.
+        }
+        clEnqueueReadBuffer(cq, p[q], CL_FALSE, 0, groups * sizeof(cl_long), &partials[k * REDUCE_GROUPS],
+                1, &computed, &done[q]);
+        clFlush(cq); // Submit now so this queue's work overlaps the next queue's.
+
+        clReleaseEvent(written[0]);
+        clReleaseEvent(written[1]);
+        clReleaseEvent(computed);
     }
 
-    return program;
-}
+    //Comment: Wait for the last read on every queue, then hand the buffers back to the pool.
+    for (int q = 0; q < queues; q++)
+    {
+        if (done[q] != NULL)
+        {
+            clWaitForEvents(1, &done[q]);
+            clReleaseEvent(done[q]);
+        }
+        ocl->release(a[q]);
+        ocl->release(b[q]);
+        ocl->release(c[q]);
+        ocl->release(p[q]);
+    }
 
-cl_device_id create_device() {
-
-   cl_platform_id platform;
-   cl_device_id dev;
-   int err;
-
-   /* Identify a platform */
-   err = clGetPlatformIDs(1, &platform, NULL);
-   if(err < 0) {
-      perror("Couldn't identify a platform");
-      exit(1);
-   }
-
-   // Access a device
-   // GPU
-   err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
-   if(err == CL_DEVICE_NOT_FOUND) {
-      // CPU
-      printf("GPU not found\n");
-      err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
-   }
-   if(err < 0) {
-      perror("Couldn't access any devices");
-      exit(1);
-   }
-
-   return dev;
+    //Comment: Unused slots of partials are still 0.
+    total = 0;
+    for (size_t i = 0; i < partials.size(); i++)
+        total += partials[i];
 }
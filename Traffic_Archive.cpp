@@ -0,0 +1,464 @@
+// On Mac COMPILE WITH: clang++ -pthread Traffic_Archive.cpp -o archive -std=c++11
+// On Windows COMPILE WITH: g++ -pthread Traffic_Archive.cpp -o archive -std=c++11
+//
+// Block compressed archive for Traffic_SIM "data_file.txt" style history logs.
+// BUILD: ./archive build data_file.txt traffic.arc
+// QUERY: ./archive query traffic.arc <day> <from HHMM> <to HHMM>    (e.g. 1 0600 0700)
+//        ./archive query traffic.arc <from day> <to day>            (whole days)
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+using namespace std::chrono;
+using namespace std;
+
+#define BLOCK_ROWS 1024     // Rows per compressed block.
+#define THREADS 4           // Decoder threads for queries.
+#define ARC_MAGIC 0x43524154 // "TARC"
+#define ARC_VERSION 1
+
+// File header, the block index sits at index_offset (end of the file).
+struct arc_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_rows;
+    uint32_t num_blocks;
+    uint64_t num_rows;
+    uint64_t index_offset;
+};
+
+// Per-block metadata, lets a query skip any block outside its time range.
+struct block_meta
+{
+    uint64_t offset;        // Byte offset of the block payload.
+    uint32_t bytes;         // Payload size in bytes.
+    uint32_t rows;          // Rows in the block.
+    int32_t min_time;       // Time keys are minutes since day 0, 00:00.
+    int32_t max_time;
+    int32_t min_light, max_light;
+    int32_t min_count, max_count;
+};
+
+// A decoded traffic row (same columns as data_file.txt).
+struct traffic_row
+{
+    int32_t day;
+    int32_t time;           // HHMM as written by Traffic_SIM.
+    int32_t light;
+    int32_t count;
+};
+
+// Thread data for parallel block decoding.
+struct decode_data
+{
+    int fd;
+    const vector<block_meta> *index;
+    const vector<int> *selected;    // Indices of the blocks to decode.
+    const vector<uint64_t> *out_pos; // Output row position of each selected block.
+    traffic_row *rows;
+    int start;
+    int stop;
+};
+
+///// Time keys - START /////
+int time_key(int day, int hhmm)
+{
+    return day * 1440 + (hhmm / 100) * 60 + (hhmm % 100);
+}
+
+int key_day(int key) { return key / 1440; }
+int key_hhmm(int key) { return ((key % 1440) / 60) * 100 + (key % 60); }
+///// Time keys - FINISH /////
+
+///// Integer codecs - START /////
+// Number of bits needed to hold value.
+int bit_width(uint32_t value)
+{
+    int bits = 0;
+    while (value != 0)
+    {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+// ZigZag maps signed deltas onto unsigned values so small negatives stay small.
+uint32_t zigzag(int32_t v) { return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31); }
+int32_t unzigzag(uint32_t v) { return (int32_t) (v >> 1) ^ -(int32_t) (v & 1); }
+
+// Packs count values of width bits each onto the end of out.
+void bitpack(const uint32_t *values, int count, int bits, vector<uint8_t> &out)
+{
+    uint64_t acc = 0;
+    int filled = 0;
+    for (int i=0; i<count; i++)
+    {
+        acc |= (uint64_t) values[i] << filled;
+        filled += bits;
+        while (filled >= 8)
+        {
+            out.push_back((uint8_t) acc);
+            acc >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) {out.push_back((uint8_t) acc);}
+    // Padding so the decoder can always do an unaligned 8 byte load.
+    for (int i=0; i<8; i++) {out.push_back(0);}
+}
+
+// Unpacks count values of width bits, adding base to each (frame of reference).
+// Returns a pointer just past the packed data.
+const uint8_t *bitunpack(const uint8_t *in, int count, int bits, int32_t base, int32_t *out)
+{
+    if (bits == 0)
+    {
+        for (int i=0; i<count; i++) {out[i] = base;}
+        return in + 8;
+    }
+
+    const uint64_t mask = (bits == 32) ? 0xffffffffull : ((1ull << bits) - 1);
+    uint64_t bit_pos = 0;
+    for (int i=0; i<count; i++)
+    {
+        uint64_t word;
+        memcpy(&word, in + (bit_pos >> 3), sizeof(word)); // Branch free unaligned load.
+        out[i] = base + (int32_t) ((word >> (bit_pos & 7)) & mask);
+        bit_pos += bits;
+    }
+    return in + ((bit_pos + 7) >> 3) + 8;
+}
+
+// Frame of reference column: min value, bit width, then the packed offsets.
+void encode_for(const int32_t *column, int count, int32_t min_value, int32_t max_value,
+    vector<uint8_t> &out)
+{
+    int bits = bit_width((uint32_t) (max_value - min_value));
+    vector<uint32_t> offsets(count);
+    for (int i=0; i<count; i++)
+    {
+        offsets[i] = (uint32_t) (column[i] - min_value);
+    }
+    out.push_back((uint8_t) bits);
+    bitpack(offsets.data(), count, bits, out);
+}
+
+// Delta column: first value, bit width, then the zigzagged + packed deltas.
+void encode_delta(const int32_t *column, int count, vector<uint8_t> &out)
+{
+    vector<uint32_t> deltas(count);
+    uint32_t widest = 0;
+    deltas[0] = 0;
+    for (int i=1; i<count; i++)
+    {
+        deltas[i] = zigzag(column[i] - column[i-1]);
+        widest |= deltas[i];
+    }
+    int32_t first = column[0];
+    out.insert(out.end(), (uint8_t *) &first, (uint8_t *) &first + sizeof(first));
+    int bits = bit_width(widest);
+    out.push_back((uint8_t) bits);
+    bitpack(deltas.data(), count, bits, out);
+}
+
+const uint8_t *decode_delta(const uint8_t *in, int count, int32_t *column)
+{
+    int32_t first;
+    memcpy(&first, in, sizeof(first));
+    int bits = in[sizeof(first)];
+    in = bitunpack(in + sizeof(first) + 1, count, bits, 0, column);
+
+    // Prefix sum restores the original values.
+    int32_t value = first;
+    column[0] = first;
+    for (int i=1; i<count; i++)
+    {
+        value += unzigzag((uint32_t) column[i]);
+        column[i] = value;
+    }
+    return in;
+}
+///// Integer codecs - FINISH /////
+
+///// Archive building - START /////
+// Reads a data_file.txt style log, each line "day,HHMM,light,count,".
+vector<traffic_row> read_log(string file_name)
+{
+    ifstream in_file(file_name);
+    string line;
+    vector<traffic_row> rows;
+
+    while (getline(in_file, line))
+    {
+        traffic_row row;
+        if (sscanf(line.c_str(), "%d,%d,%d,%d", &row.day, &row.time, &row.light, &row.count) == 4)
+        {
+            rows.push_back(row);
+        }
+    }
+    in_file.close();
+    return rows;
+}
+
+// Compresses one block of rows, filling in its metadata.
+void encode_block(const traffic_row *rows, int count, block_meta &meta, vector<uint8_t> &out)
+{
+    vector<int32_t> times(count), lights(count), counts(count);
+    meta.rows = count;
+    meta.min_time = meta.max_time = time_key(rows[0].day, rows[0].time);
+    meta.min_light = meta.max_light = rows[0].light;
+    meta.min_count = meta.max_count = rows[0].count;
+
+    for (int i=0; i<count; i++)
+    {
+        times[i] = time_key(rows[i].day, rows[i].time);
+        lights[i] = rows[i].light;
+        counts[i] = rows[i].count;
+
+        meta.min_time = min(meta.min_time, times[i]);
+        meta.max_time = max(meta.max_time, times[i]);
+        meta.min_light = min(meta.min_light, lights[i]);
+        meta.max_light = max(meta.max_light, lights[i]);
+        meta.min_count = min(meta.min_count, counts[i]);
+        meta.max_count = max(meta.max_count, counts[i]);
+    }
+
+    // Logs are (mostly) time ordered, so time deltas are tiny.
+    encode_delta(times.data(), count, out);
+    encode_for(lights.data(), count, meta.min_light, meta.max_light, out);
+    encode_for(counts.data(), count, meta.min_count, meta.max_count, out);
+}
+
+// Writes the archive: header, block payloads, then the block index.
+void build_archive(string log_name, string arc_name)
+{
+    auto start = high_resolution_clock::now();
+    vector<traffic_row> rows = read_log(log_name);
+    auto parsed = high_resolution_clock::now();
+
+    ofstream out_file(arc_name, ios::binary);
+    arc_header header;
+    header.magic = ARC_MAGIC;
+    header.version = ARC_VERSION;
+    header.block_rows = BLOCK_ROWS;
+    header.num_rows = rows.size();
+    header.num_blocks = (rows.size() + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    out_file.write((char *) &header, sizeof(header)); // Rewritten once the index offset is known.
+
+    vector<block_meta> index(header.num_blocks);
+    vector<uint8_t> payload;
+    uint64_t offset = sizeof(header);
+
+    for (uint32_t b=0; b<header.num_blocks; b++)
+    {
+        int first = b * BLOCK_ROWS;
+        int count = min((int) BLOCK_ROWS, (int) rows.size() - first);
+
+        payload.clear();
+        encode_block(&rows[first], count, index[b], payload);
+        index[b].offset = offset;
+        index[b].bytes = payload.size();
+
+        out_file.write((char *) payload.data(), payload.size());
+        offset += payload.size();
+    }
+
+    header.index_offset = offset;
+    out_file.write((char *) index.data(), index.size() * sizeof(block_meta));
+    out_file.seekp(0);
+    out_file.write((char *) &header, sizeof(header));
+    out_file.close();
+
+    auto stop = high_resolution_clock::now();
+    uint64_t total_bytes = offset + index.size() * sizeof(block_meta);
+
+    cout << "Archived " << rows.size() << " rows into " << header.num_blocks << " blocks." << endl;
+    cout << " Archive size: " << total_bytes << " bytes ("
+        << (rows.empty() ? 0.0 : (double) total_bytes / rows.size()) << " bytes/row)." << endl;
+    cout << " Text parse time: " << duration_cast<microseconds>(parsed - start).count() << " microseconds." << endl;
+    cout << " Encode time:     " << duration_cast<microseconds>(stop - parsed).count() << " microseconds." << endl;
+}
+///// Archive building - FINISH /////
+
+///// Archive queries - START /////
+// Reads the header and block index (the only full reads a query makes).
+bool read_index(int fd, arc_header &header, vector<block_meta> &index)
+{
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != ARC_MAGIC
+        || header.version != ARC_VERSION)
+    {
+        return false;
+    }
+    index.resize(header.num_blocks);
+    size_t index_bytes = header.num_blocks * sizeof(block_meta);
+    return pread(fd, index.data(), index_bytes, header.index_offset) == (ssize_t) index_bytes;
+}
+
+// DECODER PROCEDURE:
+// Reads and decodes its share of the selected blocks straight into the output rows.
+void *decode_blocks(void *args)
+{
+    decode_data *d_data = (decode_data*) args;
+    vector<uint8_t> payload;
+    vector<int32_t> times(BLOCK_ROWS), lights(BLOCK_ROWS), counts(BLOCK_ROWS);
+
+    for (int s = d_data->start; s < d_data->stop; s++)
+    {
+        const block_meta &meta = (*d_data->index)[(*d_data->selected)[s]];
+        payload.resize(meta.bytes);
+        if (pread(d_data->fd, payload.data(), meta.bytes, meta.offset) != (ssize_t) meta.bytes)
+        {
+            perror("pread");
+            exit(1);
+        }
+
+        const uint8_t *in = payload.data();
+        in = decode_delta(in, meta.rows, times.data());
+        in = bitunpack(in + 1, meta.rows, in[0], meta.min_light, lights.data());
+        in = bitunpack(in + 1, meta.rows, in[0], meta.min_count, counts.data());
+
+        traffic_row *out = d_data->rows + (*d_data->out_pos)[s];
+        for (uint32_t i=0; i<meta.rows; i++)
+        {
+            out[i].day = key_day(times[i]);
+            out[i].time = key_hhmm(times[i]);
+            out[i].light = lights[i];
+            out[i].count = counts[i];
+        }
+    }
+    pthread_exit(NULL);
+}
+
+// Decodes only the blocks overlapping [from_key, to_key], returns the matching rows.
+vector<traffic_row> query_archive(string arc_name, int from_key, int to_key)
+{
+    vector<traffic_row> result;
+    int fd = open(arc_name.c_str(), O_RDONLY);
+    arc_header header;
+    vector<block_meta> index;
+
+    if (fd < 0 || !read_index(fd, header, index))
+    {
+        perror("Couldn't read the archive");
+        exit(1);
+    }
+
+    auto start = high_resolution_clock::now();
+
+    // Block pruning on the time metadata.
+    vector<int> selected;
+    vector<uint64_t> out_pos;
+    uint64_t total_rows = 0;
+    for (uint32_t b=0; b<header.num_blocks; b++)
+    {
+        if (index[b].max_time >= from_key && index[b].min_time <= to_key)
+        {
+            selected.push_back(b);
+            out_pos.push_back(total_rows);
+            total_rows += index[b].rows;
+        }
+    }
+
+    vector<traffic_row> decoded(total_rows);
+
+    // Balanced partition of the selected blocks across the decoder threads.
+    int num_selected = selected.size();
+    int thread_num = min(THREADS, max(num_selected, 1));
+    pthread_t threads[THREADS];
+    decode_data d_data[THREADS];
+
+    for (int i=0; i<thread_num; i++)
+    {
+        d_data[i].fd = fd;
+        d_data[i].index = &index;
+        d_data[i].selected = &selected;
+        d_data[i].out_pos = &out_pos;
+        d_data[i].rows = decoded.data();
+        d_data[i].start = (num_selected * i) / thread_num;
+        d_data[i].stop = (num_selected * (i + 1)) / thread_num;
+        pthread_create(&threads[i], NULL, decode_blocks, &d_data[i]);
+    }
+    for (int i=0; i<thread_num; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Edge blocks may hold rows just outside the range.
+    for (uint64_t i=0; i<total_rows; i++)
+    {
+        int key = time_key(decoded[i].day, decoded[i].time);
+        if (key >= from_key && key <= to_key)
+        {
+            result.push_back(decoded[i]);
+        }
+    }
+
+    auto stop = high_resolution_clock::now();
+    int duration = duration_cast<microseconds>(stop - start).count();
+    close(fd);
+
+    cout << "Decoded " << num_selected << " of " << header.num_blocks << " blocks (" << total_rows
+        << " rows) using " << thread_num << " threads, " << result.size() << " rows matched." << endl;
+    cout << " Query time: " << duration << " microseconds." << endl;
+    if (duration > 0)
+    {
+        cout << " Decode rate: " << (total_rows * sizeof(traffic_row)) / (duration * 1000.0)
+            << " GB/s of decoded rows." << endl;
+    }
+    return result;
+}
+///// Archive queries - FINISH /////
+
+// Prints a summary of the rows returned by a query.
+void print_rows(const vector<traffic_row> &rows)
+{
+    long total = 0;
+    for (size_t i=0; i<rows.size(); i++)
+    {
+        total += rows[i].count;
+    }
+    size_t shown = min(rows.size(), (size_t) 10);
+    for (size_t i=0; i<shown; i++)
+    {
+        printf(" %d,%04d,%d,%d\n", rows[i].day, rows[i].time, rows[i].light, rows[i].count);
+    }
+    if (shown < rows.size()) {cout << " ..." << endl;}
+    cout << " Total Traffic: " << total << " vehicles." << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && string(argv[1]) == "build")
+    {
+        build_archive(argv[2], argv[3]);
+    }
+    else if (argc == 6 && string(argv[1]) == "query") // Hour range within a day.
+    {
+        int day = atoi(argv[3]);
+        print_rows(query_archive(argv[2], time_key(day, atoi(argv[4])), time_key(day, atoi(argv[5]))));
+    }
+    else if (argc == 5 && string(argv[1]) == "query") // Whole day range.
+    {
+        print_rows(query_archive(argv[2], time_key(atoi(argv[3]), 0), time_key(atoi(argv[4]), 2359)));
+    }
+    else
+    {
+        cout << "Usage: " << argv[0] << " build <log.txt> <archive>" << endl;
+        cout << "       " << argv[0] << " query <archive> <day> <from HHMM> <to HHMM>" << endl;
+        cout << "       " << argv[0] << " query <archive> <from day> <to day>" << endl;
+        return 1;
+    }
+
+    return 0;
+}
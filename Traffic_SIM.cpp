@@ -3,6 +3,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -17,12 +22,22 @@ using namespace std;
 
 #define NUM_RESULTS 3       // WARNING: MUST BE 3 or LESS - Number of top most congested lights. 
 
+// Anomaly detection - flags lights whose count strays from their own baseline.
+#define FIRST_LIGHT 1010        // ID of the first light, IDs count on from here.
+#define ANOMALY_ALPHA 0.125f    // EWMA smoothing factor (~8 sample memory).
+#define ANOMALY_Z 3.0f          // Standard deviations before a count is flagged.
+#define ANOMALY_WARMUP 12       // Samples per light before flagging starts (1 hour).
+#define ANOMALY_MAX_SAMPLES 255 // The packed sample count saturates here, well past the warmup.
+#define ANOMALY_BUFFER_SIZE 8   // Anomaly output queue size.
+
 sem_t *buff_avail_count;    // Semaphore to track available space.
 sem_t *consume_flag;        // Semaphore to track available data.
 
 // Naming Semaphores - Mac OS thing (ref below).
 #define BUFFER_COUNT "/buffer_count"
 #define CONSUMER_FLAG "/consumer_flag"
+#define ANOMALY_COUNT "/anomaly_count"
+#define REPORTER_FLAG "/reporter_flag"
 int insert;                 // Tracks buffer insertion position. 
 int extract;                // Tracks buffer extraction position.
 int **buffer;               // The buffer Matrix 
@@ -40,6 +55,31 @@ struct producer_data
    int id;
 };
 
+// A single flagged reading, passed from the consumers to the reporter.
+struct anomaly_data
+{
+   int day;
+   int time;
+   int light;
+   int count;
+   float mean;
+   float deviation;
+};
+
+// Per-light baseline, dense arrays indexed by (Light ID - FIRST_LIGHT).
+// The EWMA mean, variance & sample count are packed into one 64-bit word so
+// consumers can update a light with a single compare-and-swap (no locks):
+// mean float (32 bits) | variance float, low 8 mantissa bits dropped (24 bits) | samples (8 bits).
+atomic<uint64_t> light_stats[NUM_LIGHTS];
+
+sem_t *anomaly_avail_count;           // Semaphore to track space in the anomaly queue.
+sem_t *report_flag;                   // Semaphore to track anomalies waiting to be reported.
+pthread_mutex_t anomaly_lock;         // Guards the anomaly queue insertion position.
+anomaly_data anomaly_buffer[ANOMALY_BUFFER_SIZE]; // The anomaly output queue.
+int anomaly_insert;                   // Tracks anomaly queue insertion position.
+int anomaly_extract;                  // Tracks anomaly queue extraction position.
+int anomaly_total;                    // Number of anomalies reported.
+
 ///// Functions/Procedures to generate fake traffic data file - START /////
 string get_day(int value) // Switch to select Day
 {
@@ -353,6 +393,114 @@ void record_results(int **matrix, int indx)
     }
 }
 
+// Packs / unpacks a lights EWMA mean & variance into a single 64-bit word.
+uint64_t pack_stats(float mean, float var, int samples)
+{
+    uint32_t m, v;
+    memcpy(&m, &mean, sizeof(float));
+    memcpy(&v, &var, sizeof(float));
+    return ((uint64_t) m << 32) | (v & 0xFFFFFF00u) | (uint32_t) samples;
+}
+
+void unpack_stats(uint64_t word, float &mean, float &var, int &samples)
+{
+    uint32_t m = (uint32_t) (word >> 32), v = (uint32_t) word & 0xFFFFFF00u;
+    memcpy(&mean, &m, sizeof(float));
+    memcpy(&var, &v, sizeof(float));
+    samples = (int) (word & 0xFF);
+}
+
+// Zeros the per-light baselines.
+void prep_baselines()
+{
+    for (int i=0; i<NUM_LIGHTS; i++)
+    {
+        light_stats[i].store(pack_stats(0.0f, 0.0f, 0));
+    }
+}
+
+// Folds a reading into the lights baseline (lock-free), returns true if the
+// reading deviates more than ANOMALY_Z standard deviations from the baseline.
+bool update_baseline(int *row, anomaly_data &flagged)
+{
+    int idx = row[2] - FIRST_LIGHT;
+    if (idx < 0 || idx >= NUM_LIGHTS)
+    {
+        return false; // Unknown light, no baseline to test against.
+    }
+    float count = (float) row[3];
+
+    uint64_t old_word = light_stats[idx].load(memory_order_relaxed);
+    uint64_t new_word;
+    float mean, var, diff;
+    int samples;
+    bool outlier;
+    do
+    {
+        // The count comes from the same word as the stats, so the warmup test and
+        // the first-sample case always see every reading folded in before this one.
+        unpack_stats(old_word, mean, var, samples);
+        diff = count - mean;
+        // Tested against the baseline before this reading is folded in.
+        outlier = samples >= ANOMALY_WARMUP && diff * diff > ANOMALY_Z * ANOMALY_Z * var;
+
+        float new_mean = count, new_var = 0.0f;
+        if (samples != 0)
+        {
+            float incr = ANOMALY_ALPHA * diff;
+            new_mean = mean + incr;
+            new_var = (1.0f - ANOMALY_ALPHA) * (var + diff * incr);
+        }
+        new_word = pack_stats(new_mean, new_var, samples < ANOMALY_MAX_SAMPLES ? samples + 1 : samples);
+    } // On a lost race old_word is reloaded and the update is recomputed.
+    while (!light_stats[idx].compare_exchange_weak(old_word, new_word, memory_order_relaxed));
+
+    if (outlier)
+    {
+        flagged.day = row[0];
+        flagged.time = row[1];
+        flagged.light = row[2];
+        flagged.count = row[3];
+        flagged.mean = mean;
+        flagged.deviation = sqrtf(var);
+    }
+    return outlier;
+}
+
+// Places a flagged reading on the anomaly output queue.
+void push_anomaly(anomaly_data &flagged)
+{
+    sem_wait(anomaly_avail_count);
+
+    pthread_mutex_lock(&anomaly_lock);
+    anomaly_buffer[anomaly_insert] = flagged;
+    anomaly_insert = (anomaly_insert+1)%ANOMALY_BUFFER_SIZE;
+    pthread_mutex_unlock(&anomaly_lock);
+
+    sem_post(report_flag);
+}
+
+// REPORTER PROCEDURE:
+// Drains the anomaly queue until a reading with Light ID -1 (stop signal) arrives.
+void *reporter(void *)
+{
+    while (true)
+    {
+        sem_wait(report_flag);
+        // Single reporter, so extraction needs no lock.
+        anomaly_data flagged = anomaly_buffer[anomaly_extract];
+        anomaly_extract = (anomaly_extract+1)%ANOMALY_BUFFER_SIZE;
+        sem_post(anomaly_avail_count);
+
+        if (flagged.light == -1) {break;}
+
+        anomaly_total++;
+        printf("Reporter: ANOMALY -> Time: %d ID: %d Count: %d (baseline %.1f +/- %.1f)\n",
+            flagged.time, flagged.light, flagged.count, flagged.mean, flagged.deviation);
+    }
+    pthread_exit(NULL);
+}
+
 // PRODUCER PROCEDURE: 
 // Pulls data from Matrix and places into buffer for consumers. 
 void *producer(void *args)
@@ -399,6 +547,7 @@ void *consumer(void *args)
         pthread_mutex_lock(&mutex_lock);
         // Extract Traffic data from buffer.
         temp[0] = buffer[extract];
+        int *row = temp[0]; // Rows in data_m are never modified, safe outside the lock.
         // Pass the date to update max congestion.
         record_results(temp, 0);
         printf("Consumer %d: Removed Data -> Time: %d ID: %d from %d\n", *(
@@ -410,6 +559,13 @@ void *consumer(void *args)
         pthread_mutex_unlock(&mutex_lock);
         // Flag position available 
         sem_post(buff_avail_count);
+
+        // Anomaly stage - runs outside the critical section.
+        anomaly_data flagged;
+        if (update_baseline(row, flagged))
+        {
+            push_anomaly(flagged);
+        }
     }
     pthread_exit(NULL);
 }
@@ -421,6 +577,7 @@ int main()
     create_input_data(true); // Update to TRUE if Global Values Changed.
     alloc_mem();            // Allocates required memory 
     prep_result_m();        // Prepares results matrix 
+    prep_baselines();       // Zeros the per-light anomaly baselines
 
     read_file("data_file.txt"); // Reads in the fake traffic data from file. 
 
@@ -435,11 +592,12 @@ int main()
     }
 
     // Creating an array of producers & consumers + producer_data structs.
-    pthread_t produce[num_producers], consume[NUM_CONSUMERS];
+    pthread_t produce[num_producers], consume[NUM_CONSUMERS], report;
     producer_data p_data[num_producers];
 
-    // Initialising Mutex Lock
+    // Initialising Mutex Locks
     pthread_mutex_init(&mutex_lock, NULL);
+    pthread_mutex_init(&anomaly_lock, NULL);
 
     // Initialising Buffer availability Semaphore for producers to fill.
     if ((buff_avail_count = sem_open(BUFFER_COUNT, O_CREAT, 0660, BUFFER_SIZE)) == SEM_FAILED) // 0644
@@ -455,6 +613,21 @@ int main()
         exit (1);
     }
 
+    // Initialising anomaly queue Semaphores for the consumers & reporter.
+    if ((anomaly_avail_count = sem_open(ANOMALY_COUNT, O_CREAT, 0660, ANOMALY_BUFFER_SIZE)) == SEM_FAILED)
+    {
+        perror ("sem_open"); // Catches error
+        exit (1);
+    }
+    if ((report_flag = sem_open(REPORTER_FLAG, O_CREAT, 0660, 0)) == SEM_FAILED)
+    {
+        perror ("sem_open"); // Catches error
+        exit (1);
+    }
+
+    // Creates and runs the anomaly reporter.
+    pthread_create(&report, NULL, reporter, NULL);
+
     // Initialises Producer threads setting the partitions for each.
     for(int i = 0; i < num_producers; i++) 
     {
@@ -488,8 +661,15 @@ int main()
         pthread_join(consume[i], NULL);
     }
 
-    // Destroy Mutex lock once done. 
+    // Consumers are finished, signal the reporter to stop.
+    anomaly_data stop_signal;
+    stop_signal.light = -1;
+    push_anomaly(stop_signal);
+    pthread_join(report, NULL);
+
+    // Destroy Mutex locks once done. 
     pthread_mutex_destroy(&mutex_lock);
+    pthread_mutex_destroy(&anomaly_lock);
 
     // Unlink / Destroy Semaphores once finished. 
     if (sem_unlink("/buffer_count") == -1) 
@@ -502,9 +682,21 @@ int main()
         perror("sem_unlink");
         exit(EXIT_FAILURE);
     }
+    if (sem_unlink(ANOMALY_COUNT) == -1) 
+    {
+        perror("sem_unlink");
+        exit(EXIT_FAILURE);
+    }
+    if (sem_unlink(REPORTER_FLAG) == -1) 
+    {
+        perror("sem_unlink");
+        exit(EXIT_FAILURE);
+    }
 
     // Prints the results to the console. 
     print_results();
+    cout << "\n~~ Anomalies Flagged (> " << ANOMALY_Z << " std. dev. from light baseline): "
+        << anomaly_total << " ~~" << endl;
     cout << "\n" << endl;
 
     // Deallocates memory.